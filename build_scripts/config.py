@@ -1,6 +1,7 @@
 # config = 'release'
 # arch = 'i686'
 imageType = 'disk'
+# diskBus = 'virtio'
 imageFS = 'fat32'
 # imageSize = '250m'
 toolchain = '../CxxToolchain'
@@ -9,3 +10,6 @@ toolchain = '../CxxToolchain'
 # guestfs - uses libguestfs, doesn't need sudo
 # mount - uses mount, requires sudo
 mountMethod = 'guestfs'
+
+# boot-time benchmarks (kernel/bench)
+# benchmarks = True
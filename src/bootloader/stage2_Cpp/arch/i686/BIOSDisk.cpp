@@ -89,7 +89,10 @@ size_t BIOSDisk::Read(uint8_t* data, size_t size) {
 }
 
 bool BIOSDisk::ReadNextSector() {
-    uint64_t lba = m_Position / BIOSSectorSize;
+    return ReadSector(m_Position / BIOSSectorSize, m_Buffer);
+}
+
+bool BIOSDisk::ReadSector(uint64_t lba, uint8_t* buffer) {
     bool ok = false;
 
     if (m_HasExtensions) {
@@ -97,7 +100,7 @@ bool BIOSDisk::ReadNextSector() {
         params.ParamsSize = sizeof(ExtendedDriveParameters);
         params._Reserved = 0x0;
         params.Count = 1;
-        params.Buffer = ToSegOffset(m_Buffer);
+        params.Buffer = ToSegOffset(buffer);
         params.LBA = lba;
 
         for (int i = 0; i < 3 && !ok; i++) {
@@ -109,7 +112,7 @@ bool BIOSDisk::ReadNextSector() {
         LBA2CHS(lba, &cyl, &sec, &head);
 
         for (int i = 0; i < 3 && !ok; i++) {
-            ok = i686_DiskRead(m_ID, cyl, sec, head, 1, m_Buffer);
+            ok = i686_DiskRead(m_ID, cyl, sec, head, 1, buffer);
             if (!ok) i686_DiskReset(m_ID);
         }
     }
@@ -117,11 +120,33 @@ bool BIOSDisk::ReadNextSector() {
     return ok;
 }
 
+bool BIOSDisk::ReadBlocks(uint64_t lba, size_t count, const IOVec* iov, size_t iov_count) {
+    if (IOVecLength(iov, iov_count) != count * BIOSSectorSize) return false;
+
+    // The BIOS only reaches low memory, so every sector is bounced; m_Buffer keeps the Read cursor's sector
+    size_t index = 0, offset = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!ReadSector(lba + i, m_BlockBuffer)) return false;
+
+        for (size_t copied = 0; copied < BIOSSectorSize;) {
+            while (offset == iov[index].length) {
+                index++;
+                offset = 0;
+            }
+            size_t length = min<size_t>(BIOSSectorSize - copied, iov[index].length - offset);
+            Memory::Copy(static_cast<uint8_t*>(iov[index].base) + offset, m_BlockBuffer + copied, length);
+            copied += length;
+            offset += length;
+        }
+    }
+    return true;
+}
+
 size_t BIOSDisk::Write(const uint8_t* data, size_t size) {
     return -1;
 }
 
-bool BIOSDisk::Seek(int rel, SeekPos pos) {
+bool BIOSDisk::Seek(int64_t rel, SeekPos pos) {
     bool ok = true;
     switch (pos) {
         case SeekPos::Set:
@@ -140,11 +165,11 @@ bool BIOSDisk::Seek(int rel, SeekPos pos) {
     return ok;
 }
 
-size_t BIOSDisk::Position() {
+uint64_t BIOSDisk::Position() {
     return m_Position;
 }
 
-size_t BIOSDisk::Size() {
+uint64_t BIOSDisk::Size() {
     return m_Size;
 }
 
@@ -11,14 +11,17 @@ public:
 
     virtual size_t Read(uint8_t* data, size_t size) override;        
     virtual size_t Write(const uint8_t* data, size_t size) override; 
-    virtual bool Seek(int rel, SeekPos pos) override;
-    virtual size_t Position() override;
-    virtual size_t Size() override;
+    virtual bool Seek(int64_t rel, SeekPos pos) override;
+    virtual uint64_t Position() override;
+    virtual uint64_t Size() override;
+
+    virtual bool ReadBlocks(uint64_t lba, size_t count, const IOVec* iov, size_t iov_count) override;
     
     bool Initialize();
 
 private:
     bool ReadNextSector();
+    bool ReadSector(uint64_t lba, uint8_t* buffer);
     void LBA2CHS(uint32_t LBA, uint16_t* cyl, uint16_t* sec, uint16_t* head);
 
     uint8_t m_ID;
@@ -29,6 +32,7 @@ private:
     uint16_t m_Heads;
 
     uint8_t m_Buffer[BIOSSectorSize];
+    uint8_t m_BlockBuffer[BIOSSectorSize];
     uint32_t m_Position;
     size_t m_Size;
     
@@ -49,7 +49,8 @@ EXPORT void ASMCALL Start(uint16_t bootDrive, uint32_t partition_segoff) {
         Debug::Debug("Stage2", "Partition SegOff: %x", partition_segoff);
         Debug::Debug("Stage2", "Partition Linear: %x", ToLinear<void*>(partition_segoff));
         MBR_Entry* entry = ToLinear<MBR_Entry*>(partition_segoff);
-        partitionRange.Initialize(&disk, entry->LBA_Start, entry->SectorCount);
+        partitionRange.Initialize(&disk, static_cast<uint64_t>(entry->LBA_Start) * BIOSSectorSize,
+                                  static_cast<uint64_t>(entry->SectorCount) * BIOSSectorSize);
         partition = &partitionRange;
         Debug::Debug("Stage2", "Partition Sector Count: %d", entry->SectorCount);
     }
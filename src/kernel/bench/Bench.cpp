@@ -0,0 +1,33 @@
+#include "Bench.hpp"
+
+#include <core/Debug.hpp>
+#include <core/arch/i686/IO.hpp>
+#include <core/arch/i686/Timer.hpp>
+
+namespace Bench {
+    namespace {
+        uint64_t g_CyclesPerMs = 0;
+    }
+
+    uint64_t CyclesPerMs() {
+        if (g_CyclesPerMs) return g_CyclesPerMs;
+
+        constexpr uint32_t CalibrationMs = 50;
+        uint64_t start = arch::i686::ReadTSC();
+        sleep(CalibrationMs);
+        g_CyclesPerMs = (arch::i686::ReadTSC() - start) / CalibrationMs;
+        if (!g_CyclesPerMs) g_CyclesPerMs = 1;
+
+        Debug::Info("Bench", "TSC calibrated: %llu cycles/ms", g_CyclesPerMs);
+        return g_CyclesPerMs;
+    }
+
+    uint64_t CyclesToUs(uint64_t cycles) {
+        return cycles * 1000 / CyclesPerMs();
+    }
+
+    uint64_t PerSecond(uint64_t count, uint64_t cycles) {
+        if (!cycles) return 0;
+        return count * CyclesPerMs() * 1000 / cycles;
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <core/arch/i686/PagingManager.hpp>
+#include <core/arch/i686/Disk.hpp>
+#include <core/dev/VirtioBlk.hpp>
+#include <core/fs/FATFileSystem.hpp>
+
+// Boot-time benchmarks. They are only run when the kernel is built with `scons benchmarks=1`.
+namespace Bench {
+    // TSC cycles per millisecond, calibrated against the PIT on first use.
+    uint64_t CyclesPerMs();
+    uint64_t CyclesToUs(uint64_t cycles);
+    // Converts `count` operations over `cycles` TSC cycles into operations per second.
+    uint64_t PerSecond(uint64_t count, uint64_t cycles);
+
+    void RunHeapBenchmark();
+    // Maps the same range with 4 KiB and 4 MiB pages and compares mapping cost, table memory and TLB misses.
+    void RunPagingBenchmark(PagingManager& paging);
+    // memcpy/memset throughput from 16 B to 1 MiB: byte string ops vs the dword and SSE paths.
+    void RunMemoryBenchmark();
+    // Sequential reads of the boot disk: one sector per command, multi-sector PIO commands, DMA, and small
+    // byte-interface reads with and without readahead.
+    void RunDiskBenchmark(Disk& disk);
+    // Random and sequential single-sector reads, issued one by one vs sorted and merged by a BlockQueue.
+    void RunBlockQueueBenchmark(Disk& disk);
+    // Sequential virtio-blk reads from 4 KiB to 1 MiB per call, and a call scattered over sector-sized pieces,
+    // with the number of requests, notifications and interrupts each took.
+    void RunVirtioBlkBenchmark(VirtioBlk& disk);
+    // Appends to a file in 4 KiB, 64 KiB and 4 MiB writes, synced at the end, then truncates it back.
+    void RunFileWriteBenchmark(FATFileSystem& fs);
+}
@@ -0,0 +1,232 @@
+#include "Bench.hpp"
+
+#include <core/Debug.hpp>
+#include <core/cpp/Memory.hpp>
+#include <core/cpp/Algorithm.hpp>
+#include <core/arch/i686/IO.hpp>
+#include <core/dev/BlockQueue.hpp>
+
+namespace {
+    constexpr const char* LogModule = "DiskBench";
+    constexpr size_t BenchBytes = 8 * 1024 * 1024;
+    constexpr size_t ChunkBytes = 64 * 1024;
+    // Single-sector requests per block queue run, and the span the random ones are spread over
+    constexpr size_t QueueRequests = 512;
+    constexpr uint64_t RandomSpanSectors = 64 * 1024;
+    constexpr size_t VirtioMaxCall = 1024 * 1024;
+
+    // Also logs and restarts the disk's command latency histogram, so it covers exactly one run
+    void Report(Disk& disk, const char* name, size_t bytes, size_t commands, uint64_t cycles) {
+        Debug::Info(LogModule, "%s: %u commands, %llu us, %llu KiB/s",
+            name, commands, Bench::CyclesToUs(cycles), Bench::PerSecond(bytes, cycles) / 1024);
+        disk.LogLatencyHistogram(LogModule);
+        disk.ResetLatencyHistogram();
+    }
+
+    uint32_t XorShift(uint32_t& state) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    // Reads `lbas` one sector per command in submission order; `travel` gets the LBA distance covered
+    bool ReadDirect(Disk& disk, const uint64_t* lbas, uint8_t* buffer, uint64_t& travel) {
+        uint64_t head = 0;
+        travel = 0;
+        for (size_t i = 0; i < QueueRequests; i++) {
+            travel += lbas[i] > head ? lbas[i] - head : head - lbas[i];
+            if (!disk.ReadSectors(lbas[i], buffer + i * Disk::BytesPerSector, 1)) return false;
+            head = lbas[i] + 1;
+        }
+        return true;
+    }
+
+    bool ReadQueued(BlockQueue& queue, const uint64_t* lbas, BlockRequest* requests, uint8_t* buffer) {
+        queue.ResetStats();
+        for (size_t i = 0; i < QueueRequests; i++) {
+            requests[i] = BlockRequest{ lbas[i], 1, buffer + i * Disk::BytesPerSector, false, nullptr, nullptr };
+            queue.Submit(&requests[i]);
+        }
+        return queue.Run();
+    }
+}
+
+void Bench::RunDiskBenchmark(Disk& disk) {
+    uint8_t* buffer = static_cast<uint8_t*>(zmalloc(ChunkBytes));
+    if (!buffer) {
+        Debug::Error(LogModule, "Failed to allocate the benchmark buffer");
+        return;
+    }
+
+    size_t bytes = static_cast<size_t>(min<uint64_t>(BenchBytes, disk.Size()));
+    bytes -= bytes % ChunkBytes;
+    uint32_t sectors = bytes / Disk::BytesPerSector;
+    uint32_t chunk_sectors = ChunkBytes / Disk::BytesPerSector;
+    Debug::Info(LogModule, "Sequential read of the first %u KiB of the boot disk", bytes / 1024);
+
+    bool dma = disk.DMAEnabled();
+    disk.UseDMA(false);
+    disk.ResetLatencyHistogram();
+
+    // What the driver did before: one READ SECTORS command and one DRQ wait per sector
+    uint64_t start = arch::i686::ReadTSC();
+    for (uint32_t lba = 0; lba < sectors; lba++) {
+        if (!disk.ReadSectors(lba, buffer + (lba % chunk_sectors) * Disk::BytesPerSector, 1)) {
+            Debug::Error(LogModule, "Read failed at LBA %u", lba);
+            disk.UseDMA(dma);
+            zfree(buffer);
+            return;
+        }
+    }
+    Report(disk, "1 sector per command", bytes, sectors, arch::i686::ReadTSC() - start);
+
+    start = arch::i686::ReadTSC();
+    for (uint32_t lba = 0; lba < sectors; lba += chunk_sectors)
+        disk.ReadSectors(lba, buffer, chunk_sectors);
+    Report(disk, "64 KiB per command, PIO", bytes, sectors / chunk_sectors, arch::i686::ReadTSC() - start);
+
+    disk.UseDMA(dma);
+    if (dma) {
+        start = arch::i686::ReadTSC();
+        for (uint32_t lba = 0; lba < sectors; lba += chunk_sectors)
+            disk.ReadSectors(lba, buffer, chunk_sectors);
+        Report(disk, "64 KiB per command, DMA", bytes, sectors / chunk_sectors, arch::i686::ReadTSC() - start);
+    }
+
+    // Through the byte interface the file system uses; aligned reads bypass the sector buffer
+    uint64_t position = disk.Position();
+    disk.Seek(0, SeekPos::Set);
+    start = arch::i686::ReadTSC();
+    for (size_t offset = 0; offset < bytes; offset += ChunkBytes)
+        disk.Read(buffer, ChunkBytes);
+    Report(disk, "Disk::Read, 64 KiB calls", bytes, sectors / chunk_sectors, arch::i686::ReadTSC() - start);
+
+    // Small unaligned reads go through the sector buffer: one sector per miss vs the readahead window
+    constexpr size_t SmallRead = 100;
+    size_t small_bytes = bytes / 8;
+    for (uint32_t window : { 1u, Disk::ReadaheadCapacity }) {
+        disk.SetReadahead(window);
+        disk.ResetReadaheadStats();
+        disk.ResetLatencyHistogram();
+        disk.Seek(0, SeekPos::Set);
+        start = arch::i686::ReadTSC();
+        for (size_t offset = 0; offset < small_bytes; offset += SmallRead)
+            disk.Read(buffer, SmallRead);
+        uint64_t cycles = arch::i686::ReadTSC() - start;
+        Debug::Info(LogModule, "Disk::Read, %u-byte calls, readahead up to %u sectors: %llu us, %llu KiB/s",
+            SmallRead, window, Bench::CyclesToUs(cycles), Bench::PerSecond(small_bytes, cycles) / 1024);
+        disk.LogReadaheadStats(LogModule);
+    }
+    disk.SetReadahead(Disk::ReadaheadCapacity);
+    disk.ResetLatencyHistogram();
+    disk.Seek(position, SeekPos::Set);
+
+    zfree(buffer);
+}
+
+void Bench::RunBlockQueueBenchmark(Disk& disk) {
+    uint8_t* buffer = static_cast<uint8_t*>(zmalloc(QueueRequests * Disk::BytesPerSector));
+    uint64_t* lbas = static_cast<uint64_t*>(zmalloc(QueueRequests * sizeof(uint64_t)));
+    BlockRequest* requests = static_cast<BlockRequest*>(zmalloc(QueueRequests * sizeof(BlockRequest)));
+    if (!buffer || !lbas || !requests) {
+        Debug::Error(LogModule, "Failed to allocate the block queue benchmark buffers");
+        zfree(buffer);
+        zfree(lbas);
+        zfree(requests);
+        return;
+    }
+
+    BlockQueue queue;
+    queue.Initialize(&disk, QueueRequests);
+    uint64_t span = min<uint64_t>(RandomSpanSectors, disk.SectorCount());
+    Debug::Info(LogModule, "%u single-sector reads, random over %llu sectors and sequential", QueueRequests, span);
+
+    uint32_t seed = 0x2545F491;
+    for (size_t i = 0; i < QueueRequests; i++)
+        lbas[i] = XorShift(seed) % span;
+
+    for (int sequential = 0; sequential < 2; sequential++) {
+        if (sequential) {
+            for (size_t i = 0; i < QueueRequests; i++)
+                lbas[i] = i;
+        }
+        const char* order = sequential ? "sequential" : "random";
+        disk.ResetLatencyHistogram();
+
+        uint64_t travel;
+        uint64_t start = arch::i686::ReadTSC();
+        if (!ReadDirect(disk, lbas, buffer, travel)) {
+            Debug::Error(LogModule, "Direct %s reads failed", order);
+            break;
+        }
+        uint64_t cycles = arch::i686::ReadTSC() - start;
+        Debug::Info(LogModule, "%s, submission order: head travel %llu sectors", order, travel);
+        Report(disk, "  one command per request", QueueRequests * Disk::BytesPerSector, QueueRequests, cycles);
+
+        start = arch::i686::ReadTSC();
+        if (!ReadQueued(queue, lbas, requests, buffer)) {
+            Debug::Error(LogModule, "Queued %s reads failed", order);
+            break;
+        }
+        cycles = arch::i686::ReadTSC() - start;
+        Debug::Info(LogModule, "%s, block queue: head travel %llu sectors", order, queue.HeadTravel());
+        queue.LogStats(LogModule);
+        Report(disk, "  C-LOOK and merged", QueueRequests * Disk::BytesPerSector, queue.Dispatches(), cycles);
+    }
+
+    zfree(requests);
+    zfree(lbas);
+    zfree(buffer);
+}
+
+void Bench::RunVirtioBlkBenchmark(VirtioBlk& disk) {
+    uint8_t* buffer = static_cast<uint8_t*>(zmalloc(VirtioMaxCall));
+    IOVec* pieces = static_cast<IOVec*>(zmalloc(ChunkBytes / VirtioBlk::BytesPerSector * sizeof(IOVec)));
+    if (!buffer || !pieces) {
+        Debug::Error(LogModule, "Failed to allocate the virtio-blk benchmark buffers");
+        zfree(buffer);
+        zfree(pieces);
+        return;
+    }
+
+    size_t bytes = static_cast<size_t>(min<uint64_t>(BenchBytes, disk.Size()));
+    bytes -= bytes % VirtioMaxCall;
+    Debug::Info(LogModule, "Sequential virtio-blk read of the first %u KiB", bytes / 1024);
+
+    for (size_t call : { size_t(4 * 1024), ChunkBytes, VirtioMaxCall }) {
+        size_t blocks = call / VirtioBlk::BytesPerSector;
+        IOVec iov{ buffer, call };
+        disk.ResetStats();
+        uint64_t start = arch::i686::ReadTSC();
+        for (size_t offset = 0; offset < bytes; offset += call) {
+            if (!disk.ReadBlocks(offset / VirtioBlk::BytesPerSector, blocks, &iov, 1)) {
+                Debug::Error(LogModule, "virtio-blk read failed at byte %u", offset);
+                break;
+            }
+        }
+        uint64_t cycles = arch::i686::ReadTSC() - start;
+        Debug::Info(LogModule, "%u KiB per call: %llu us, %llu KiB/s", call / 1024, Bench::CyclesToUs(cycles), Bench::PerSecond(bytes, cycles) / 1024);
+        disk.LogStats(LogModule);
+    }
+
+    // The shape of a buffer cache flush: every sector its own piece, spread over the buffer in reverse
+    size_t piece_count = ChunkBytes / VirtioBlk::BytesPerSector;
+    for (size_t i = 0; i < piece_count; i++)
+        pieces[i] = IOVec{ buffer + (piece_count - 1 - i) * 2 * VirtioBlk::BytesPerSector, VirtioBlk::BytesPerSector };
+    disk.ResetStats();
+    uint64_t start = arch::i686::ReadTSC();
+    for (size_t offset = 0; offset < bytes; offset += ChunkBytes) {
+        if (!disk.ReadBlocks(offset / VirtioBlk::BytesPerSector, piece_count, pieces, piece_count)) {
+            Debug::Error(LogModule, "Scattered virtio-blk read failed at byte %u", offset);
+            break;
+        }
+    }
+    uint64_t cycles = arch::i686::ReadTSC() - start;
+    Debug::Info(LogModule, "64 KiB per call in %u pieces: %llu us, %llu KiB/s", piece_count, Bench::CyclesToUs(cycles), Bench::PerSecond(bytes, cycles) / 1024);
+    disk.LogStats(LogModule);
+    disk.ResetStats();
+
+    zfree(pieces);
+    zfree(buffer);
+}
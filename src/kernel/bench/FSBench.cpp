@@ -0,0 +1,63 @@
+#include "Bench.hpp"
+
+#include <core/Debug.hpp>
+#include <core/cpp/Memory.hpp>
+#include <core/cpp/Algorithm.hpp>
+#include <core/arch/i686/IO.hpp>
+#include <core/dev/BufferCache.hpp>
+
+namespace {
+    constexpr const char* LogModule = "FSBench";
+    constexpr const char* BenchFile = "/test.txt";
+    constexpr size_t BenchBytes = 8 * 1024 * 1024;
+    constexpr size_t MaxAppend = 4 * 1024 * 1024;
+}
+
+void Bench::RunFileWriteBenchmark(FATFileSystem& fs) {
+    File* file = fs.Open(BenchFile, FileOpenMode::Append);
+    if (!file) {
+        Debug::Error(LogModule, "Failed to open %s", BenchFile);
+        return;
+    }
+
+    // The appended data is cut off again after every run, so the file ends up as it was
+    uint32_t original = file->Size();
+    uint32_t cluster_bytes = fs.Data().BS.BootSector.SectorsPerCluster * SectorSize;
+    size_t bytes = static_cast<size_t>(min<uint64_t>(BenchBytes, static_cast<uint64_t>(fs.FreeClusterCount()) * cluster_bytes / 2));
+    bytes -= bytes % MaxAppend;
+    uint8_t* buffer = static_cast<uint8_t*>(zmalloc(MaxAppend));
+    if (!bytes || !buffer) {
+        Debug::Error(LogModule, "Not enough free clusters or memory for the write benchmark");
+        zfree(buffer);
+        file->Release();
+        return;
+    }
+    for (size_t i = 0; i < MaxAppend; i++)
+        buffer[i] = static_cast<uint8_t>(i * 7);
+    Debug::Info(LogModule, "Appending %u KiB to %s, synced at the end", bytes / 1024, BenchFile);
+
+    for (size_t append : { size_t(4 * 1024), size_t(64 * 1024), MaxAppend }) {
+        file->Seek(0, SeekPos::End);
+        g_BufferCache.ResetStats();
+        uint64_t start = arch::i686::ReadTSC();
+        for (size_t offset = 0; offset < bytes; offset += append) {
+            if (file->Write(buffer, append) != append) {
+                Debug::Error(LogModule, "Append failed at byte %u", offset);
+                break;
+            }
+        }
+        bool synced = fs.Sync();
+        uint64_t cycles = arch::i686::ReadTSC() - start;
+        if (!synced) Debug::Error(LogModule, "Sync after the appends failed");
+
+        Debug::Info(LogModule, "%u KiB appends: %llu us, %llu KiB/s", append / 1024, Bench::CyclesToUs(cycles), Bench::PerSecond(bytes, cycles) / 1024);
+        g_BufferCache.LogStats(LogModule);
+        if (!file->Resize(original)) {
+            Debug::Error(LogModule, "Failed to truncate %s back to %u bytes", BenchFile, original);
+            break;
+        }
+    }
+
+    file->Release();
+    zfree(buffer);
+}
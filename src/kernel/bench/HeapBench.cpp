@@ -0,0 +1,61 @@
+#include "Bench.hpp"
+
+#include <core/ZosDefs.hpp>
+#include <core/Debug.hpp>
+#include <core/cpp/Memory.hpp>
+#include <core/arch/i686/IO.hpp>
+
+namespace {
+    constexpr const char* LogModule = "HeapBench";
+    constexpr size_t LiveSlots = 256;
+    constexpr size_t Iterations = 50000;
+
+    uint32_t NextRandom(uint32_t& state) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    // Keeps LiveSlots allocations alive and replaces a random one per iteration,
+    // so every iteration is exactly one free and one malloc.
+    uint64_t RunWorkload(uint32_t min_size, uint32_t max_size) {
+        void* slots[LiveSlots] = {};
+        uint32_t rng = 0x2545F491;
+
+        uint64_t start = arch::i686::ReadTSC();
+        for (size_t i = 0; i < Iterations; i++) {
+            size_t slot = NextRandom(rng) % LiveSlots;
+            zfree(slots[slot]);
+            slots[slot] = zmalloc(min_size + NextRandom(rng) % (max_size - min_size + 1));
+        }
+        for (size_t i = 0; i < LiveSlots; i++)
+            zfree(slots[i]);
+
+        return arch::i686::ReadTSC() - start;
+    }
+}
+
+void Bench::RunHeapBenchmark() {
+    struct {
+        const char* name;
+        uint32_t min_size, max_size;
+    } workloads[] = {
+        { "small  (16-256 B)",   16,  256 },
+        { "packet (64-1536 B)",  64, 1536 },
+        { "mixed  (16-2048 B)",  16, 2048 },
+    };
+
+    Debug::Info(LogModule, "%u malloc/free pairs per run, %u live allocations", Iterations, LiveSlots);
+    for (size_t i = 0; i < _countof(workloads); i++) {
+        Mem_SetSlabEnabled(false);
+        uint64_t heap_cycles = RunWorkload(workloads[i].min_size, workloads[i].max_size);
+        Mem_SetSlabEnabled(true);
+        uint64_t slab_cycles = RunWorkload(workloads[i].min_size, workloads[i].max_size);
+
+        Debug::Info(LogModule, "%s: heap only %llu allocs/s (%llu cycles/op), with slab %llu allocs/s (%llu cycles/op)",
+            workloads[i].name,
+            PerSecond(Iterations, heap_cycles), heap_cycles / Iterations,
+            PerSecond(Iterations, slab_cycles), slab_cycles / Iterations);
+    }
+}
@@ -0,0 +1,71 @@
+#include "Bench.hpp"
+
+#include <core/Debug.hpp>
+#include <core/arch/i686/IO.hpp>
+#include <core/arch/i686/FrameAllocator.hpp>
+
+namespace {
+    constexpr const char* LogModule = "PagingBench";
+
+    // The low 16 MiB are mapped a second and third time into otherwise unused kernel space, and unmapped afterwards
+    constexpr uintptr_t BenchPhysBase = 0x00000000;
+    constexpr size_t BenchSize = FrameAllocator::LOW_MEMORY_LIMIT;
+    constexpr uintptr_t SmallPagesVirt = 0xC8000000;
+    constexpr uintptr_t LargePagesVirt = 0xCC000000;
+
+    struct MappingResult {
+        uint64_t mapCycles;
+        uint64_t sweepCycles;
+        uint64_t unmapCycles;
+        size_t frames;
+        size_t framesReclaimed;
+    };
+
+    // Reads one dword per 4 KiB page with a cold TLB, so every page costs a TLB lookup.
+    uint64_t Sweep(PagingManager& paging, uintptr_t virt_base) {
+        paging.InstallPageDirectory();
+
+        uint64_t start = arch::i686::ReadTSC();
+        for (uintptr_t offset = 0; offset < BenchSize; offset += PAGE_SIZE)
+            (void)*reinterpret_cast<volatile uint32_t*>(virt_base + offset);
+        return arch::i686::ReadTSC() - start;
+    }
+
+    template<typename MapFn>
+    MappingResult Measure(PagingManager& paging, uintptr_t virt_base, MapFn map) {
+        MappingResult result{};
+        size_t frames_before = FrameAllocator::UsedFrames();
+
+        uint64_t start = arch::i686::ReadTSC();
+        map();
+        result.mapCycles = arch::i686::ReadTSC() - start;
+        result.frames = FrameAllocator::UsedFrames() - frames_before;
+        result.sweepCycles = Sweep(paging, virt_base);
+
+        size_t frames_mapped = FrameAllocator::UsedFrames();
+        start = arch::i686::ReadTSC();
+        paging.UnmapRange(virt_base, BenchSize);
+        result.unmapCycles = arch::i686::ReadTSC() - start;
+        result.framesReclaimed = frames_mapped - FrameAllocator::UsedFrames();
+        return result;
+    }
+}
+
+void Bench::RunPagingBenchmark(PagingManager& paging) {
+    MappingResult small = Measure(paging, SmallPagesVirt, [&]() {
+        // What MapRange did before large pages: one PTE and one invlpg per 4 KiB
+        for (uintptr_t offset = 0; offset < BenchSize; offset += PAGE_SIZE)
+            paging.MapPage(BenchPhysBase + offset, SmallPagesVirt + offset, PAGE_PRESENT | PAGE_READWRITE);
+    });
+    MappingResult large = Measure(paging, LargePagesVirt, [&]() {
+        paging.MapRange(BenchPhysBase, LargePagesVirt, BenchSize, PAGE_PRESENT | PAGE_READWRITE);
+    });
+
+    Debug::Info(LogModule, "Mapping %u MiB:", BenchSize / 1024 / 1024);
+    Debug::Info(LogModule, "4 KiB pages: map %llu cycles (%llu us), %u page table frames, cold sweep %llu cycles",
+        small.mapCycles, CyclesToUs(small.mapCycles), small.frames, small.sweepCycles);
+    Debug::Info(LogModule, "4 MiB pages: map %llu cycles (%llu us), %u page table frames, cold sweep %llu cycles",
+        large.mapCycles, CyclesToUs(large.mapCycles), large.frames, large.sweepCycles);
+    Debug::Info(LogModule, "Batched unmap: %llu cycles (4 KiB) / %llu cycles (4 MiB), %u page table frames reclaimed",
+        small.unmapCycles, large.unmapCycles, small.framesReclaimed + large.framesReclaimed);
+}
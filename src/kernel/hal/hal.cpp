@@ -14,6 +14,7 @@
 #include <core/arch/i686/RTC.hpp>
 #include <core/arch/i686/FrameAllocator.hpp>
 #include <core/arch/i686/PagingManager.hpp>
+#include <core/arch/i686/IO.hpp>
 
 arch::i686::E9Device g_E9Device{};
 TextDevice e9_debug{ &g_E9Device };
@@ -29,71 +30,98 @@ arch::i686::E9Device* GetGlobalE9Device() {
     return &g_E9Device;
 }
 
+namespace {
+    PagingManager g_KernelPagingManager{};
+
+    constexpr uintptr_t KERNEL_HEAP_BASE = 0xD0000000;
+    constexpr size_t KERNEL_HEAP_MAX = 0xF0000000 - KERNEL_HEAP_BASE; // PCI BARs are mapped from 0xF0000000
+    constexpr size_t KERNEL_HEAP_INITIAL = 4 * 1024 * 1024;
+
+    // Real-mode IVT, BDA, stage2 and its data (including the memory map), EBDA, video memory and the BIOS
+    constexpr uintptr_t LOW_MEMORY_RESERVED = 0x100000;
+
+    // Everything in [KERNEL_HEAP_BASE, g_HeapBreak) belongs to the heap, but is only backed by frames once touched
+    uintptr_t g_HeapBreak = KERNEL_HEAP_BASE;
+
+    constexpr uint32_t PAGE_FAULT_PRESENT = (1 << 0);
+
+    // Cost of building the boot page tables, logged once the debug output is up
+    uint64_t g_BootMappingCycles = 0;
+    size_t g_BootMappingFrames = 0;
+}
+
 void PageFaultHandler(ISR::Registers* regs) {
     uint32_t faulting_address;
     asm volatile("mov %%cr2, %0" : "=r"(faulting_address));
+
+    if (!(regs->error & PAGE_FAULT_PRESENT) && faulting_address >= KERNEL_HEAP_BASE && faulting_address < g_HeapBreak) {
+        uintptr_t frame = FrameAllocator::Allocate();
+        if (frame) {
+            g_KernelPagingManager.MapPage(frame, faulting_address & ~(PAGE_SIZE - 1), PAGE_PRESENT | PAGE_READWRITE);
+            return;
+        }
+        Debug::Critical("PageFault", "Out of frames while backing heap page '0x%X'", faulting_address);
+    }
+
     Debug::Critical("PageFault", "Page fault at addr '0x%X'", faulting_address);
     arch::i686::PANIC();
 }
 
-PagingManager InitializeMMU(BootParams* bootparams, uintptr_t& kernel_heap_base, MemoryRegion& best_region) {
-    PagingManager pagingManager(bootparams->Memory);
-
-    pagingManager.IdentityMapRange(0x00, 16 * 1024 * 1024, PAGE_PRESENT | PAGE_READWRITE);
-
-    extern uint32_t KERNEL_START;
-    extern uint32_t KERNEL_END;
+extern uint32_t KERNEL_START;
+extern uint32_t KERNEL_END;
 
-    uintptr_t kernel_phys_base = reinterpret_cast<uintptr_t>(&KERNEL_START);
-    constexpr uintptr_t kernel_virt_base = 0xC0000000;
-    size_t kernel_size = reinterpret_cast<uintptr_t>(&KERNEL_END) - kernel_phys_base;
-    pagingManager.MapRange(kernel_phys_base, kernel_virt_base, kernel_size, PAGE_PRESENT | PAGE_READWRITE);
+void InitializePhysicalMemory(BootParams* bootparams) {
+    FrameAllocator::Init(bootparams->Memory);
+    FrameAllocator::Reserve(0, LOW_MEMORY_RESERVED);
 
-    constexpr uint32_t kernel_stack_virt = 0xC0100000;
-    uintptr_t kernel_stack_top = pagingManager.SetupKernelStack(kernel_stack_virt);
+    // The kernel image, which also holds the frame allocator's bitmap in .bss
+    uintptr_t kernel_start = reinterpret_cast<uintptr_t>(&KERNEL_START);
+    uintptr_t kernel_end = reinterpret_cast<uintptr_t>(&KERNEL_END);
+    FrameAllocator::Reserve(kernel_start, kernel_end - kernel_start);
+}
 
-    kernel_heap_base = 0xD0000000;
-    size_t region_idx = 0;
-    best_region = FindBestRegion(&bootparams->Memory, /*out*/ region_idx);
+// Moves the kernel heap's break up by `increment` bytes and returns the old break, or nullptr if the window is exhausted.
+// Nothing is mapped here, pages are faulted in on first use.
+void* KernelHeapSbrk(size_t increment) {
+    increment = ALIGN_UP(increment, PAGE_SIZE);
+    if (increment > KERNEL_HEAP_BASE + KERNEL_HEAP_MAX - g_HeapBreak) return nullptr;
+    if (increment / PAGE_SIZE > FrameAllocator::FreeFrames()) return nullptr;
 
-    assert(best_region.Length > kernel_size && "Best memory region is smaller than kernel size!");
+    uintptr_t old_break = g_HeapBreak;
+    g_HeapBreak += increment;
+    return reinterpret_cast<void*>(old_break);
+}
 
-    uintptr_t usable_begin = best_region.Begin + kernel_size;
-    uintptr_t usable_length = best_region.Length - kernel_size;
+void InitializeMMU(BootParams* bootparams) {
+    InitializePhysicalMemory(bootparams);
 
-    constexpr float FRAME_RATIO = 1.f/10.f;
+    size_t frames_before = FrameAllocator::UsedFrames();
+    uint64_t mapping_start = arch::i686::ReadTSC();
 
-    size_t frame_allocator_size = (usable_length * FRAME_RATIO);
-    frame_allocator_size = (frame_allocator_size / PAGE_SIZE) * PAGE_SIZE;
+    PagingManager& pagingManager = g_KernelPagingManager;
+    pagingManager.Initialize();
 
-    size_t heap_size = usable_length - frame_allocator_size;
-    assert(heap_size != 0 && "Usable reegion yeilds zero-sized heap!");
+    pagingManager.IdentityMapRange(0x00, FrameAllocator::LOW_MEMORY_LIMIT, PAGE_PRESENT | PAGE_READWRITE);
 
-    uintptr_t heap_phys_start = usable_begin;
-    uintptr_t frame_phys_start = heap_phys_start + heap_size;
+    uintptr_t kernel_phys_base = reinterpret_cast<uintptr_t>(&KERNEL_START);
+    constexpr uintptr_t kernel_virt_base = 0xC0000000;
+    size_t kernel_size = reinterpret_cast<uintptr_t>(&KERNEL_END) - kernel_phys_base;
+    pagingManager.MapRange(kernel_phys_base, kernel_virt_base, kernel_size, PAGE_PRESENT | PAGE_READWRITE);
 
-    pagingManager.MapRange(heap_phys_start, kernel_heap_base, heap_size, PAGE_PRESENT | PAGE_READWRITE);
+    g_BootMappingCycles = arch::i686::ReadTSC() - mapping_start;
+    g_BootMappingFrames = FrameAllocator::UsedFrames() - frames_before;
 
-    FrameAllocator::Init(frame_phys_start, frame_allocator_size);
+    constexpr uint32_t kernel_stack_virt = 0xC0100000;
+    uintptr_t kernel_stack_top = pagingManager.SetupKernelStack(kernel_stack_virt);
 
     pagingManager.InstallPageDirectory();
     pagingManager.EnablePaging();
 
     asm volatile("mov %0, %%esp" :: "r"(kernel_stack_top));
-
-    best_region.Begin = heap_phys_start;
-    best_region.Length = heap_size;
-    
-    Debug::Info("HAL", "MMU initialized: heap phys=0x%08X size=%u KB, frame phys=0x%08X size=%u KB",
-                heap_phys_start, heap_size / 1024, frame_phys_start, frame_allocator_size / 1024);
-
-    return pagingManager;
 }
 
-PagingManager HAL_Initialize(BootParams* bootparams) {
-    uintptr_t kernel_heap_base = 0;
-    MemoryRegion best_region{ 0 };
-    PagingManager pagingManager = InitializeMMU(bootparams, kernel_heap_base, best_region);
+PagingManager& HAL_Initialize(BootParams* bootparams) {
+    InitializeMMU(bootparams);
     Debug::Init();
     Debug::AddOutputDevice(&vga_text, Debug::DebugLevel::Info, false);
     Debug::AddOutputDevice(&e9_debug, Debug::DebugLevel::Debug, true);
@@ -101,7 +129,13 @@ PagingManager HAL_Initialize(BootParams* bootparams) {
     g_VGADevice.ClearScreen();
     Debug::Info("ZOS", "=-=-=-=-= ZOS KERNEL LOADING =-=-=-=-=");
     Debug::Info("HAL", "Hardware Abstraction Layer beginning initialization...");
-    //Mem_Init(kernel_heap_base, best_region);
+    Debug::Info("HAL", "MMU initialized: %u KB of physical memory available (%u frames)",
+                FrameAllocator::TotalFrames() * FrameAllocator::FRAME_SIZE / 1024, FrameAllocator::TotalFrames());
+    Debug::Info("HAL", "Boot mappings took %llu cycles and %u frames of paging structures", g_BootMappingCycles, g_BootMappingFrames);
+    if (arch::i686::EnableSSE()) {
+        g_MemorySSE = 1;
+        Debug::Info("HAL", "SSE2 enabled, using XMM memcpy/memset");
+    }
     GDT::LoadDefaults();
     IDT::Load();
     ISR::Init();
@@ -110,7 +144,7 @@ PagingManager HAL_Initialize(BootParams* bootparams) {
     RTC::Init(true, true);
     ISR::RegisterHandler(14, PageFaultHandler);
     Debug::Info("HAL", "Initialization finished successfully.");
-    Mem_Init(kernel_heap_base, best_region);
+    Mem_Init(KernelHeapSbrk, KERNEL_HEAP_INITIAL, KERNEL_HEAP_MAX);
 
-    return pagingManager;
+    return g_KernelPagingManager;
 }
@@ -3,4 +3,4 @@
 #include <core/arch/i686/PagingManager.hpp>
 
 // Hardware Abstraction Layer Initialization function
-PagingManager HAL_Initialize(BootParams* bootparams);
\ No newline at end of file
+PagingManager& HAL_Initialize(BootParams* bootparams);
\ No newline at end of file
@@ -14,10 +14,12 @@
 
 #include <core/fs/FATFileSystem.hpp>
 #include <core/dev/RangeBlockDevice.hpp>
+#include <core/dev/BufferCache.hpp>
 #include <core/arch/i686/Disk.hpp>
 
 #include <core/arch/i686/PCI.hpp>
 #include <core/dev/RTL8139.hpp>
+#include <core/dev/VirtioBlk.hpp>
 
 #include <core/arch/i686/Timer.hpp>
 #include <core/arch/i686/RTC.hpp>
@@ -26,6 +28,8 @@
 
 #include <core/net/Net.hpp>
 
+#include <bench/Bench.hpp>
+
 
 #pragma region 
 // libgcc function which calls all global constructors.
@@ -49,10 +53,16 @@ void EoH(int exit_code) {
 extern "C" void KernelEntry(BootParams* bootParams) {
     // Call all global instructors
     _init();
-    PagingManager KernelPagingManager = HAL_Initialize(bootParams);
+    PagingManager& KernelPagingManager = HAL_Initialize(bootParams);
 
     Debug::Info("Kernel Main", "Kernel Initialization Success!");
 
+#ifdef ZOS_BENCHMARKS
+    Bench::RunHeapBenchmark();
+    Bench::RunPagingBenchmark(KernelPagingManager);
+    Bench::RunMemoryBenchmark();
+#endif
+
     RTC::Time time{};
     RTC::GetTime(time);
     time.hour -= 4;
@@ -62,29 +72,77 @@ extern "C" void KernelEntry(BootParams* bootParams) {
 
 
     IOAllocator KernelIOAllocator{};
+    IORange pci_io{ KernelIOAllocator.RequestIORange(PCI::PCI_CONFIG_ADDRESS, 8, false) };
+    PCI pci = PCI(pci_io);
+
     IORange disk_pio_range = KernelIOAllocator.RequestIORange(0x1F0, 8, false);
     Disk disk{ bootParams->BootDevice, &disk_pio_range, true };
-    if (!disk.Initialize()) {
+    bool ata_disk = disk.Initialize();
+
+    // Transitional virtio-blk-pci (`scons run diskBus=virtio`); it holds the boot image when there's no IDE drive
+    IORange virtio_range;
+    VirtioBlk virtio_disk;
+    bool virtio = false;
+    if (PCIDevice* virtio_dev = pci.FindDevice(VirtioBlk::VendorID, VirtioBlk::DeviceID)) {
+        GeneralPCIDevice virtio_pci = GeneralPCIDevice(virtio_dev->Upgrade());
+        uint32_t io_base = virtio_pci.FindIOBase(0);
+        if (io_base) {
+            virtio_range = KernelIOAllocator.RequestIORange(io_base, VirtioBlk::IORangeLength, false);
+            virtio = virtio_disk.Initialize(&virtio_pci, &virtio_range, &KernelPagingManager);
+        }
+    }
+
+    if (!ata_disk && !virtio) {
         Debug::Critical("Kernel Main", "Disk initialization failed!");
         EoH(1);
     }
+    BlockDevice* boot_disk = ata_disk ? static_cast<BlockDevice*>(&disk) : &virtio_disk;
+
+    // PIIX3 IDE controller of the i440FX machine, its BAR4 holds the bus master registers
+    IORange ide_bus_master_range;
+    PCIDevice* ide_dev = ata_disk ? pci.FindDevice(0x8086, 0x7010) : nullptr;
+    if (ide_dev) {
+        GeneralPCIDevice ide_pci = GeneralPCIDevice(ide_dev->Upgrade());
+        uint32_t bus_master_base = ide_pci.FindIOBase(4);
+        if (bus_master_base) {
+            ide_bus_master_range = KernelIOAllocator.RequestIORange(bus_master_base, 8, false);
+            disk.EnableDMA(&ide_pci, &ide_bus_master_range, &KernelPagingManager);
+        }
+    }
+
+#ifdef ZOS_BENCHMARKS
+    if (ata_disk) {
+        Bench::RunDiskBenchmark(disk);
+        Bench::RunBlockQueueBenchmark(disk);
+    }
+    if (virtio) Bench::RunVirtioBlkBenchmark(virtio_disk);
+#endif
     
     BlockDevice* partition;
     RangeBlockDevice partitionRange;
     if (bootParams->BootDevice < 0x80) {
-        partition = &disk;
+        partition = boot_disk;
     } else {
         MBR_entry* entry = ToLinear<MBR_entry*>(reinterpret_cast<uint32_t>(bootParams->PartitionLocation));
-        partitionRange.Initialize(&disk, entry->LBA_Start * Disk::BytesPerSector, entry->SectorCount * Disk::BytesPerSector);
+        partitionRange.Initialize(boot_disk, static_cast<uint64_t>(entry->LBA_Start) * boot_disk->BlockSize(),
+                                  static_cast<uint64_t>(entry->SectorCount) * boot_disk->BlockSize());
         partition = &partitionRange;
     }
 
+    // 512 KiB of cached sectors shared by every mounted file system, written back at most a second after they change
+    g_BufferCache.Initialize(1024);
+    g_BufferCache.SetWriteBack(true);
+
     FATFileSystem fatfs;
     if (!fatfs.Initialize(partition)) {
         Debug::Critical("Kernel Main", "Failed to initialize FATFS");
         EoH(1);
     }
 
+#ifdef ZOS_BENCHMARKS
+    Bench::RunFileWriteBenchmark(fatfs);
+#endif
+
     { // File system demo
         // const char* file_path = "/folder/demo.txt";
         // File* test = fatfs.Open(file_path, FileOpenMode::Read);
@@ -108,9 +166,8 @@ extern "C" void KernelEntry(BootParams* bootParams) {
         // Debug::Info("Kernel Main", "%s contents:\n%s", file_path, text_data.data());
         // test->Release();
     } 
+    g_BufferCache.LogStats("Kernel Main");
 
-    IORange pci_io{ KernelIOAllocator.RequestIORange(PCI::PCI_CONFIG_ADDRESS, 8, false) };
-    PCI pci = PCI(pci_io);
     PCIDevice* rtl8139_dev = pci.FindDevice(0x10EC, 0x8139);
     rtl8139_dev->PrintIDs();
     GeneralPCIDevice rtl8139_pci = GeneralPCIDevice(rtl8139_dev->Upgrade());
@@ -123,7 +180,8 @@ extern "C" void KernelEntry(BootParams* bootParams) {
     
     while (true) {
         std::vector<uint8_t> data;
-        while (!Net::ReceivePayload(data, rtl8139));
+        while (!Net::ReceivePayload(data, rtl8139))
+            g_BufferCache.FlushExpired();
         Debug::Info("Kernel Main", "Received: %.*s", data.size() - 1, data.data());
         if (strncmp(reinterpret_cast<const char*>(data.data()), "quit", 4) == 0) break;
     }
@@ -132,5 +190,7 @@ extern "C" void KernelEntry(BootParams* bootParams) {
     sleep(2500);
     Debug::Info("Kernel Main", "We woke up!");
 
+    if (!fatfs.Sync()) Debug::Error("Kernel Main", "Failed to write back the file system");
+
     EoH(0);
 }
@@ -4,6 +4,12 @@
 #include <core/cpp/Algorithm.hpp>
 #include <core/cpp/Memory.hpp>
 
+#include "IO.hpp"
+#include "IRQ.hpp"
+#include "Timer.hpp"
+#include "FrameAllocator.hpp"
+#include "PagingManager.hpp"
+
 void DecodeATAString(const char* src, char* dst, int length) {
     for (int i = 0; i < length; i += 2) {
         dst[i] = src[i + 1];
@@ -12,49 +18,111 @@ void DecodeATAString(const char* src, char* dst, int length) {
     dst[length] = '\0';
 }
 
-Disk::Disk(uint32_t drive_id, IORange* range, bool ranged) : m_DriveID{ drive_id }, m_Range{ range }, m_UsedByRangedDevice{ ranged } {}
+namespace {
+    constexpr uint8_t ATA_STATUS_ERR = 0x01;
+    constexpr uint8_t ATA_STATUS_DRQ = 0x08;
+    constexpr uint8_t ATA_STATUS_DF = 0x20;
+    constexpr uint8_t ATA_STATUS_BSY = 0x80;
+
+    constexpr uint8_t ATA_READ_SECTORS = 0x20;
+    constexpr uint8_t ATA_WRITE_SECTORS = 0x30;
+    constexpr uint8_t ATA_READ_MULTIPLE = 0xC4;
+    constexpr uint8_t ATA_WRITE_MULTIPLE = 0xC5;
+    constexpr uint8_t ATA_SET_MULTIPLE_MODE = 0xC6;
+    constexpr uint8_t ATA_READ_DMA = 0xC8;
+    constexpr uint8_t ATA_WRITE_DMA = 0xCA;
+
+    // 48-bit variants
+    constexpr uint8_t ATA_READ_SECTORS_EXT = 0x24;
+    constexpr uint8_t ATA_READ_DMA_EXT = 0x25;
+    constexpr uint8_t ATA_READ_MULTIPLE_EXT = 0x29;
+    constexpr uint8_t ATA_WRITE_SECTORS_EXT = 0x34;
+    constexpr uint8_t ATA_WRITE_DMA_EXT = 0x35;
+    constexpr uint8_t ATA_WRITE_MULTIPLE_EXT = 0x39;
+
+    constexpr uint64_t LBA28_LIMIT = 1 << 28;
+    constexpr uint16_t COMMAND_SET_LBA48 = (1 << 10); // word 83
+
+    // Bus master registers of the primary channel, relative to BAR4
+    constexpr IOOffset BM_COMMAND = 0x0;
+    constexpr IOOffset BM_STATUS = 0x2;
+    constexpr IOOffset BM_PRDT = 0x4;
+
+    constexpr uint8_t BM_COMMAND_START = 0x01;
+    constexpr uint8_t BM_COMMAND_READ = 0x08; // the controller writes to memory
+    constexpr uint8_t BM_STATUS_ERROR = 0x02;
+    constexpr uint8_t BM_STATUS_INTERRUPT = 0x04;
+
+    constexpr uint16_t PRD_END_OF_TABLE = 0x8000;
+    constexpr uint32_t COMMAND_TIMEOUT_MS = 5000;
+
+    // Status reads before a wait falls back to sleeping; emulated drives are usually ready within these
+    constexpr int STATUS_SPINS = 64;
+    constexpr uint32_t EFLAGS_IF = (1 << 9);
+}
+
+Disk::Disk(uint32_t drive_id, IORange* range, bool ranged, int irq) : m_DriveID{ drive_id }, m_Range{ range }, m_UsedByRangedDevice{ ranged }, m_IRQ{ irq } {}
 
 size_t Disk::Read(uint8_t* data, size_t size) {
-    size_t initialPosition = m_Position;
     if (!m_Initialized) {
-        ReadNextSector();
         if (!m_UsedByRangedDevice) m_Position = 0;
         m_Initialized = true;
     }
+    uint64_t initialPosition = m_Position;
     if (m_Position >= m_Size) return 0;
+    size = static_cast<size_t>(min<uint64_t>(size, m_Size - m_Position));
 
     while (size > 0) {
         size_t bufferPos = m_Position % BytesPerSector;
+        if (bufferPos == 0 && size >= BytesPerSector) {
+            // Whole sectors go straight into the caller's buffer
+            size_t bytes = size - size % BytesPerSector;
+            if (!ReadSectors(m_Position / BytesPerSector, data, bytes / BytesPerSector)) break;
+            size -= bytes;
+            data += bytes;
+            m_Position += bytes;
+            continue;
+        }
+
+        uint8_t* sector = LoadCurrentSector();
+        if (!sector) break;
         size_t canRead = min(size, BytesPerSector - bufferPos);
-        size_t remaining = m_Size - m_Position;
-        canRead = min(canRead, remaining);
-        Memory::Copy(data, m_Buffer + bufferPos, canRead);
+        Memory::Copy(data, sector + bufferPos, canRead);
         size -= canRead;
         data += canRead;
         m_Position += canRead;
-
-        if (size > 0 && !ReadNextSector()) break;
     }
 
     return m_Position - initialPosition;
 }
 
 size_t Disk::Write(const uint8_t* data, size_t size) {
-    size_t initialPosition = m_Position;
+    uint64_t initialPosition = m_Position;
     if (m_Position >= m_Size) return 0;
+    size = static_cast<size_t>(min<uint64_t>(size, m_Size - m_Position));
 
     while (size > 0) {
         size_t bufferPos = m_Position % BytesPerSector;
+        if (bufferPos == 0 && size >= BytesPerSector) {
+            size_t bytes = size - size % BytesPerSector;
+            uint64_t lba = m_Position / BytesPerSector;
+            if (!WriteSectors(lba, data, bytes / BytesPerSector)) break;
+            size -= bytes;
+            data += bytes;
+            m_Position += bytes;
+            continue;
+        }
+
+        // Partial sectors are read, patched and written back
         size_t canWrite = min(size, BytesPerSector - bufferPos);
-        size_t remaining = m_Size - m_Position;
-        canWrite = min(canWrite, remaining);
+        uint8_t* sector = LoadCurrentSector();
+        if (!sector) break;
 
-        // load current sector if needed
-        if (!ReadNextSector()) break;
+        Memory::Copy(sector + bufferPos, data, canWrite);
 
-        Memory::Copy(m_Buffer + bufferPos, data, canWrite);
-
-        if (!WriteCurrentSector()) break;
+        // Straight through Transfer: the buffered copy is the data being written, so it stays valid
+        IOVec iov{ sector, BytesPerSector };
+        if (!Transfer(m_Position / BytesPerSector, 1, &iov, 1, true)) break;
 
         size -= canWrite;
         data += canWrite;
@@ -64,24 +132,26 @@ size_t Disk::Write(const uint8_t* data, size_t size) {
     return m_Position - initialPosition;
 }
 
-bool Disk::Seek(int rel, SeekPos pos) {
-    uint32_t newPos = 0;
+bool Disk::Seek(int64_t rel, SeekPos pos) {
+    int64_t newPos = 0;
     switch (pos) {
         case SeekPos::Set:      newPos = rel; break;
         case SeekPos::Current:  newPos = m_Position + rel; break;
         case SeekPos::End:      newPos = m_Size - rel; break;
     }
 
-    if (newPos > m_Size || newPos < 0) return false;
+    if (newPos < 0 || static_cast<uint64_t>(newPos) > m_Size) return false;
+    // The sector is only fetched once it's read, most seeks are followed by whole-sector reads
     m_Position = newPos;
-    return ReadNextSector();
+    m_Initialized = true;
+    return true;
 }
 
-size_t Disk::Position() {
+uint64_t Disk::Position() {
     return m_Position;
 }
 
-size_t Disk::Size() {
+uint64_t Disk::Size() {
     return m_Size;
 }
 
@@ -106,10 +176,14 @@ bool Disk::Initialize() {
     m_Range->write<uint8_t>(0x05, 0x00);
     m_Range->write<uint8_t>(0x07, 0xEC);
     
-    uint8_t status;
-    do {
+    uint8_t status = m_Range->read<uint8_t>(0x7);
+    // A floating bus reads all ones, there's no drive that would ever clear BSY
+    if (status == 0xFF) {
+        Debug::Warn("ATA", "No drive on the channel");
+        return false;
+    }
+    while (status & 0x80)
         status = m_Range->read<uint8_t>(0x7);
-    } while (status & 0x80);
     if (!(status & 0x08)) {
         Debug::Critical("ATA", "IDENTIFY failed or is not supported!");
         return false;
@@ -121,73 +195,418 @@ bool Disk::Initialize() {
 
     memcpy(&m_Configuration, ata_identify_buf, sizeof(ATAIdentifyDevice));
 
-    m_Size = BytesPerSector * m_Configuration.LBA28SectorCount;
+    if (!CheckATAIdentify(m_Configuration)) return false;
+
+    // LBA28SectorCount saturates at 2^28 - 1 sectors (128 GiB), the 48-bit count covers the whole drive
+    m_LBA48 = (m_Configuration.CommandSet_Supported2 & COMMAND_SET_LBA48) && m_Configuration.LBA48SectorCount;
+    m_SectorCount = m_LBA48 ? m_Configuration.LBA48SectorCount : m_Configuration.LBA28SectorCount;
+    m_Size = m_SectorCount * BytesPerSector;
     m_Position = -1;
+    Debug::Info("ATA", "%llu sectors (%llu MiB), %s addressing", m_SectorCount, m_Size / (1024 * 1024), m_LBA48 ? "LBA48" : "LBA28");
 
-    return CheckATAIdentify(m_Configuration);
+    // From here on the drive's INTRQ wakes the waits below instead of them spinning
+    IRQ::RegisterHandler(m_IRQ, IRQHandler, this);
+    IRQ::Unmask(2);
+    IRQ::Unmask(m_IRQ);
+
+    SetMultipleMode();
+    return true;
 }
 
-bool Disk::WaitDRQ() {
-    for (int i{ 0 }; i < 1000; i++) {
+bool Disk::SetMultipleMode() {
+    // Only powers of two are valid block sizes
+    uint32_t max_sectors = m_Configuration.MultipleSectorMax & 0xFF;
+    if (max_sectors <= 1 || (max_sectors & (max_sectors - 1))) return false;
+
+    if (!WaitBusy()) return false;
+    m_Range->write<uint8_t>(0x6, 0xE0 | (m_DriveID << 4));
+    m_Range->write<uint8_t>(0x2, (uint8_t)max_sectors);
+    m_Range->write<uint8_t>(0x7, ATA_SET_MULTIPLE_MODE);
+
+    if (!WaitBusy() || (m_Range->read<uint8_t>(0x7) & ATA_STATUS_ERR)) {
+        Debug::Warn("ATA", "SET MULTIPLE MODE (%u sectors) was rejected, using one DRQ block per sector", max_sectors);
+        return false;
+    }
+
+    m_MultipleSectors = max_sectors;
+    Debug::Info("ATA", "READ/WRITE MULTIPLE enabled, %u sectors per block", max_sectors);
+    return true;
+}
+
+bool Disk::WaitStatus(uint8_t mask, uint8_t value) {
+    for (int i{ 0 }; i < STATUS_SPINS; i++) {
         uint8_t status = m_Range->read<uint8_t>(0x7);
-        if (!(status & 0x80) && (status & 0x08)) return true;
-        if (status & 0x01) return false;
-        for (int j{ 0 }; j < 5000; j++)
-            ; // TODO: Implement a better sleep function that's not specific to the Kernel
+        if ((status & mask) == value) return true;
+        if (!(status & ATA_STATUS_BSY) && (status & ATA_STATUS_ERR)) return false;
     }
-    return false;
+
+    // Still not there, sleep until the drive's IRQ or the next PIT tick and look again
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r"(flags) :: "memory");
+    uint64_t start = PITTicks;
+    uint64_t timeout = PIT::MsToTicks(COMMAND_TIMEOUT_MS);
+    bool reached = false;
+    while (PITTicks - start < timeout) {
+        uint8_t status = m_Range->read<uint8_t>(0x7);
+        if ((status & mask) == value) {
+            reached = true;
+            break;
+        }
+        if (!(status & ATA_STATUS_BSY) && (status & ATA_STATUS_ERR)) break;
+        asm volatile("sti; hlt; cli" ::: "memory");
+    }
+
+    if (flags & EFLAGS_IF) asm volatile("sti");
+    return reached;
 }
 
-bool Disk::ReadNextSector() {
-    uint32_t desiredLBA = m_Position / BytesPerSector;
-    if (desiredLBA == m_CurrentLBA) return true;
-    m_CurrentLBA = desiredLBA;
+bool Disk::WaitBusy() {
+    return WaitStatus(ATA_STATUS_BSY, 0);
+}
 
-    while (m_Range->read<uint8_t>(0x7) & 0x80) 
-        for (int i{ 0 }; i < 5000; i++)
-            ; // TODO: Better sleep function
+bool Disk::WaitDRQ() {
+    return WaitStatus(ATA_STATUS_BSY | ATA_STATUS_DRQ, ATA_STATUS_DRQ);
+}
 
-    m_Range->write<uint8_t>(0x6, 0xE0 | (m_DriveID << 4) | ((m_CurrentLBA >> 24) & 0x0F));
+bool Disk::IssueCommand(uint64_t lba, size_t count, uint8_t command, uint8_t command_ext) {
+    if (!WaitBusy()) {
+        Debug::Critical("Disk", "Drive stayed busy, command 0x%02x not sent", command);
+        return false;
+    }
+
+    if (lba + count <= LBA28_LIMIT) {
+        m_Range->write<uint8_t>(0x6, 0xE0 | (m_DriveID << 4) | ((lba >> 24) & 0x0F));
+        m_Range->write<uint8_t>(0x2, (uint8_t)count); // 0 means 256 sectors
+        m_Range->write<uint8_t>(0x3, (uint8_t)(lba & 0xFF));
+        m_Range->write<uint8_t>(0x4, (uint8_t)((lba >> 8) & 0xFF));
+        m_Range->write<uint8_t>(0x5, (uint8_t)((lba >> 16) & 0xFF));
+    } else {
+        // The registers are two-deep FIFOs for 48-bit commands: high bytes first, then the low ones
+        command = command_ext;
+        m_Range->write<uint8_t>(0x6, 0x40 | (m_DriveID << 4));
+        m_Range->write<uint8_t>(0x2, (uint8_t)((count >> 8) & 0xFF));
+        m_Range->write<uint8_t>(0x3, (uint8_t)((lba >> 24) & 0xFF));
+        m_Range->write<uint8_t>(0x4, (uint8_t)((lba >> 32) & 0xFF));
+        m_Range->write<uint8_t>(0x5, (uint8_t)((lba >> 40) & 0xFF));
+        m_Range->write<uint8_t>(0x2, (uint8_t)(count & 0xFF));
+        m_Range->write<uint8_t>(0x3, (uint8_t)(lba & 0xFF));
+        m_Range->write<uint8_t>(0x4, (uint8_t)((lba >> 8) & 0xFF));
+        m_Range->write<uint8_t>(0x5, (uint8_t)((lba >> 16) & 0xFF));
+    }
+    m_IRQFired = false;
+    m_CommandStart = arch::i686::ReadTSC();
+    m_Range->write<uint8_t>(0x7, command);
+    return true;
+}
+
+void Disk::CompleteCommand() {
+    uint64_t cycles = arch::i686::ReadTSC() - m_CommandStart;
+    size_t bucket = cycles ? 63 - __builtin_clzll(cycles) : 0;
+    bucket = bucket < LatencyFirstBucket ? 0 : min<size_t>(bucket - LatencyFirstBucket, LatencyBuckets - 1);
+    m_LatencyHistogram[bucket]++;
+}
+
+void Disk::ResetLatencyHistogram() {
+    for (size_t i = 0; i < LatencyBuckets; i++)
+        m_LatencyHistogram[i] = 0;
+}
+
+void Disk::LogLatencyHistogram(const char* module) {
+    uint32_t total = 0;
+    for (size_t i = 0; i < LatencyBuckets; i++)
+        total += m_LatencyHistogram[i];
+    Debug::Info(module, "ATA command latency, %u commands:", total);
+
+    for (size_t i = 0; i < LatencyBuckets; i++) {
+        if (!m_LatencyHistogram[i]) continue;
+        uint32_t percent = m_LatencyHistogram[i] * 100 / total;
+        if (i == 0)
+            Debug::Info(module, "        < 2^%u cycles: %6u (%u%%)", LatencyFirstBucket + 1, m_LatencyHistogram[i], percent);
+        else if (i == LatencyBuckets - 1)
+            Debug::Info(module, "       >= 2^%u cycles: %6u (%u%%)", LatencyFirstBucket + i, m_LatencyHistogram[i], percent);
+        else
+            Debug::Info(module, "  2^%u - 2^%u cycles: %6u (%u%%)", LatencyFirstBucket + i, LatencyFirstBucket + i + 1, m_LatencyHistogram[i], percent);
+    }
+}
 
-    m_Range->write<uint8_t>(0x2, (uint8_t)1); // read one sector
-    m_Range->write<uint8_t>(0x3, (uint8_t)(m_CurrentLBA & 0xFF));
-    m_Range->write<uint8_t>(0x4, (uint8_t)((m_CurrentLBA >> 8) & 0xFF));
-    m_Range->write<uint8_t>(0x5, (uint8_t)((m_CurrentLBA >> 16) & 0xFF));
+bool Disk::ReadSectors(uint64_t lba, uint8_t* buffer, size_t count) {
+    IOVec iov{ buffer, count * BytesPerSector };
+    return ReadBlocks(lba, count, &iov, 1);
+}
+
+bool Disk::WriteSectors(uint64_t lba, const uint8_t* buffer, size_t count) {
+    IOVec iov{ const_cast<uint8_t*>(buffer), count * BytesPerSector };
+    return WriteBlocks(lba, count, &iov, 1);
+}
+
+bool Disk::ReadBlocks(uint64_t lba, size_t count, const IOVec* iov, size_t iov_count) {
+    return Transfer(lba, count, iov, iov_count, false);
+}
+
+bool Disk::WriteBlocks(uint64_t lba, size_t count, const IOVec* iov, size_t iov_count) {
+    InvalidateBuffer(lba, count);
+    return Transfer(lba, count, iov, iov_count, true);
+}
 
-    m_Range->write<uint8_t>(0x7, 0x20);
+bool Disk::Transfer(uint64_t lba, size_t count, const IOVec* iov, size_t iov_count, bool write) {
+    if (lba + count > m_SectorCount) return false;
+    if (IOVecLength(iov, iov_count) != count * BytesPerSector) return false;
 
-    uint16_t* u16buf = (uint16_t*)m_Buffer;
-    if (!WaitDRQ()) {
-        Debug::Critical("Disk", "WaitDRQ failed!");
+    // Data moves in 16-bit words, and PRD entries have to start on a word boundary
+    bool dma = m_DMAEnabled;
+    for (size_t i = 0; i < iov_count; i++) {
+        if (iov[i].length & 1) return false;
+        if (reinterpret_cast<uintptr_t>(iov[i].base) & 1) dma = false;
+    }
+
+    IOVecCursor cursor{ iov, 0, 0 };
+    while (count > 0) {
+        size_t sectors = min<size_t>(count, MaxSectorsPerCommand);
+        bool ok;
+        if (dma) ok = TransferDMA(lba, cursor, sectors, write);
+        else ok = write ? WritePIO(lba, cursor, sectors) : ReadPIO(lba, cursor, sectors);
+        if (!ok) return false;
+
+        lba += sectors;
+        count -= sectors;
+    }
+
+    return true;
+}
+
+bool Disk::ReadPIO(uint64_t lba, IOVecCursor& cursor, size_t count) {
+    // READ MULTIPLE raises DRQ once per block of m_MultipleSectors instead of once per sector
+    bool multiple = m_MultipleSectors > 1;
+    if (!IssueCommand(lba, count, multiple ? ATA_READ_MULTIPLE : ATA_READ_SECTORS,
+                      multiple ? ATA_READ_MULTIPLE_EXT : ATA_READ_SECTORS_EXT)) return false;
+
+    for (size_t done = 0; done < count;) {
+        size_t block = min<size_t>(count - done, m_MultipleSectors);
+        // The drive interrupts once each block is ready, the next one only comes after this block was read
+        if (!WaitForIRQ(COMMAND_TIMEOUT_MS) || !WaitDRQ()) {
+            Debug::Critical("Disk", "No data from the drive reading LBA %llu!", lba + done);
+            return false;
+        }
+        m_IRQFired = false;
+        for (size_t bytes = block * BytesPerSector; bytes > 0;) {
+            size_t length;
+            uint8_t* piece = cursor.Next(bytes, length);
+            m_Range->readWords(0x0, piece, length / 2);
+            bytes -= length;
+        }
+        done += block;
+    }
+
+    CompleteCommand();
+    return true;
+}
+
+bool Disk::WritePIO(uint64_t lba, IOVecCursor& cursor, size_t count) {
+    bool multiple = m_MultipleSectors > 1;
+    if (!IssueCommand(lba, count, multiple ? ATA_WRITE_MULTIPLE : ATA_WRITE_SECTORS,
+                      multiple ? ATA_WRITE_MULTIPLE_EXT : ATA_WRITE_SECTORS_EXT)) return false;
+
+    // No interrupt announces the first block, after that the drive interrupts once it has taken each block
+    for (size_t done = 0; done < count;) {
+        size_t block = min<size_t>(count - done, m_MultipleSectors);
+        if (!WaitDRQ()) {
+            Debug::Critical("Disk", "Drive isn't taking data writing LBA %llu!", lba + done);
+            return false;
+        }
+        m_IRQFired = false;
+        for (size_t bytes = block * BytesPerSector; bytes > 0;) {
+            size_t length;
+            const uint8_t* piece = cursor.Next(bytes, length);
+            m_Range->writeWords(0x0, piece, length / 2);
+            bytes -= length;
+        }
+        done += block;
+
+        if (!WaitForIRQ(COMMAND_TIMEOUT_MS)) {
+            Debug::Critical("Disk", "Write of LBA %llu timed out!", lba + done - block);
+            return false;
+        }
+    }
+
+    // The last interrupt comes once the final block is committed
+    if (!WaitBusy() || (m_Range->read<uint8_t>(0x7) & (ATA_STATUS_ERR | ATA_STATUS_DF))) {
+        Debug::Critical("Disk", "Write of %u sectors at LBA %llu failed!", count, lba);
+        return false;
+    }
+
+    CompleteCommand();
+    return true;
+}
+
+bool Disk::EnableDMA(GeneralPCIDevice* controller, IORange* bus_master, PagingManager* paging) {
+    if (m_IRQ != PrimaryChannelIRQ) {
+        Debug::Warn("ATA", "DMA is only supported on the primary channel, staying on PIO");
+        return false;
+    }
+    // Words 63 and 88: supported multiword and Ultra DMA modes
+    if (!(m_Configuration.DMAModes & 0x07) && !(m_Configuration.UltaDMAModes & 0x7F)) {
+        Debug::Warn("ATA", "Drive reports no DMA modes, staying on PIO");
+        return false;
+    }
+
+    uintptr_t prdt = FrameAllocator::AllocateLow();
+    if (!prdt) {
+        Debug::Error("ATA", "No frame left for the PRD table, staying on PIO");
         return false;
     }
-    for (int i{ 0 }; i < 256; i++)
-        u16buf[i] = m_Range->read<uint16_t>(0x0);
 
+    m_PRDT = reinterpret_cast<PRD*>(prdt);
+    m_BusMaster = bus_master;
+    m_Paging = paging;
+    m_DMAEnabled = true;
+    controller->EnableBusMastering();
+
+    m_BusMaster->write<uint8_t>(BM_COMMAND, 0);
+    m_BusMaster->write<uint8_t>(BM_STATUS, BM_STATUS_ERROR | BM_STATUS_INTERRUPT);
+
+    Debug::Info("ATA", "Bus-master DMA enabled, PRD table at 0x%X", prdt);
     return true;
 }
 
-bool Disk::WriteCurrentSector() {
-    while (m_Range->read<uint8_t>(0x7) & 0x80) 
-        for (int i{ 0 }; i < 5000; i++)
-            ; // TODO: Better sleep function
+void Disk::IRQHandler(ISR::Registers* regs, void* data) {
+    Disk* disk = static_cast<Disk*>(data);
+    // Reading the status register acknowledges the interrupt on the drive
+    disk->m_Range->read<uint8_t>(0x7);
+    disk->m_IRQFired = true;
+}
+
+bool Disk::WaitForIRQ(uint32_t timeout_ms) {
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r"(flags) :: "memory");
+
+    // sti only takes effect after hlt, so an IRQ arriving after the check still wakes it
+    uint64_t start = PITTicks;
+    uint64_t timeout = PIT::MsToTicks(timeout_ms);
+    while (!m_IRQFired && PITTicks - start < timeout)
+        asm volatile("sti; hlt; cli" ::: "memory");
+
+    if (flags & EFLAGS_IF) asm volatile("sti");
+    return m_IRQFired;
+}
+
+size_t Disk::BuildPRDT(IOVecCursor& cursor, size_t bytes) {
+    size_t count = 0;
+    size_t last_bytes = 0;
+
+    while (bytes > 0) {
+        size_t piece_length;
+        const uint8_t* piece = cursor.Next(bytes, piece_length);
+        bytes -= piece_length;
+
+        while (piece_length > 0) {
+            uintptr_t virt = reinterpret_cast<uintptr_t>(piece);
+            uintptr_t phys = m_Paging->VirtToPhys(virt);
+            if (!phys) {
+                // Heap pages are only backed once touched, fault this one in
+                (void)*reinterpret_cast<const volatile uint8_t*>(piece);
+                phys = m_Paging->VirtToPhys(virt);
+                if (!phys) return 0;
+            }
+            size_t chunk = min<size_t>(piece_length, PAGE_SIZE - (virt & (PAGE_SIZE - 1)));
+
+            // Physically contiguous pages share an entry, as long as it stays inside one 64 KiB block
+            PRD* last = count ? &m_PRDT[count - 1] : nullptr;
+            if (last && last->physAddr + last_bytes == phys && (last->physAddr >> 16) == ((phys + chunk - 1) >> 16)) {
+                last_bytes += chunk;
+            } else {
+                if (count == MaxPRDs) return 0;
+                last = &m_PRDT[count++];
+                last->physAddr = phys;
+                last_bytes = chunk;
+            }
+            last->byteCount = static_cast<uint16_t>(last_bytes);
+            last->flags = 0;
+
+            piece += chunk;
+            piece_length -= chunk;
+        }
+    }
 
-    m_Range->write<uint8_t>(0x06, 0xE0 | (m_DriveID << 4) | ((m_CurrentLBA >> 24) & 0x0F));
-    m_Range->write<uint8_t>(0x02, 1); // read a single sector
-    m_Range->write<uint8_t>(0x03, (uint8_t)(m_CurrentLBA & 0xFF));
-    m_Range->write<uint8_t>(0x04, (uint8_t)((m_CurrentLBA >> 8) & 0xFF));
-    m_Range->write<uint8_t>(0x05, (uint8_t)((m_CurrentLBA >> 16) & 0xFF));
-    m_Range->write<uint8_t>(0x07, 0x30); // WRITE SECTORS
+    if (count) m_PRDT[count - 1].flags = PRD_END_OF_TABLE;
+    return count;
+}
 
-    if (!WaitDRQ()) {
-        Debug::Critical("Disk", "WaitDRQ failed!");
+bool Disk::TransferDMA(uint64_t lba, IOVecCursor& cursor, size_t count, bool write) {
+    if (!BuildPRDT(cursor, count * BytesPerSector)) {
+        Debug::Critical("Disk", "Can't build a PRD table for the transfer at LBA %llu", lba);
         return false;
     }
 
-    uint16_t* buf = reinterpret_cast<uint16_t*>(m_Buffer);
-    for (int i = 0; i < 256; i++) {
-        m_Range->write<uint16_t>(0x0, buf[i]);
+    uint8_t direction = write ? 0 : BM_COMMAND_READ;
+    m_BusMaster->write<uint8_t>(BM_COMMAND, direction);
+    m_BusMaster->write<uint32_t>(BM_PRDT, reinterpret_cast<uintptr_t>(m_PRDT));
+    m_BusMaster->write<uint8_t>(BM_STATUS, BM_STATUS_ERROR | BM_STATUS_INTERRUPT); // write 1 to clear
+
+    if (!IssueCommand(lba, count, write ? ATA_WRITE_DMA : ATA_READ_DMA, write ? ATA_WRITE_DMA_EXT : ATA_READ_DMA_EXT)) return false;
+    m_BusMaster->write<uint8_t>(BM_COMMAND, direction | BM_COMMAND_START);
+
+    bool completed = WaitForIRQ(COMMAND_TIMEOUT_MS);
+
+    m_BusMaster->write<uint8_t>(BM_COMMAND, direction);
+    uint8_t bm_status = m_BusMaster->read<uint8_t>(BM_STATUS);
+    uint8_t status = m_Range->read<uint8_t>(0x7);
+    m_BusMaster->write<uint8_t>(BM_STATUS, BM_STATUS_ERROR | BM_STATUS_INTERRUPT);
+
+    if (!completed || (bm_status & BM_STATUS_ERROR) || (status & (ATA_STATUS_ERR | ATA_STATUS_DF))) {
+        Debug::Critical("Disk", "DMA %s of %u sectors at LBA %llu failed (%s, bus master 0x%02x, status 0x%02x)",
+            write ? "write" : "read", count, lba, completed ? "completed" : "timed out", bm_status, status);
+        return false;
     }
 
+    CompleteCommand();
     return true;
-}
\ No newline at end of file
+}
+
+uint8_t* Disk::LoadCurrentSector() {
+    uint64_t desiredLBA = m_Position / BytesPerSector;
+    if (desiredLBA >= m_BufferLBA && desiredLBA - m_BufferLBA < m_BufferSectors) {
+        m_ReadaheadHits++;
+        return m_Buffer + (desiredLBA - m_BufferLBA) * BytesPerSector;
+    }
+
+    if (!m_Buffer) {
+        m_Buffer = new uint8_t[ReadaheadCapacity * BytesPerSector];
+        if (!m_Buffer) return nullptr;
+    }
+
+    // Running off the end of the window means the reads are sequential, anything else starts it over
+    bool sequential = m_BufferSectors && desiredLBA == m_BufferLBA + m_BufferSectors;
+    m_ReadaheadWindow = sequential ? min(m_ReadaheadWindow * 2, m_ReadaheadMax) : 1;
+    uint32_t count = static_cast<uint32_t>(min<uint64_t>(m_ReadaheadWindow, m_SectorCount - desiredLBA));
+    m_ReadaheadMisses++;
+
+    if (!ReadSectors(desiredLBA, m_Buffer, count)) {
+        m_BufferSectors = 0;
+        return nullptr;
+    }
+    m_BufferLBA = desiredLBA;
+    m_BufferSectors = count;
+    return m_Buffer;
+}
+
+void Disk::InvalidateBuffer(uint64_t lba, size_t count) {
+    if (m_BufferSectors && lba < m_BufferLBA + m_BufferSectors && m_BufferLBA < lba + count)
+        m_BufferSectors = 0;
+}
+
+void Disk::SetReadahead(uint32_t sectors) {
+    m_ReadaheadMax = max<uint32_t>(1, min(sectors, ReadaheadCapacity));
+    m_ReadaheadWindow = min(m_ReadaheadWindow, m_ReadaheadMax);
+}
+
+void Disk::ResetReadaheadStats() {
+    m_ReadaheadHits = 0;
+    m_ReadaheadMisses = 0;
+}
+
+void Disk::LogReadaheadStats(const char* module) {
+    uint64_t total = m_ReadaheadHits + m_ReadaheadMisses;
+    uint64_t percent = total ? m_ReadaheadHits * 100 / total : 0;
+    Debug::Info(module, "Disk readahead: %llu of %llu buffered sector lookups hit the window (%llu%%), window %u/%u sectors",
+        m_ReadaheadHits, total, percent, m_ReadaheadWindow, m_ReadaheadMax);
+}
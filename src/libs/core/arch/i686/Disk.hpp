@@ -3,6 +3,10 @@
 #include <stdint.h>
 #include <core/dev/BlockDevice.hpp>
 #include "IOAllocator.hpp"
+#include "PCI.hpp"
+#include "ISR.hpp"
+
+class PagingManager;
 
 struct ATAIdentifyDevice {
     uint16_t GeneralConfig;               // Word 0
@@ -11,19 +15,19 @@ struct ATAIdentifyDevice {
     uint16_t _2[3];                // Words 20–22
     uint8_t  FirmwareRevision[8];        // Words 23–26
     uint8_t  ModelNumber[40];            // Words 27–46
-    uint8_t  _3[2];            // Word 47
+    uint16_t MultipleSectorMax;          // Word 47 (low byte: max sectors per READ/WRITE MULTIPLE block)
     uint16_t TrustedComputing;           // Word 48
     uint16_t Capabilities;                // Word 49
     uint16_t Capabilities2;               // Word 50
     uint16_t _4[2];                // Words 51–52
     uint16_t FieldValidity;              // Word 53
     uint16_t _5[5];                // Words 54–58
-    uint16_t MultiSectorSetting;        // Word 59
+    uint16_t MultiSectorSetting;        // Word 59 (bit 8: low byte holds the current block size)
     uint32_t LBA28SectorCount;          // Words 60–61
     uint16_t _6;                   // Word 62
     uint16_t DMAModes;                   // Word 63
     uint16_t PIOModes;                   // Word 64
-    uint16_t _7[5];                // Words 65–69
+    uint16_t _7[10];               // Words 65–74
     uint16_t QueueDepth;                 // Word 75
     uint16_t SATACapabilities;           // Word 76
     uint16_t SATAAdditionalCapabilities;// Word 77
@@ -38,7 +42,7 @@ struct ATAIdentifyDevice {
     uint16_t CommandSet_Enabled2;        // Word 86
     uint16_t CommandSet_Enabled3;        // Word 87
     uint16_t UltaDMAModes;             // Word 88
-    uint16_t _8[5];           // Words 89–93
+    uint16_t _8[4];           // Words 89–92
     uint16_t HardwareResetResult;       // Word 93
     uint16_t _9[6];           // Words 94–99
 
@@ -52,35 +56,113 @@ struct ATAIdentifyDevice {
     uint32_t LogicalSectorSizeBytes;   // Words 117–118
     uint16_t _11[137];         // Words 119–255 (vendor/reserved)
 } PACKED;
+static_assert(sizeof(ATAIdentifyDevice) == 512, "IDENTIFY DEVICE data is 256 words");
 
 class Disk : public BlockDevice {
 public:
-    Disk(uint32_t drive_id, IORange* range, bool ranged = false);
+    // `irq` is the channel's interrupt line, 14 for the primary and 15 for the secondary channel
+    Disk(uint32_t drive_id, IORange* range, bool ranged = false, int irq = PrimaryChannelIRQ);
 
     virtual size_t Read(uint8_t* data, size_t size) override;
     virtual size_t Write(const uint8_t* data, size_t size) override;
-    virtual bool Seek(int rel, SeekPos pos) override;
-    virtual size_t Position() override;
-    virtual size_t Size() override;
+    virtual bool Seek(int64_t rel, SeekPos pos) override;
+    virtual uint64_t Position() override;
+    virtual uint64_t Size() override;
 
     bool Initialize();
+    // Moves whole-sector transfers to bus-master DMA through the IDE controller's BAR4 registers, completed on IRQ 14.
+    // Only the primary channel is handled. PIO stays in use for buffers DMA can't reach.
+    bool EnableDMA(GeneralPCIDevice* controller, IORange* bus_master, PagingManager* paging);
+    // Switches between DMA and PIO once EnableDMA succeeded
+    void UseDMA(bool enabled) { m_DMAEnabled = enabled && m_PRDT; }
+    bool DMAEnabled() const { return m_DMAEnabled; }
+
+    // Whole-sector transfers straight between the drive and `buffer`, split into commands of at most 256 sectors
+    bool ReadSectors(uint64_t lba, uint8_t* buffer, size_t count);
+    bool WriteSectors(uint64_t lba, const uint8_t* buffer, size_t count);
+    uint64_t SectorCount() const { return m_SectorCount; }
+
+    // Scatter/gather over `iov`; one command covers up to 256 sectors no matter how many pieces they span
+    virtual bool ReadBlocks(uint64_t lba, size_t count, const IOVec* iov, size_t iov_count) override;
+    virtual bool WriteBlocks(uint64_t lba, size_t count, const IOVec* iov, size_t iov_count) override;
+    virtual uint32_t BlockSize() override { return BytesPerSector; }
+
+    // Byte-interface reads fill a window of sectors that doubles while they stay sequential, up to `sectors`
+    // (at most ReadaheadCapacity); 1 reads one sector at a time
+    void SetReadahead(uint32_t sectors);
+    void ResetReadaheadStats();
+    void LogReadaheadStats(const char* module);
+
+    // Every command's latency, from issuing it until its last data moved, counted in power-of-two TSC cycle buckets
+    void ResetLatencyHistogram();
+    void LogLatencyHistogram(const char* module);
 
     static constexpr uint32_t BytesPerSector{ 512 }; 
+    static constexpr uint32_t MaxSectorsPerCommand{ 256 };
+    static constexpr int PrimaryChannelIRQ{ 14 };
+    static constexpr uint32_t ReadaheadCapacity{ 64 };
 private:
-    
+    // Physical region descriptor, the bus master's scatter/gather entry
+    struct PRD {
+        uint32_t physAddr;
+        uint16_t byteCount; // 0 means 64 KiB
+        uint16_t flags;
+    } PACKED;
+
+    static constexpr size_t MaxPRDs{ 4096 / sizeof(PRD) };
+    // Bucket 0 collects everything below 2^(LatencyFirstBucket + 1) cycles, the last one everything above
+    static constexpr size_t LatencyBuckets{ 16 };
+    static constexpr uint32_t LatencyFirstBucket{ 12 };
+
+    static void IRQHandler(ISR::Registers* regs, void* data);
+
+    bool WaitStatus(uint8_t mask, uint8_t value);
+    bool WaitBusy();
     bool WaitDRQ();
-    bool ReadNextSector();
-    bool WriteCurrentSector();
+    bool WaitForIRQ(uint32_t timeout_ms);
+    bool SetMultipleMode();
+    // Sends `command`, or `command_ext` with 48-bit addressing when the range reaches past LBA28
+    bool IssueCommand(uint64_t lba, size_t count, uint8_t command, uint8_t command_ext);
+    void CompleteCommand();
+    bool Transfer(uint64_t lba, size_t count, const IOVec* iov, size_t iov_count, bool write);
+    bool ReadPIO(uint64_t lba, IOVecCursor& cursor, size_t count);
+    bool WritePIO(uint64_t lba, IOVecCursor& cursor, size_t count);
+    bool TransferDMA(uint64_t lba, IOVecCursor& cursor, size_t count, bool write);
+    size_t BuildPRDT(IOVecCursor& cursor, size_t bytes);
+    // The buffered copy of the sector under the byte cursor, read (ahead) if needed
+    uint8_t* LoadCurrentSector();
+    void InvalidateBuffer(uint64_t lba, size_t count);
 
     ATAIdentifyDevice m_Configuration;
 
     IORange* m_Range{ nullptr };
     uint32_t m_DriveID{ static_cast<uint32_t>(-1) };
-    uint32_t m_CurrentLBA{ static_cast<uint32_t>(-1) };
+    uint64_t m_SectorCount{ 0 };
+    bool m_LBA48{ false };
+    // Sectors per DRQ block; above 1 once SET MULTIPLE MODE succeeded
+    uint32_t m_MultipleSectors{ 1 };
+
+    IORange* m_BusMaster{ nullptr };
+    PagingManager* m_Paging{ nullptr };
+    // One identity-mapped low frame, so its address is also what the controller is given
+    PRD* m_PRDT{ nullptr };
+    volatile bool m_IRQFired{ false };
+    bool m_DMAEnabled{ false };
+    int m_IRQ{ PrimaryChannelIRQ };
+
+    uint64_t m_CommandStart{ 0 };
+    uint32_t m_LatencyHistogram[LatencyBuckets]{};
 
-    uint8_t m_Buffer[BytesPerSector];
-    uint32_t m_Position{ 0 };
-    size_t m_Size{ 0 };
+    // Sectors m_BufferLBA onwards, as last read for the byte interface
+    uint8_t* m_Buffer{ nullptr };
+    uint64_t m_BufferLBA{ static_cast<uint64_t>(-1) };
+    uint32_t m_BufferSectors{ 0 };
+    uint32_t m_ReadaheadWindow{ 1 };
+    uint32_t m_ReadaheadMax{ ReadaheadCapacity };
+    uint64_t m_ReadaheadHits{ 0 };
+    uint64_t m_ReadaheadMisses{ 0 };
+    uint64_t m_Position{ 0 };
+    uint64_t m_Size{ 0 };
     bool m_Initialized{ false };
     bool m_UsedByRangedDevice{ false };
 };
\ No newline at end of file
@@ -1,76 +1,244 @@
 #include "FrameAllocator.hpp"
 
 #include <core/cpp/Memory.hpp>
+#include <core/Debug.hpp>
 
-uint8_t* FrameAllocator::bitmap = nullptr;
-size_t FrameAllocator::bitmap_size_bytes = 0;
-uintptr_t FrameAllocator::phys_start = 0;
+namespace {
+    // Level 0 holds one bit per frame, every level above one bit per word of the level below
+    uint32_t g_Level0[FrameAllocator::MAX_FRAMES / 32];
+    uint32_t g_Level1[FrameAllocator::MAX_FRAMES / 32 / 32];
+    uint32_t g_Level2[FrameAllocator::MAX_FRAMES / 32 / 32 / 32];
+    uint32_t g_Level3[1];
+    // One bit per frame inside a region given to AddRegion and not reserved since; only these can ever be free
+    uint32_t g_Usable[FrameAllocator::MAX_FRAMES / 32];
+}
+
+uint32_t* FrameAllocator::levels[LEVELS] = { g_Level0, g_Level1, g_Level2, g_Level3 };
+size_t FrameAllocator::level_words[LEVELS] = { _countof(g_Level0), _countof(g_Level1), _countof(g_Level2), _countof(g_Level3) };
 size_t FrameAllocator::total_frames = 0;
+size_t FrameAllocator::free_frames = 0;
+size_t FrameAllocator::low_hint = 0;
+size_t FrameAllocator::high_hint = FrameAllocator::LOW_FRAMES;
+
+void FrameAllocator::Init(const MemoryInfo& memory) {
+    for (size_t level = 0; level < LEVELS; level++)
+        Memory::Set(levels[level], 0x00, level_words[level] * sizeof(uint32_t));
+    Memory::Set(g_Usable, 0x00, sizeof(g_Usable));
+    total_frames = 0;
+    free_frames = 0;
+    low_hint = 0;
+    high_hint = LOW_FRAMES;
+
+    for (int i = 0; i < memory.BlockCount; i++) {
+        const MemoryRegion& region = memory.Regions[i];
+        if (region.Type == 1) AddRegion(region.Begin, region.Length);
+    }
+
+    // E820 entries may overlap, a reserved entry always wins over a usable one
+    for (int i = 0; i < memory.BlockCount; i++) {
+        const MemoryRegion& region = memory.Regions[i];
+        if (region.Type != 1) Reserve(region.Begin, region.Length);
+    }
+}
+
+void FrameAllocator::AddRegion(uint64_t begin, uint64_t length) {
+    constexpr uint64_t limit = static_cast<uint64_t>(MAX_FRAMES) * FRAME_SIZE;
+    uint64_t end = begin + length;
+    if (end > limit) end = limit;
 
-void FrameAllocator::Init(uintptr_t mmap_start, size_t mmap_size) {
-    phys_start = mmap_start;
-    total_frames = mmap_size / FRAME_SIZE;
+    // Only whole frames inside the region are usable
+    uint64_t first = ALIGN_UP(begin, static_cast<uint64_t>(FRAME_SIZE)) / FRAME_SIZE;
+    uint64_t last = end / FRAME_SIZE;
+    if (last <= first) return;
+
+    size_t before = free_frames;
+    SetUsable(static_cast<size_t>(first), static_cast<size_t>(last - first), true);
+    MarkRange(static_cast<size_t>(first), static_cast<size_t>(last - first), true);
+    total_frames += free_frames - before;
+}
 
-    bitmap_size_bytes = (total_frames + 7) / 8;
+void FrameAllocator::Reserve(uint64_t begin, uint64_t length) {
+    constexpr uint64_t limit = static_cast<uint64_t>(MAX_FRAMES) * FRAME_SIZE;
+    if (begin >= limit || length == 0) return;
+    uint64_t end = begin + length;
+    if (end > limit) end = limit;
 
-    static uint8_t static_bitmap[65536];
-    bitmap = static_bitmap;
+    // Any frame touched by the range is unusable
+    uint64_t first = begin / FRAME_SIZE;
+    uint64_t last = ALIGN_UP(end, static_cast<uint64_t>(FRAME_SIZE)) / FRAME_SIZE;
 
-    Memory::Set(bitmap, 0x00, bitmap_size_bytes);
-    Memory::Set(reinterpret_cast<void*>(phys_start), 0x00, mmap_size);
+    size_t before = free_frames;
+    MarkRange(static_cast<size_t>(first), static_cast<size_t>(last - first), false);
+    SetUsable(static_cast<size_t>(first), static_cast<size_t>(last - first), false);
+    total_frames -= before - free_frames;
 }
 
 uintptr_t FrameAllocator::Allocate() {
-    for (size_t i = 0; i < total_frames; i++) {
-        if (IsFrameFree(i)) {
-            SetFrameUsed(i, true);
-            return phys_start + i * FRAME_SIZE;
+    size_t frame = FindFree(high_hint);
+    if (frame == NOT_FOUND) return AllocateLow();
+
+    MarkRange(frame, 1, false);
+    high_hint = frame + 1;
+    return frame * FRAME_SIZE;
+}
+
+uintptr_t FrameAllocator::AllocateLow() {
+    size_t frame = FindFree(low_hint);
+    if (frame == NOT_FOUND || frame >= LOW_FRAMES) return 0;
+
+    MarkRange(frame, 1, false);
+    low_hint = frame + 1;
+    return frame * FRAME_SIZE;
+}
+
+uintptr_t FrameAllocator::AllocateContiguous(size_t num_frames) {
+    if (num_frames == 0 || num_frames > free_frames) return 0;
+
+    size_t start = FindRun(high_hint, num_frames);
+    if (start == NOT_FOUND) start = FindRun(low_hint, num_frames);
+    if (start == NOT_FOUND) return 0;
+
+    // The hints stay valid lower bounds, allocating never frees anything below them
+    MarkRange(start, num_frames, false);
+    return start * FRAME_SIZE;
+}
+
+uintptr_t FrameAllocator::AllocateLowContiguous(size_t num_frames) {
+    if (num_frames == 0 || num_frames > free_frames) return 0;
+
+    size_t start = FindRun(low_hint, num_frames);
+    if (start == NOT_FOUND || start + num_frames > LOW_FRAMES) return 0;
+
+    MarkRange(start, num_frames, false);
+    return start * FRAME_SIZE;
+}
+
+void FrameAllocator::Free(uintptr_t phys_addr) {
+    FreeContiguous(phys_addr, 1);
+}
+
+void FrameAllocator::FreeContiguous(uintptr_t phys_addr, size_t num_frames) {
+    size_t frame = phys_addr / FRAME_SIZE;
+    if (frame >= MAX_FRAMES || num_frames == 0) return;
+    if (num_frames > MAX_FRAMES - frame) num_frames = MAX_FRAMES - frame;
+
+    // Reserved frames, the kernel image and holes in the memory map never become allocatable
+    if (size_t ignored = MarkRange(frame, num_frames, true))
+        Debug::Warn("FrameAllocator", "Ignored freeing %u frames outside usable memory at 0x%08x", ignored, phys_addr);
+    if (frame < LOW_FRAMES) {
+        if (frame < low_hint) low_hint = frame;
+        if (frame + num_frames > LOW_FRAMES && high_hint > LOW_FRAMES) high_hint = LOW_FRAMES;
+    } else if (frame < high_hint) {
+        high_hint = frame;
+    }
+}
+
+// Returns the first free frame at or after `from`, climbing the summary levels to skip fully used words.
+size_t FrameAllocator::FindFree(size_t from) {
+    size_t index = from;
+    size_t level = 0;
+
+    for (; level < LEVELS; level++) {
+        size_t word = index / 32;
+        if (word >= level_words[level]) return NOT_FOUND;
+
+        uint32_t bits = levels[level][word] & (~0u << (index % 32));
+        if (bits) {
+            index = word * 32 + __builtin_ctz(bits);
+            break;
         }
+        // Nothing left in this word, continue with the next word one level up
+        index = word + 1;
     }
-    return 0;
+    if (level == LEVELS) return NOT_FOUND;
+
+    while (level > 0) {
+        level--;
+        index = index * 32 + __builtin_ctz(levels[level][index]);
+    }
+    return index;
 }
 
-uintptr_t FrameAllocator::AllocateContiguous(size_t num_frames) {
-    if (num_frames == 0 || num_frames > total_frames) return 0;
-
-    size_t consecutive = 0;
-    size_t start_idx = 0;
-
-    for (size_t i = 0; i < total_frames; i++) {
-        if (IsFrameFree(i)) {
-            if (consecutive == 0) start_idx = i;
-            consecutive++;
-            if (consecutive == num_frames) {
-                for (size_t j = start_idx; j < start_idx + num_frames; j++) {
-                    SetFrameUsed(j, true);
-                }
-                return phys_start + start_idx * FRAME_SIZE;
-            } 
-        }else {
-            consecutive = 0;
+// Returns the first frame of `num_frames` consecutive free frames at or after `from`.
+size_t FrameAllocator::FindRun(size_t from, size_t num_frames) {
+    size_t start = FindFree(from);
+    while (start != NOT_FOUND && start + num_frames <= MAX_FRAMES) {
+        size_t run = FreeRunLength(start, num_frames);
+        if (run >= num_frames) return start;
+        // start + run is in use, skip to the next free frame after it
+        start = FindFree(start + run);
+    }
+    return NOT_FOUND;
+}
+
+// Counts free frames starting at `from`, stopping once `limit` is reached.
+size_t FrameAllocator::FreeRunLength(size_t from, size_t limit) {
+    size_t run = 0;
+    while (run < limit && from + run < MAX_FRAMES) {
+        size_t frame = from + run;
+        uint32_t bits = g_Level0[frame / 32] >> (frame % 32);
+        size_t available = 32 - (frame % 32);
+
+        size_t free_bits = (~bits == 0) ? 32 : __builtin_ctz(~bits);
+        if (free_bits > available) free_bits = available;
+
+        run += free_bits;
+        if (free_bits < available) break;
+    }
+    return run < limit ? run : limit;
+}
+
+size_t FrameAllocator::MarkRange(size_t first_frame, size_t num_frames, bool free) {
+    size_t frame = first_frame;
+    size_t end = first_frame + num_frames;
+    size_t ignored = 0;
+
+    while (frame < end) {
+        size_t word = frame / 32;
+        size_t bit = frame % 32;
+        size_t count = end - frame < 32 - bit ? end - frame : 32 - bit;
+        uint32_t mask = (count == 32) ? ~0u : (((1u << count) - 1) << bit);
+
+        uint32_t old = g_Level0[word];
+        if (free) {
+            ignored += __builtin_popcount(mask & ~g_Usable[word]);
+            mask &= g_Usable[word];
+            g_Level0[word] = old | mask;
+            free_frames += __builtin_popcount(mask & ~old);
+        } else {
+            g_Level0[word] = old & ~mask;
+            free_frames -= __builtin_popcount(mask & old);
         }
+
+        if ((old != 0) != (g_Level0[word] != 0)) UpdateSummary(word);
+        frame += count;
     }
-    return 0;
+    return ignored;
 }
 
-void FrameAllocator::Free(uintptr_t phys_addr) {
-    if (phys_addr < phys_start) return;
+void FrameAllocator::SetUsable(size_t first_frame, size_t num_frames, bool usable) {
+    for (size_t frame = first_frame; frame < first_frame + num_frames; frame++) {
+        if (usable) g_Usable[frame / 32] |= 1u << (frame % 32);
+        else g_Usable[frame / 32] &= ~(1u << (frame % 32));
+    }
+}
+
+// Propagates the empty/non-empty state of a level 0 word up through the summary levels.
+void FrameAllocator::UpdateSummary(size_t word_index) {
+    size_t index = word_index;
+    for (size_t level = 1; level < LEVELS; level++) {
+        bool any_free = levels[level - 1][index] != 0;
+        uint32_t& summary = levels[level][index / 32];
+        uint32_t old = summary;
 
-    size_t frame_idx = (phys_addr - phys_start) / FRAME_SIZE;
-    if (frame_idx < total_frames) SetFrameUsed(frame_idx, false);
+        if (any_free) summary |= (1u << (index % 32));
+        else summary &= ~(1u << (index % 32));
+
+        if ((old != 0) == (summary != 0)) break;
+        index /= 32;
+    }
 }
 
 bool FrameAllocator::IsFrameFree(size_t frame_idx) {
-    size_t byte_index = frame_idx / 8;
-    size_t bit_index = frame_idx % 8;
-    return (bitmap[byte_index] & (1 << bit_index)) == 0;
-}
-
-void FrameAllocator::SetFrameUsed(size_t frame_idx, bool used) {
-    size_t byte_index = frame_idx / 8;
-    size_t bit_index = frame_idx % 8; 
-    if (used)
-        bitmap[byte_index] |= (1 << bit_index);
-    else
-        bitmap[byte_index] &= ~(1 << bit_index);
-}
\ No newline at end of file
+    return (g_Level0[frame_idx / 32] >> (frame_idx % 32)) & 1;
+}
@@ -3,24 +3,60 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <boot/bootparams.h>
+
+// Physical frame allocator.
+// Frames are tracked by absolute frame number over the whole 32-bit physical address space
+// in a bitmap (1 = free) with summary levels on top: a bit in level N+1 is set when the
+// matching 32-bit word in level N has any free frame. Searches walk up and down the levels
+// with __builtin_ctz, so finding a free frame costs O(log n) word reads instead of a linear scan.
+//
+// Frames below LOW_MEMORY_LIMIT are identity-mapped by the HAL and are kept for things that are
+// accessed by physical address; general allocations prefer frames above it.
 class FrameAllocator {
 public:
-    static void Init(uintptr_t mmap_start, size_t mmap_size);
+    // Registers every usable region of the BIOS memory map. Anything overlapping a non-usable region stays reserved.
+    static void Init(const MemoryInfo& memory);
+    static void AddRegion(uint64_t begin, uint64_t length);
+    static void Reserve(uint64_t begin, uint64_t length);
 
     static uintptr_t Allocate();
+    static uintptr_t AllocateLow();
     static uintptr_t AllocateContiguous(size_t num_frames);
+    // A physically contiguous run below LOW_MEMORY_LIMIT, usable through the identity mapping
+    static uintptr_t AllocateLowContiguous(size_t num_frames);
 
     static void Free(uintptr_t phys_addr);
+    static void FreeContiguous(uintptr_t phys_addr, size_t num_frames);
+
+    static size_t TotalFrames() { return total_frames; }
+    static size_t FreeFrames() { return free_frames; }
+    static size_t UsedFrames() { return total_frames - free_frames; }
 
     static constexpr size_t FRAME_SIZE = 4096;
+    static constexpr size_t MAX_FRAMES = 0x100000; // 4 GiB / FRAME_SIZE
+    static constexpr uintptr_t LOW_MEMORY_LIMIT = 16 * 1024 * 1024;
 private:
+    static constexpr size_t LOW_FRAMES = LOW_MEMORY_LIMIT / FRAME_SIZE;
+    static constexpr size_t LEVELS = 4;
+    static constexpr size_t NOT_FOUND = static_cast<size_t>(-1);
 
-    static uint8_t* bitmap;
-    static size_t bitmap_size_bytes;
+    static uint32_t* levels[LEVELS];
+    static size_t level_words[LEVELS];
 
-    static uintptr_t phys_start;
     static size_t total_frames;
+    static size_t free_frames;
+    // Lowest frame that may be free, below and above LOW_MEMORY_LIMIT
+    static size_t low_hint;
+    static size_t high_hint;
+
+    static size_t FindFree(size_t from);
+    static size_t FindRun(size_t from, size_t num_frames);
+    static size_t FreeRunLength(size_t from, size_t limit);
+    // Returns how many frames of the range were left alone because they aren't usable memory
+    static size_t MarkRange(size_t first_frame, size_t num_frames, bool free);
+    static void SetUsable(size_t first_frame, size_t num_frames, bool usable);
+    static void UpdateSummary(size_t word_index);
 
     static bool IsFrameFree(size_t frame_idx);
-    static void SetFrameUsed(size_t frame_idx, bool used);
-};
\ No newline at end of file
+};
@@ -12,6 +12,9 @@ namespace arch {
         EXPORT uint16_t ASMCALL InPortW(uint16_t port);
         EXPORT void ASMCALL OutPortL(uint16_t port, uint32_t value);
         EXPORT uint32_t ASMCALL InPortL(uint16_t port);
+        // `count` words through a single port with rep insw/outsw
+        EXPORT void ASMCALL InPortSW(uint16_t port, void* buffer, uint32_t count);
+        EXPORT void ASMCALL OutPortSW(uint16_t port, const void* buffer, uint32_t count);
         
         EXPORT void ASMCALL DisableInterrupts();
         EXPORT void ASMCALL EnableInterrupts();
@@ -22,5 +25,8 @@ namespace arch {
         EXPORT void ASMCALL LoadIDT(void* desc);
 
         EXPORT void ASMCALL IOWait();
+
+        EXPORT uint64_t ASMCALL ReadTSC();
+        EXPORT bool ASMCALL EnableSSE();
     }
 }
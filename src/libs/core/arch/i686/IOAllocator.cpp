@@ -41,4 +41,20 @@ void IOAllocator::FreeIORange(IORange& range) {
 
 bool IORange::VerifyOffset(IOOffset offset, uint32_t bytes) {
     return static_cast<uint32_t>(offset) + bytes <= static_cast<uint32_t>(m_Length);
+}
+
+void IORange::readWords(IOOffset offset, void* buffer, size_t count) {
+    if (!VerifyOffset(offset, sizeof(uint16_t))) {
+        Debug::Critical("IORange::readWords", "Offset + 2 > IORange::Length (%u + 2 > %u)", offset, m_Length);
+        return;
+    }
+    arch::i686::InPortSW(m_Address + offset, buffer, count);
+}
+
+void IORange::writeWords(IOOffset offset, const void* buffer, size_t count) {
+    if (!VerifyOffset(offset, sizeof(uint16_t))) {
+        Debug::Critical("IORange::writeWords", "Offset + 2 > IORange::Length (%u + 2 > %u)", offset, m_Length);
+        return;
+    }
+    arch::i686::OutPortSW(m_Address + offset, buffer, count);
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 
 #include <vector>
 #include <concepts>
@@ -23,6 +24,10 @@ public:
     template<typename T>
     T read(IOOffset offset);
 
+    // Block transfers of `count` 16-bit words through one port
+    void readWords(IOOffset offset, void* buffer, size_t count);
+    void writeWords(IOOffset offset, const void* buffer, size_t count);
+
 private:
     bool VerifyOffset(IOOffset offset, uint32_t bytes);
 
@@ -6,23 +6,24 @@
 #include "IO.hpp"
 
 constexpr uint8_t CppPICRemapOffset{ 0x20 };
+// PCI interrupt lines are shared between devices, each handler checks whether its own device raised it
+constexpr size_t MaxSharedHandlers{ 4 };
 
 struct IRQCallback {
     IRQ::IRQHandler handler;
     void* data;
 };
 
-IRQCallback g_CppIRQHandlers[16]{};
+IRQCallback g_CppIRQHandlers[16][MaxSharedHandlers]{};
 static PICDriver* g_CppIrqDriver{ nullptr };
 
 void MainIRQHandler(ISR::Registers* regs) {
     int irq = regs->interrupt - CppPICRemapOffset;
     
-    if (g_CppIRQHandlers[irq].handler)
-        g_CppIRQHandlers[irq].handler(regs, g_CppIRQHandlers[irq].data);
-    else {
+    if (!g_CppIRQHandlers[irq][0].handler)
         Debug::Error("IRQ", "Unhandled IRQ %d!!", irq);
-    }
+    for (size_t i = 0; i < MaxSharedHandlers && g_CppIRQHandlers[irq][i].handler; i++)
+        g_CppIRQHandlers[irq][i].handler(regs, g_CppIRQHandlers[irq][i].data);
 
     g_CppIrqDriver->SendEOI(irq);
 }
@@ -55,5 +56,20 @@ void IRQ::Init() {
 }
 
 void IRQ::RegisterHandler(int irq, IRQHandler handler, void* data) {
-    g_CppIRQHandlers[irq] = { handler, data };
+    for (size_t i = 0; i < MaxSharedHandlers; i++) {
+        IRQCallback& callback = g_CppIRQHandlers[irq][i];
+        if (!callback.handler || (callback.handler == handler && callback.data == data)) {
+            callback = { handler, data };
+            return;
+        }
+    }
+    Debug::Error("IRQ", "No handler slot left on IRQ %d", irq);
+}
+
+void IRQ::Unmask(int irq) {
+    if (g_CppIrqDriver) g_CppIrqDriver->Unmask(irq);
+}
+
+void IRQ::Mask(int irq) {
+    if (g_CppIrqDriver) g_CppIrqDriver->Mask(irq);
 }
\ No newline at end of file
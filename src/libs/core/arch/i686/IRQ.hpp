@@ -9,5 +9,10 @@ namespace IRQ {
     using IRQHandler = void(*)(ISR::Registers*, void*);
 
     void Init();
+    // Handlers registered on the same line all run, in registration order. One handler may be registered several times
+    // with different data (one per device instance); only registering the same handler and data again is a no-op.
     void RegisterHandler(int irq, IRQHandler handler, void* data = nullptr);
+    // IRQs start out masked at the PIC; lines 8-15 also need the cascade on IRQ 2
+    void Unmask(int irq);
+    void Mask(int irq);
 }
\ No newline at end of file
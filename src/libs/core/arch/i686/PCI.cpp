@@ -14,7 +14,8 @@ PCIDevice* PCI::FindDevice(uint16_t vendor, uint16_t device) {
         return nullptr;
     }
 
-    for (uint8_t bus = 0; bus < 256; ++bus) {
+    // uint16_t, a uint8_t bus counter would never reach 256 and never stop for a missing device
+    for (uint16_t bus = 0; bus < 256; ++bus) {
         for (uint8_t dev = 0; dev < 32; ++dev) {
             for (uint8_t func = 0; func < 8; ++func) {
                 uint32_t id = ReadConfig(bus, dev, func, 0x00);
@@ -109,6 +110,13 @@ uint32_t GeneralPCIDevice::FindIOBase() {
     return 0;
 }
 
+uint32_t GeneralPCIDevice::FindIOBase(uint8_t bar) {
+    if (bar >= 6) return 0;
+    const uint32_t value = ReadRegister(static_cast<uint8_t>(4 + bar));
+    if (!(value & 0x1u)) return 0;
+    return value & ~0x3u;
+}
+
 PCIDevice::MmapRange GeneralPCIDevice::FindMmapRange(PagingManager& KernelPagingManager) {
     // Memory BARs only (bit0 == 0)
     for (int i = 0; i < 6; ++i) {
@@ -126,8 +134,10 @@ PCIDevice::MmapRange GeneralPCIDevice::FindMmapRange(PagingManager& KernelPaging
 
             const std::size_t length = static_cast<std::size_t>(~(size_mask & ~0xFu) + 1u);
 
+            // Prefetchable BARs (bit 3) have no read side effects and can be write-combined, registers must stay uncached
+            const bool prefetchable = (bar & 0x8u) != 0;
             const uintptr_t virt_start = 0xF0000000u + static_cast<uintptr_t>(i) * 0x100000u;
-            KernelPagingManager.MapRange(phys_start, virt_start, length, PAGE_PRESENT | PAGE_READWRITE);
+            KernelPagingManager.MapRange(phys_start, virt_start, length, prefetchable ? PAGE_PREFETCHABLE_MMIO : PAGE_MMIO);
 
             return { reinterpret_cast<uint8_t*>(virt_start), length };
         }
@@ -72,6 +72,8 @@ public:
     explicit GeneralPCIDevice(PCIDevice* base) { *static_cast<PCIDevice*>(this) = *base; }
 
     uint32_t FindIOBase();
+    // I/O port base of one specific BAR, 0 if it's a memory BAR or unused
+    uint32_t FindIOBase(uint8_t bar);
     MmapRange FindMmapRange(PagingManager& KernelPagingManager);
     uint8_t GetIRQ();
 
@@ -1,90 +1,212 @@
 #include "PagingManager.hpp"
 
 #include <core/Assert.hpp>
+#include <core/arch/i686/FrameAllocator.hpp>
 
-extern "C" {
-    char KERNEL_END; // Symbol defined in linker script
-};
+// The last directory entry points back at the directory itself, so once paging is on every page table is
+// visible at RECURSIVE_TABLES + pd_index * PAGE_SIZE and the directory at RECURSIVE_DIRECTORY.
+static constexpr uint32_t RECURSIVE_SLOT = PAGE_ENTRIES - 1;
+static constexpr uintptr_t RECURSIVE_TABLES = 0xFFC00000;
+static constexpr uintptr_t RECURSIVE_DIRECTORY = 0xFFFFF000;
 
-namespace {
-    class PhysicalMemoryManager {
-    public:
-        static void Init(const MemoryInfo& memory) {
-        // Find the best region (largest usable memory after kernel)
-        uintptr_t best_start = 0;
-        uintptr_t best_len = 0;
+// A single page right below the recursive window, used to fill a page table before it's installed
+static constexpr uint32_t SCRATCH_SLOT = PAGE_ENTRIES - 2;
+static constexpr uintptr_t SCRATCH_PAGE = RECURSIVE_TABLES - PAGE_SIZE;
 
+void PagingManager::Initialize() {
+    PageDirectory = (uint32_t*)AllocatePageAligned();
+    assert(PageDirectory && "Failed to allocate the page directory!");
+    m_LargePages = enable_pse();
+    m_WriteCombining = enable_pat();
 
-        uintptr_t kernel_end = (uintptr_t)&KERNEL_END;
-
-        for (int i = 0; i < memory.BlockCount; ++i) {
-            const MemoryRegion& region = memory.Regions[i];
-            if (region.Type != 1) continue; // Type 1 = usable
+    PDE(RECURSIVE_SLOT) = ((uint32_t)PageDirectory) | PAGE_PRESENT | PAGE_READWRITE;
 
-            uintptr_t region_start = (uintptr_t)region.Begin;
-            uintptr_t region_end = region_start + (uintptr_t)region.Length;
+    // The scratch page's table must never be reclaimed
+    uint32_t* scratch_table = GetPageTable(SCRATCH_SLOT, true);
+    assert(scratch_table && "Failed to allocate the scratch page table!");
+    m_TableUsage[SCRATCH_SLOT]++;
+}
 
-            if (region_end <= kernel_end) continue;
+uint32_t* PagingManager::Directory() {
+    return m_PagingEnabled ? (uint32_t*)RECURSIVE_DIRECTORY : PageDirectory;
+}
 
-            // Adjust to not overlap the kernel
-            uintptr_t usable_start = (region_start < kernel_end) ? kernel_end : region_start;
-            uintptr_t usable_len = region_end - usable_start;
+uint32_t* PagingManager::TableOf(uint32_t pd_index) {
+    if (m_PagingEnabled) return (uint32_t*)(RECURSIVE_TABLES + pd_index * PAGE_SIZE);
+    return (uint32_t*)(PDE(pd_index) & 0xFFFFF000);
+}
 
-            if (usable_len > best_len) {
-                best_start = usable_start;
-                best_len = usable_len;
-            }
-        }
+// Maps `phys_addr` at the scratch page, only valid until the next call.
+void* PagingManager::MapScratch(uintptr_t phys_addr) {
+    TableOf(SCRATCH_SLOT)[PAGE_ENTRIES - 1] = (phys_addr & 0xFFFFF000) | PAGE_PRESENT | PAGE_READWRITE;
+    invlpg((void*)SCRATCH_PAGE);
+    return (void*)SCRATCH_PAGE;
+}
 
-        // Align start to 4KB
-        m_NextFreePage = (best_start + 0xFFF) & ~0xFFF;
-        m_Limit = best_start + best_len;
-    }
+// Without a PAT the PAT bit is reserved, write-combining falls back to uncached.
+uint32_t PagingManager::ResolveCacheType(uint32_t flags) const {
+    if ((flags & PAGE_PAT) && !m_WriteCombining) return (flags & ~PAGE_CACHEMASK) | PAGE_UNCACHED;
+    return flags;
+}
 
-    static void* AllocatePage() {
-        if (m_NextFreePage + 0x1000 > m_Limit) {
-            // Out of memory (you could trigger panic here)
-            return nullptr;
+void PagingManager::MapRange(uintptr_t phys_start, uintptr_t virt_start, size_t size, uint32_t flags) {
+    MapTransaction transaction{ *this };
+
+    size_t offset = 0;
+    while (offset < size) {
+        uintptr_t phys_addr = phys_start + offset;
+        uintptr_t virt_addr = virt_start + offset;
+
+        if (CanMapLarge(phys_addr, virt_addr, size - offset)) {
+            MapLargePage(phys_addr, virt_addr, flags);
+            offset += LARGE_PAGE_SIZE;
+        } else {
+            MapPage(phys_addr, virt_addr, flags);
+            offset += PAGE_SIZE;
         }
-
-        void* page = (void*)m_NextFreePage;
-        m_NextFreePage += 0x1000;
-        return page;
     }
+}
 
-    private:
-        static uintptr_t m_NextFreePage;
-        static uintptr_t m_Limit;
-    };
+bool PagingManager::CanMapLarge(uintptr_t phys_addr, uintptr_t virt_addr, size_t remaining) {
+    if (!m_LargePages || remaining < LARGE_PAGE_SIZE) return false;
+    if ((phys_addr | virt_addr) & (LARGE_PAGE_SIZE - 1)) return false;
 
-    uintptr_t PhysicalMemoryManager::m_NextFreePage = 0;
-    uintptr_t PhysicalMemoryManager::m_Limit = 0;
+    // Don't replace a page table that may already hold other mappings
+    uint32_t pde = PDE((virt_addr >> 22) & 0x3FF);
+    return !(pde & PAGE_PRESENT) || (pde & PAGE_LARGE);
 }
 
-PagingManager::PagingManager(const MemoryInfo& mem_info) {
-    PhysicalMemoryManager::Init(mem_info);
-    PageDirectory = (uint32_t*)AllocatePageAligned();
-    Memory::Set(PageDirectory, 0, PAGE_SIZE);
+void PagingManager::MapLargePage(uintptr_t phys_addr, uintptr_t virt_addr, uint32_t flags) {
+    uint32_t& pde = PDE((virt_addr >> 22) & 0x3FF);
+    bool was_present = pde & PAGE_PRESENT;
+    flags = ResolveCacheType(flags);
+    uint32_t pat = (flags & PAGE_PAT) ? PAGE_LARGE_PAT : 0;
+    pde = (phys_addr & 0xFFC00000) | (flags & 0xFFF & ~PAGE_PAT) | PAGE_LARGE | pat;
+
+    // The MMU never caches not-present entries, so only replaced mappings need flushing
+    if (was_present) {
+        DropTranslations();
+        Invalidate(virt_addr);
+    }
 }
 
-void PagingManager::MapRange(uintptr_t phys_start, uintptr_t virt_start, size_t size, uint32_t flags) {
-    size_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
-    for (size_t i = 0; i < pages; i++) {
-        uintptr_t phys_addr = phys_start + i * PAGE_SIZE;
-        uintptr_t virt_addr = virt_start + i * PAGE_SIZE;
+void PagingManager::MapPage(uintptr_t phys_addr, uintptr_t virt_addr, uint32_t flags) {
+    uint32_t pd_index = (virt_addr >> 22) & 0x3FF;
+    uint32_t pt_index = (virt_addr >> 12) & 0x3FF;
+
+    assert(pd_index != RECURSIVE_SLOT && "Mapping over the recursive page table window!");
+    uint32_t* page_table = GetPageTable(pd_index, true);
+    assert(page_table && "Out of frames for page tables!");
+
+    bool was_present = page_table[pt_index] & PAGE_PRESENT;
+    page_table[pt_index] = (phys_addr & 0xFFFFF000) | (ResolveCacheType(flags) & 0xFFF);
 
-        MapPage(phys_addr, virt_addr, flags);
+    if (was_present) Invalidate(virt_addr);
+    else if (flags & PAGE_PRESENT) m_TableUsage[pd_index]++;
+
+    if (was_present && !(flags & PAGE_PRESENT) && --m_TableUsage[pd_index] == 0)
+        ReleasePageTable(pd_index);
+}
+
+void PagingManager::UnmapRange(uintptr_t virt_start, size_t size) {
+    MapTransaction transaction{ *this };
+
+    size_t offset = 0;
+    while (offset < size) {
+        uintptr_t virt_addr = virt_start + offset;
+        uint32_t pd_index = (virt_addr >> 22) & 0x3FF;
+        uint32_t pde = PDE(pd_index);
+        size_t to_boundary = LARGE_PAGE_SIZE - (virt_addr & (LARGE_PAGE_SIZE - 1));
+
+        if (!(pde & PAGE_PRESENT)) {
+            offset += to_boundary;
+        } else if ((pde & PAGE_LARGE) && to_boundary == LARGE_PAGE_SIZE && size - offset >= LARGE_PAGE_SIZE) {
+            PDE(pd_index) = 0;
+            DropTranslations();
+            Invalidate(virt_addr);
+            offset += LARGE_PAGE_SIZE;
+        } else {
+            UnmapPage(virt_addr);
+            offset += PAGE_SIZE;
+        }
     }
 }
 
-void PagingManager::MapPage(uintptr_t phys_addr, uintptr_t virt_addr, uint32_t flags) {
+void PagingManager::UnmapPage(uintptr_t virt_addr) {
     uint32_t pd_index = (virt_addr >> 22) & 0x3FF;
     uint32_t pt_index = (virt_addr >> 12) & 0x3FF;
 
+    if (pd_index == RECURSIVE_SLOT || !(PDE(pd_index) & PAGE_PRESENT)) return;
     uint32_t* page_table = GetPageTable(pd_index, true);
-    page_table[pt_index] = (phys_addr & 0xFFFFF000) | (flags & 0xFFF);
+    if (!page_table || !(page_table[pt_index] & PAGE_PRESENT)) return;
+
+    page_table[pt_index] = 0;
+    Invalidate(virt_addr);
+    if (--m_TableUsage[pd_index] == 0) ReleasePageTable(pd_index);
+}
+
+void PagingManager::ReleasePageTable(uint32_t pd_index) {
+    uintptr_t page_table = PDE(pd_index) & 0xFFFFF000;
+    PDE(pd_index) = 0;
+    // The table's own page in the recursive window goes away with it
+    Invalidate(RECURSIVE_TABLES + pd_index * PAGE_SIZE);
+
+    if (m_TransactionDepth == 0) {
+        // The last entry's invlpg has already dropped any cached copy of the directory entry
+        FrameAllocator::Free(page_table);
+        return;
+    }
+
+    if (m_PendingTableCount == TABLE_BATCH) Flush();
+    m_PendingTables[m_PendingTableCount++] = page_table;
+}
+
+void PagingManager::BeginTransaction() {
+    m_TransactionDepth++;
+}
 
-    invlpg((void*)virt_addr);
+void PagingManager::EndTransaction() {
+    if (--m_TransactionDepth == 0) Flush();
+}
+
+void PagingManager::Invalidate(uintptr_t virt_addr) {
+    Translation& cached = m_Translations[(virt_addr / PAGE_SIZE) % TRANSLATION_CACHE_SIZE];
+    if (cached.tag == ((virt_addr & 0xFFFFF000) | TRANSLATION_VALID)) cached.tag = 0;
+
+    // Nothing can be cached in the TLB before paging is turned on
+    if (!m_PagingEnabled) return;
+
+    if (m_TransactionDepth == 0) invlpg((void*)virt_addr);
+    else if (m_PendingFlushAll) return;
+    else if (m_PendingPageCount < INVALIDATE_BATCH) m_PendingPages[m_PendingPageCount++] = virt_addr;
+    else m_PendingFlushAll = true;
+}
+
+void PagingManager::InvalidateAll() {
+    DropTranslations();
+    if (!m_PagingEnabled) return;
+
+    if (m_TransactionDepth == 0) load_cr3((uint32_t)PageDirectory);
+    else m_PendingFlushAll = true;
+}
+
+void PagingManager::DropTranslations() {
+    for (size_t i = 0; i < TRANSLATION_CACHE_SIZE; i++)
+        m_Translations[i].tag = 0;
+}
+
+void PagingManager::Flush() {
+    if (m_PendingFlushAll) load_cr3((uint32_t)PageDirectory);
+    else {
+        for (size_t i = 0; i < m_PendingPageCount; i++)
+            invlpg((void*)m_PendingPages[i]);
+    }
+    m_PendingPageCount = 0;
+    m_PendingFlushAll = false;
+
+    for (size_t i = 0; i < m_PendingTableCount; i++)
+        FrameAllocator::Free(m_PendingTables[i]);
+    m_PendingTableCount = 0;
 }
 
 void PagingManager::IdentityMapRange(uintptr_t start, size_t size, uint32_t flags) {
@@ -96,17 +218,28 @@ uintptr_t PagingManager::PhysToVirt(uintptr_t phys_addr) const {
 }
 
 uintptr_t PagingManager::VirtToPhys(uintptr_t virt_addr) {
+    uintptr_t virt_page = virt_addr & 0xFFFFF000;
+    Translation& cached = m_Translations[(virt_addr / PAGE_SIZE) % TRANSLATION_CACHE_SIZE];
+    if (cached.tag == (virt_page | TRANSLATION_VALID)) return cached.physPage | (virt_addr & 0xFFF);
+
     uint32_t pd_index = (virt_addr >> 22) & 0x3FF;
     uint32_t pt_index = (virt_addr >> 12) & 0x3FF;
 
     uint32_t pde = PDE(pd_index);
     if (!(pde & PAGE_PRESENT)) return 0; // not mapped;
 
-    uint32_t* page_table = (uint32_t*)(pde & 0xFFFFF000);
-    uint32_t pte = page_table[pt_index];
-    if (!(pte & PAGE_PRESENT)) return 0;
+    uintptr_t phys_page;
+    if (pde & PAGE_LARGE) {
+        phys_page = (pde & 0xFFC00000) | (virt_page & (LARGE_PAGE_SIZE - 1));
+    } else {
+        uint32_t pte = TableOf(pd_index)[pt_index];
+        if (!(pte & PAGE_PRESENT)) return 0;
+        phys_page = pte & 0xFFFFF000;
+    }
 
-    return (pte & 0xFFFFF000) | (virt_addr & 0xFFF);
+    cached.tag = virt_page | TRANSLATION_VALID;
+    cached.physPage = phys_page;
+    return phys_page | (virt_addr & 0xFFF);
 }
 
 void PagingManager::InstallPageDirectory() {
@@ -115,13 +248,15 @@ void PagingManager::InstallPageDirectory() {
 
 void PagingManager::EnablePaging() {
     enable_paging();
+    m_PagingEnabled = true;
 }
 
 uintptr_t PagingManager::SetupKernelStack(uintptr_t virt_stack_base, size_t stack_pages, uint32_t flags) {
     for (size_t i = 0; i < stack_pages; i++) {
-        void* phys_page = AllocatePageAligned();
+        uintptr_t phys_page = FrameAllocator::Allocate();
+        assert(phys_page && "Out of frames for the kernel stack!");
         uintptr_t virt_addr = virt_stack_base + i * PAGE_SIZE;
-        MapRange((uintptr_t)phys_page, virt_addr, PAGE_SIZE, flags);
+        MapRange(phys_page, virt_addr, PAGE_SIZE, flags);
     }
 
     return virt_stack_base + stack_pages * PAGE_SIZE;
@@ -132,22 +267,44 @@ uint32_t* PagingManager::GetPageTable(uint32_t pd_index, bool create_if_missing)
     if (!(pde & PAGE_PRESENT)) {
         if (!create_if_missing) return nullptr;
 
-        void* page_table = AllocatePageAligned();
-        Memory::Set(page_table, 0, PAGE_SIZE);
-        PDE(pd_index) = ((uint32_t)page_table) | PAGE_PRESENT | PAGE_READWRITE;
-        return (uint32_t*)page_table;
+        uintptr_t page_table = FrameAllocator::Allocate();
+        if (!page_table) return nullptr;
+        PDE(pd_index) = page_table | PAGE_PRESENT | PAGE_READWRITE;
+        m_TableUsage[pd_index] = 0;
+
+        // A table released earlier in this transaction may still be cached at the same window address
+        if (m_PagingEnabled) invlpg((void*)(RECURSIVE_TABLES + pd_index * PAGE_SIZE));
+        uint32_t* table = TableOf(pd_index);
+        Memory::Set(table, 0, PAGE_SIZE);
+        return table;
     }
-    return (uint32_t*)(pde & 0xFFFFF000);
+    if (pde & PAGE_LARGE) return create_if_missing ? SplitLargePage(pd_index) : nullptr;
+    return TableOf(pd_index);
 }
 
-uint32_t& PagingManager::PTE(uint32_t pd_index, uint32_t pt_index) {
-    uint32_t* page_table = GetPageTable(pd_index, true);
-    return page_table[pt_index];
+// Replaces a 4 MiB mapping with a page table mapping the same memory, so single pages inside it can be changed.
+uint32_t* PagingManager::SplitLargePage(uint32_t pd_index) {
+    uint32_t pde = PDE(pd_index);
+    uintptr_t page_table = FrameAllocator::Allocate();
+    if (!page_table) return nullptr;
+
+    // The range stays mapped while the replacement table is filled in, it may hold the code doing this
+    uint32_t* entries = m_PagingEnabled ? (uint32_t*)MapScratch(page_table) : (uint32_t*)page_table;
+    uint32_t flags = pde & 0xFFF & ~PAGE_LARGE;
+    if (pde & PAGE_LARGE_PAT) flags |= PAGE_PAT;
+    for (size_t i = 0; i < PAGE_ENTRIES; i++)
+        entries[i] = ((pde & 0xFFC00000) + i * PAGE_SIZE) | flags;
+
+    PDE(pd_index) = page_table | (pde & (PAGE_PRESENT | PAGE_READWRITE | PAGE_USER));
+    m_TableUsage[pd_index] = PAGE_ENTRIES;
+    // invlpg only drops one of the 4 KiB translations that may now be cached, flush everything
+    InvalidateAll();
+    return TableOf(pd_index);
 }
 
-
+// Only used before paging is enabled, when every frame is reachable through its physical address.
 void* PagingManager::AllocatePageAligned() {
-    void* page = PhysicalMemoryManager::AllocatePage();
-    Memory::Set(page, 0, PAGE_SIZE);
+    void* page = reinterpret_cast<void*>(FrameAllocator::Allocate());
+    if (page) Memory::Set(page, 0, PAGE_SIZE);
     return page;
 }
\ No newline at end of file
@@ -12,24 +12,56 @@ constexpr uint32_t PAGE_READWRITE   = (1 << 1);
 constexpr uint32_t PAGE_USER        = (1 << 2);
 constexpr uint32_t PAGE_WRITETHROUGH = (1 << 3);
 constexpr uint32_t PAGE_CACHEDISABLED = (1 << 4);
+constexpr uint32_t PAGE_LARGE       = (1 << 7); // PDE maps a 4 MiB page directly (PSE)
+constexpr uint32_t PAGE_PAT         = (1 << 7); // in a PTE; moved to bit 12 for 4 MiB pages
+constexpr uint32_t PAGE_LARGE_PAT   = (1 << 12);
 
-constexpr uint32_t PAGE_MMIO = PAGE_PRESENT | PAGE_READWRITE | PAGE_CACHEDISABLED;
+// Memory types, selected through the PAT index formed by PAT:PCD:PWT
+constexpr uint32_t PAGE_UNCACHED = PAGE_CACHEDISABLED | PAGE_WRITETHROUGH; // UC, MTRRs can't relax it
+constexpr uint32_t PAGE_WRITECOMBINE = PAGE_PAT; // PAT entry 4, programmed to WC at boot
+constexpr uint32_t PAGE_CACHEMASK = PAGE_PAT | PAGE_CACHEDISABLED | PAGE_WRITETHROUGH;
+
+constexpr uint32_t PAGE_MMIO = PAGE_PRESENT | PAGE_READWRITE | PAGE_UNCACHED;
+constexpr uint32_t PAGE_PREFETCHABLE_MMIO = PAGE_PRESENT | PAGE_READWRITE | PAGE_WRITECOMBINE;
 
 constexpr size_t PAGE_SIZE = 4096;
 constexpr size_t PAGE_ENTRIES = 1024;
+constexpr size_t LARGE_PAGE_SIZE = PAGE_SIZE * PAGE_ENTRIES;
 
 extern "C" void load_cr3(uint32_t);
 extern "C" void enable_paging();
 extern "C" void invlpg(void*);
+extern "C" bool enable_pse();
+extern "C" bool enable_pat();
 
 class PagingManager {
 public:
-    PagingManager(const MemoryInfo& mem_info);
+    // Groups map/unmap calls so their TLB invalidations are issued once, when the outermost transaction ends.
+    class MapTransaction {
+    public:
+        explicit MapTransaction(PagingManager& paging) : m_Paging(paging) { m_Paging.BeginTransaction(); }
+        ~MapTransaction() { m_Paging.EndTransaction(); }
+    private:
+        PagingManager& m_Paging;
+    };
+
+    PagingManager() = default;
+
+    // Allocates an empty page directory. The FrameAllocator has to be initialized first.
+    void Initialize();
 
+    // Uses 4 MiB pages wherever physical and virtual addresses are both 4 MiB aligned and enough of the range is left.
     void MapRange(uintptr_t phys_start, uintptr_t virt_start, size_t size, uint32_t flags);
     void IdentityMapRange(uintptr_t start, size_t size, uint32_t flags);
     void MapPage(uintptr_t phys_addr, uintptr_t virt_addr, uint32_t flags);
 
+    // Page tables that become empty are returned to the FrameAllocator. The mapped frames themselves are left alone.
+    void UnmapRange(uintptr_t virt_start, size_t size);
+    void UnmapPage(uintptr_t virt_addr);
+
+    void BeginTransaction();
+    void EndTransaction();
+
     uintptr_t PhysToVirt(uintptr_t phys_addr) const;
     uintptr_t VirtToPhys(uintptr_t virt_addr);
 
@@ -39,13 +71,56 @@ public:
     uintptr_t SetupKernelStack(uintptr_t virt_stack_base, size_t stack_pages = 1, uint32_t flags = PAGE_PRESENT | PAGE_READWRITE);
 
 private:
-    uint32_t* PageDirectory;
+    // Past this many pages a full CR3 reload is cheaper than one invlpg each
+    static constexpr size_t INVALIDATE_BATCH = 32;
+    static constexpr size_t TABLE_BATCH = 8;
+    static constexpr size_t TRANSLATION_CACHE_SIZE = 32;
+    static constexpr uintptr_t TRANSLATION_VALID = 1;
+
+    // Direct-mapped cache of recent VirtToPhys lookups, keyed by virtual page
+    struct Translation {
+        uintptr_t tag;
+        uintptr_t physPage;
+    };
+
+    uint32_t* PageDirectory{ nullptr }; // physical address
+    bool m_LargePages{ false };
+    bool m_WriteCombining{ false };
+    bool m_PagingEnabled{ false };
+
+    // Present entries in each page table, so empty tables can be reclaimed
+    uint16_t m_TableUsage[PAGE_ENTRIES]{};
+
+    size_t m_TransactionDepth{ 0 };
+    uintptr_t m_PendingPages[INVALIDATE_BATCH]{};
+    size_t m_PendingPageCount{ 0 };
+    bool m_PendingFlushAll{ false };
+    // Emptied tables may still be cached by the MMU, they are only freed after the flush
+    uintptr_t m_PendingTables[TABLE_BATCH]{};
+    size_t m_PendingTableCount{ 0 };
+
+    Translation m_Translations[TRANSLATION_CACHE_SIZE]{};
+
+    uint32_t ResolveCacheType(uint32_t flags) const;
+    bool CanMapLarge(uintptr_t phys_addr, uintptr_t virt_addr, size_t remaining);
+    void MapLargePage(uintptr_t phys_addr, uintptr_t virt_addr, uint32_t flags);
+    uint32_t* SplitLargePage(uint32_t pd_index);
+    void ReleasePageTable(uint32_t pd_index);
+
+    void Invalidate(uintptr_t virt_addr);
+    void InvalidateAll();
+    void DropTranslations();
+    void Flush();
 
     void* AllocatePageAligned();
     uint32_t* GetPageTable(uint32_t pd_index, bool create_if_missing = true);
 
-    uint32_t& PDE(uint32_t pd_index) { return PageDirectory[pd_index]; }
-    uint32_t& PTE(uint32_t pd_index, uint32_t pt_index);
+    // Paging structures are reached through their physical address until paging is on, then through the recursive slot
+    uint32_t* Directory();
+    uint32_t* TableOf(uint32_t pd_index);
+    void* MapScratch(uintptr_t phys_addr);
+
+    uint32_t& PDE(uint32_t pd_index) { return Directory()[pd_index]; }
 
     uintptr_t KernelVirtualOffset = 0xC0000000;
 };
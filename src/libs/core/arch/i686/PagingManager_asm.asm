@@ -3,6 +3,8 @@
 global load_cr3
 global enable_paging
 global invlpg
+global enable_pse
+global enable_pat
 
 section .text
 
@@ -23,4 +25,42 @@ enable_paging:
 invlpg:
     mov eax, [esp + 4]
     invlpg [eax]
-    ret
\ No newline at end of file
+    ret
+
+; bool enable_pse(void)
+; Turns on 4 MiB pages (CR4.PSE) if the CPU supports them, returns whether it did.
+enable_pse:
+    push ebx
+    mov eax, 1
+    cpuid
+    xor eax, eax
+    test edx, (1 << 3)
+    jz .done
+    mov ecx, cr4
+    or ecx, (1 << 4)
+    mov cr4, ecx
+    mov eax, 1
+.done:
+    pop ebx
+    ret
+
+; bool enable_pat(void)
+; Reprograms PAT entry 4 (selected by the PAT bit alone) from write-back to write-combining,
+; returns whether the CPU has a PAT. Entries 0-3 keep their power-on WB, WT, UC-, UC types.
+enable_pat:
+    push ebx
+    mov eax, 1
+    cpuid
+    xor eax, eax
+    test edx, (1 << 16)
+    jz .done
+    mov ecx, 0x277          ; IA32_PAT
+    rdmsr
+    and edx, 0xFFFFFF00
+    or edx, 0x01            ; PA4 = WC
+    wrmsr
+    wbinvd
+    mov eax, 1
+.done:
+    pop ebx
+    ret
@@ -30,6 +30,11 @@ void PIT::Init(uint32_t frequency) {
     Debug::Info("PIT", "PIT initialized. Frequency: %d", g_PITHZ);
 }
 
+uint64_t PIT::MsToTicks(uint32_t ms) {
+    uint64_t ticks = static_cast<uint64_t>(ms) * g_PITHZ / 1000;
+    return ticks ? ticks : 1;
+}
+
 void sleep(uint32_t ms) {
     uint32_t start = PITTicks;
     uint32_t target = (ms * g_PITHZ) / 1000;
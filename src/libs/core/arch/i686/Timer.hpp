@@ -3,8 +3,12 @@
 #include <stdint.h>
 #include <stddef.h>
 
+// Incremented by the PIT interrupt, `frequency` times per second
+extern volatile uint64_t PITTicks;
+
 namespace PIT {
     void Init(uint32_t frequency);
+    uint64_t MsToTicks(uint32_t ms);
 }
 
 void sleep(uint32_t ms);
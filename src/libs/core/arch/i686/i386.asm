@@ -49,6 +49,30 @@ InPortL:
     in eax, dx
     ret
 
+; EXPORT void ASMCALL InPortSW(uint16_t port, void* buffer, uint32_t count);
+global InPortSW
+InPortSW:
+    push edi
+    mov dx, [esp + 8]
+    mov edi, [esp + 12]
+    mov ecx, [esp + 16]
+    cld
+    rep insw
+    pop edi
+    ret
+
+; EXPORT void ASMCALL OutPortSW(uint16_t port, const void* buffer, uint32_t count);
+global OutPortSW
+OutPortSW:
+    push esi
+    mov dx, [esp + 8]
+    mov esi, [esp + 12]
+    mov ecx, [esp + 16]
+    cld
+    rep outsw
+    pop esi
+    ret
+
 ; EXPORT void ASMCALL DisableInterrupts();
 global DisableInterrupts
 DisableInterrupts:
@@ -119,9 +143,42 @@ IOWait:
     out dx, al
     ret
 
+; EXPORT uint64_t ASMCALL ReadTSC();
+global ReadTSC
+ReadTSC:
+    rdtsc
+    ret
+
+; EXPORT bool ASMCALL EnableSSE();
+; Turns on the FPU and SSE (CR0.MP, CR4.OSFXSR/OSXMMEXCPT) if the CPU has SSE2.
+global EnableSSE
+EnableSSE:
+    push ebx
+    mov eax, 1
+    cpuid
+    xor eax, eax
+    test edx, (1 << 26)     ; SSE2
+    jz .done
+
+    mov ecx, cr0
+    and ecx, ~(1 << 2)      ; EM: no FPU emulation
+    or ecx, (1 << 1)        ; MP
+    mov cr0, ecx
+
+    mov ecx, cr4
+    or ecx, (1 << 9) | (1 << 10)
+    mov cr4, ecx
+
+    fninit
+    mov eax, 1
+.done:
+    pop ebx
+    ret
+
 ; --------------------------------------------------------------
 
 extern ISRSHandler
+extern g_MemorySSE
 
 %macro ISR_NOERRORCODE 1
 global ISRWrapper%1
@@ -153,11 +210,28 @@ ISR_Common:
     mov fs, ax
     mov gs, ax
 
-    push esp
+    ; Handlers may run memcpy/memset, which use XMM registers once SSE is on,
+    ; so the interrupted code's SSE state is saved on the stack around the call
+    mov ebx, esp
+    xor esi, esi
+    cmp byte [g_MemorySSE], 0
+    je .call_handler
+    sub esp, 512
+    and esp, ~0xF
+    fxsave [esp]
+    mov esi, 1
+
+.call_handler:
+    push ebx
     call ISRSHandler
-
     add esp, 4
 
+    test esi, esi
+    jz .restored
+    fxrstor [esp]
+.restored:
+    mov esp, ebx
+
     pop eax,
     mov ds, ax
     mov es, ax
@@ -1,6 +1,8 @@
 #include "Memory.hpp"
 #include <core/Assert.hpp>
 #include <core/Debug.hpp>
+#include <core/mem/SlabAllocator.hpp>
+#include <core/mem/TLSFHeap.hpp>
 
 #include <cstddef>
 
@@ -27,155 +29,89 @@ uint32_t get_alignment(void* ptr) {
     return (align > 64 ? 64 : align);
 }
 
-struct Block {
-    uint32_t size;
-    bool free;
-    Block* next;
-    Block* prev;
-};
-
-extern uint32_t KERNEL_START;
-extern uint32_t KERNEL_END;
-
-static Block* g_FreeList = nullptr;
-
-MemoryRegion FindBestRegion(MemoryInfo* info, size_t& idx) {
-    uintptr_t kernel_start = (uintptr_t)&KERNEL_START;
-    uintptr_t kernel_end   = (uintptr_t)&KERNEL_END;
-
-    MemoryRegion best = {0};
-
-    for (size_t i = 0; i < info->BlockCount; ++i) {
-        MemoryRegion region = info->Regions[i];
-
-        if (region.Type != 1) continue; // Only usable RAM
-
-        uintptr_t start = region.Begin;
-        uintptr_t end   = region.Begin + region.Length;
-
-        // Skip region entirely if it ends before or starts after the kernel
-        if (end <= kernel_start || start >= kernel_end) {
-            // No overlap with kernel at all, fully usable
-            if (region.Length > best.Length)
-                best = region;
-        }
-        // If region overlaps kernel partially or fully
-        else {
-            // Adjust the region to start after the kernel ends
-            if (start < kernel_end && end > kernel_end) {
-                uintptr_t adjusted_start = kernel_end;
-                uintptr_t adjusted_length = end - kernel_end;
-                if (adjusted_length > best.Length) {
-                    best.Begin = adjusted_start;
-                    best.Length = adjusted_length;
-                    best.Type = region.Type;
-                    idx = i;
-                }
-            }
-            // Region starts inside kernel or exactly where kernel starts (fully unusable portion)
-            // e.g., region.Begin == kernel_start and end <= kernel_end
-            // => skip it because no usable memory left
-        }
+static TLSFHeap g_Heap;
+static HeapSbrkFn g_HeapSbrk = nullptr;
+// Growth granularity, so a run of small allocations doesn't move the break one page at a time
+static constexpr size_t HeapGrowStep = 1024 * 1024;
+static constexpr size_t HeapPageSize = 4096;
+
+static SlabAllocator g_SlabAllocator;
+static bool g_SlabEnabled = false;
+
+static void* HeapAllocate(uint32_t size, uint32_t alignment);
+static void HeapFree(void* ptr);
+
+bool Mem_Init(HeapSbrkFn sbrk, size_t initial_size, size_t max_size) {
+    initial_size = ALIGN_UP(initial_size, HeapPageSize);
+    uintptr_t heap_base = reinterpret_cast<uintptr_t>(sbrk(initial_size));
+    if (!heap_base || !g_Heap.Initialize(heap_base, initial_size)) {
+        Debug::Critical("MemInit", "Failed to initialize the kernel heap!");
+        return false;
     }
+    g_HeapSbrk = sbrk;
 
-    return best;
+    Debug::Info("MemInit", "Memory initialized! Heap [%08X - %08X] (%uKB), may grow up to %08X", 
+        heap_base, heap_base + initial_size, initial_size / 1024, heap_base + max_size);
+
+    g_SlabEnabled = g_SlabAllocator.Initialize(heap_base, max_size, HeapAllocate, HeapFree);
+    if (!g_SlabEnabled) Debug::Warn("MemInit", "Slab allocator unavailable, small allocations use the general heap");
+    return true;
 }
 
+// Moves the break far enough to satisfy an allocation of `min_bytes` and hands the new range to the heap.
+static bool GrowHeap(size_t min_bytes) {
+    if (!g_HeapSbrk) return false;
 
-bool Mem_Init(uintptr_t heap_base, const MemoryRegion& best_region) {
-    g_FreeList = (Block*)(heap_base);
-    memset(g_FreeList, 0x00, sizeof(Block));
-    
-    g_FreeList->size = best_region.Length - (sizeof(Block) * 2);
-    g_FreeList->free = true;
-    g_FreeList->prev = nullptr;
+    // TLSF rounds requests up to the next list boundary (at most 1/32 extra), leave room for that and the headers
+    size_t needed = ALIGN_UP(min_bytes + min_bytes / 16 + 64, HeapPageSize);
+    size_t bytes = ALIGN_UP(needed, HeapGrowStep);
 
-    uintptr_t tail_ptr = (heap_base + g_FreeList->size + sizeof(Block));
-    Block* tail = reinterpret_cast<Block*>(tail_ptr);
-    memset(tail, 0x00, sizeof(Block));
-    
-    tail->size = 0;
-    tail->free = true;
-    tail->next = nullptr;
-    tail->prev = g_FreeList;
-    g_FreeList->next = tail;
+    void* old_break = g_HeapSbrk(bytes);
+    if (!old_break && bytes != needed) {
+        bytes = needed;
+        old_break = g_HeapSbrk(bytes);
+    }
+    if (!old_break) return false;
 
-    Debug::Info("MemInit", "Memory initialized! Region [%08X - %08X] (%dMB)", best_region.Begin, best_region.Begin + best_region.Length, best_region.Length / 1024 / 1024);
-    return true;
+    if (reinterpret_cast<uintptr_t>(old_break) != g_Heap.Base() + g_Heap.Size()) {
+        Debug::Error("Allocator", "Heap break moved behind the allocator's back (%p)", old_break);
+        return false;
+    }
+    return g_Heap.Extend(bytes);
+}
+
+void Mem_SetSlabEnabled(bool enabled) {
+    g_SlabEnabled = enabled;
 }
 
 void* zmalloc_aligned(uint32_t size, uint32_t alignment) {
-    Block* current = g_FreeList;
-
-    constexpr size_t MIN_SPLIT_PAYLOAD = 16;
-
-    while (current) {
-        if (!current->free) {
-            current = current->next;
-            continue;
-        }
-
-        uintptr_t raw_block = (uintptr_t)current;
-        uintptr_t payload_base = raw_block + sizeof(Block);
-        uintptr_t user_data = ALIGN_UP(payload_base + sizeof(void*), alignment);
-        uintptr_t block_end = user_data + size;
-        if (block_end <= payload_base) {
-            current = current->next;
-            continue;
-        }
-
-        uintptr_t total_size = block_end - payload_base;
-
-        if (current->size >= total_size) {
-            size_t leftover = current->size - static_cast<size_t>(total_size);
-
-            bool do_split = false;
-            if (leftover >= sizeof(Block) + MIN_SPLIT_PAYLOAD) do_split = true;
-            if (current->next == nullptr && leftover >= sizeof(Block)) do_split = true; 
-
-            if (do_split) {
-                Block* split = (Block*)(payload_base + total_size);
-                split->size = static_cast<uint32_t>(leftover - sizeof(Block));
-                split->free = true;
-                split->next = current->next;
-                split->prev = current;
-
-                if (current->next) current->next->prev = split;
-                current->next = split;
-                current->size = static_cast<uint32_t>(total_size);
-            }
-
-            current->free = false;
-            uintptr_t backref = user_data - sizeof(void*);
-            *((Block**)backref) = current;
-            return (void*)user_data;
-        }
-        
-        current = current->next;
+    if (g_SlabEnabled && SlabAllocator::Handles(size, alignment)) {
+        void* ptr = g_SlabAllocator.Allocate(size < alignment ? alignment : size);
+        if (ptr) return ptr;
     }
-    
-    unreachable();
-    return nullptr;
+    return HeapAllocate(size, alignment);
+}
+
+static void* HeapAllocate(uint32_t size, uint32_t alignment) {
+    void* ptr = g_Heap.Allocate(size, alignment);
+    if (!ptr && GrowHeap(static_cast<size_t>(size) + alignment)) ptr = g_Heap.Allocate(size, alignment);
+    if (!ptr) Debug::Error("Allocator", "Out of memory! (size: %u, alignment: %u)", size, alignment);
+    return ptr;
 }
 
 void zfree(void* ptr) {
     if (!ptr) return;
 
-    uintptr_t backref = (uintptr_t)ptr - sizeof(void*);
-    Block* block = *((Block**)backref);
-    block->free = true;
-
-    if (block->next && block->next > block && block->next->free) {
-        block->size += sizeof(Block) + block->next->size;
-        block->next = block->next->next;
-        if (block->next) block->next->prev = block;
+    // Slab objects are recognised by address, so they go back to the slab even if it was disabled since
+    if (g_SlabAllocator.Owns(ptr)) {
+        g_SlabAllocator.Free(ptr);
+        return;
     }
+    HeapFree(ptr);
+}
 
-    if (block->prev && block->prev->free) {
-        block->prev->size += sizeof(Block) + block->size;
-        block->prev->next = block->next;
-        if (block->next) block->next->prev = block->prev;
-    }
+static void HeapFree(void* ptr) {
+    g_Heap.Free(ptr);
 }
 
 void* zrealloc(void* ptr, uint32_t new_size) {
@@ -186,25 +122,19 @@ void* zrealloc(void* ptr, uint32_t new_size) {
         return nullptr;
     }
 
-    uintptr_t backref = (uintptr_t)ptr - sizeof(void*);
-    Block* block = *((Block**)backref);
-    if (block->size >= new_size) return ptr;
-
-    if (block->next && block->next->free) {
-        uint32_t combined_size = block->size + sizeof(Block) + block->next->size;
-        if (combined_size >= new_size) {
-            Block* next = block->next;
-            block->size = combined_size;
-            block->next = next->next;
-            if (next->next) next->next->prev = block;
-            return ptr;
-        }
+    size_t old_size;
+    if (g_SlabAllocator.Owns(ptr)) {
+        old_size = g_SlabAllocator.SizeOf(ptr);
+        if (old_size >= new_size) return ptr;
+    } else {
+        if (g_Heap.ResizeInPlace(ptr, new_size)) return ptr;
+        old_size = g_Heap.UsableSize(ptr);
     }
 
     void* new_ptr = zmalloc_aligned(new_size, 8);
     if (!new_ptr) return nullptr;
 
-    memcpy(new_ptr, ptr, block->size);
+    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
     zfree(ptr);
 
     return new_ptr;
@@ -214,7 +144,7 @@ void* zmalloc(uint32_t size) {
     return zmalloc_aligned(size, 8);
 }
 
-void* zcalloc(uint32_t size, uint8_t n) {
+void* zcalloc(uint32_t size, uint32_t n) {
     size_t bytes = n * size;
     if (size && bytes / size != n) return nullptr;
     void* p = zmalloc_aligned((uint32_t)bytes, 8);
@@ -266,20 +196,6 @@ void operator delete(void*, void* ptr) {
 }
 
 void DumpHeap() {
-    Debug::Info("Allocator", "================ HEAP DUMP ================");
-    Block* current = g_FreeList;
-    int index = 0;
-    size_t total_free = 0, total_used = 0;
-
-    while (current) {
-        const char* status = current->free ? "free" : "used";
-        Debug::Info("Allocator", "#%02d - Addr: %p | Size: %08zu | Status: %s", index++, current, current->size, status);
-        if (current->free) total_free += current->size;
-        else total_used += current->size;
-        current = current->next;
-    }
-
-    Debug::Info("Allocator", "Total Used: %zu bytes (%zuMB)", total_used, total_used / 1024 / 1024);
-    Debug::Info("Allocator", "Total Free: %zu bytes (%zuMB)", total_free, total_free / 1024 / 1024);
-    Debug::Info("Allocator", "================ HEAP DUMP ================");
+    g_Heap.Dump();
+    g_SlabAllocator.DumpStats();
 }
\ No newline at end of file
@@ -10,6 +10,9 @@ EXPORT void* ASMCALL memset(void* dst, uint32_t val, size_t size);
 EXPORT int   ASMCALL memcmp(const void* ptr1, const void* ptr2, size_t size); 
 EXPORT void* ASMCALL memmove(void *, const void *, unsigned long);
 
+// Non-zero once SSE is enabled; large copies and fills then use 16-byte XMM moves.
+EXPORT uint8_t g_MemorySSE;
+
 
 namespace Memory {
     constexpr auto Copy = memcpy;
@@ -22,10 +25,16 @@ namespace Memory {
 
 uint32_t get_alignment(void* ptr);
 
-MemoryRegion FindBestRegion(MemoryInfo* info, size_t& idx);
-bool Mem_Init(uintptr_t heap_base, const MemoryRegion& best_region);
+// Extends the heap's address range by `increment` bytes and returns its old end, or nullptr when out of space.
+typedef void* (*HeapSbrkFn)(size_t increment);
+
+// The heap starts with `initial_size` bytes from `sbrk` and grows through it on demand, up to `max_size` bytes.
+bool Mem_Init(HeapSbrkFn sbrk, size_t initial_size, size_t max_size);
+// Routes small allocations through the size-class slab allocator (enabled by Mem_Init).
+void Mem_SetSlabEnabled(bool enabled);
+void DumpHeap();
 void* zmalloc(uint32_t size);
-void* zcalloc(uint32_t size, uint8_t n);
+void* zcalloc(uint32_t size, uint32_t n);
 void zfree(void* ptr);
 void* zrealloc(void* ptr, uint32_t new_size);
 void* zrecalloc(void* ptr, uint32_t new_size);
@@ -1,5 +1,91 @@
 [bits 32]
 
+; Set by the HAL once SSE is enabled; the XMM paths are skipped until then
+global g_MemorySSE
+section .data
+g_MemorySSE: db 0
+
+section .text
+
+; Copies/fills below this size aren't worth aligning for 16-byte moves
+SSE_THRESHOLD equ 128
+
+;
+; Internal: copies ecx bytes from esi to edi, front to back.
+; Clobbers ecx, edx, esi, edi and xmm0-xmm3; expects the direction flag to be clear.
+;
+copy_forward:
+    cmp ecx, SSE_THRESHOLD
+    jb .dwords
+    cmp byte [g_MemorySSE], 0
+    je .dwords
+
+    ; byte copy until the destination is 16-byte aligned
+    mov edx, edi
+    neg edx
+    and edx, 15
+    sub ecx, edx
+    xchg ecx, edx
+    rep movsb
+    mov ecx, edx
+
+    ; 64 bytes per iteration, aligned loads when the source happens to line up too
+    mov edx, ecx
+    shr edx, 6
+    and ecx, 63
+    test esi, 15
+    jnz .sse_unaligned
+
+    .sse_aligned:
+        movdqa xmm0, [esi]
+        movdqa xmm1, [esi + 16]
+        movdqa xmm2, [esi + 32]
+        movdqa xmm3, [esi + 48]
+        movdqa [edi], xmm0
+        movdqa [edi + 16], xmm1
+        movdqa [edi + 32], xmm2
+        movdqa [edi + 48], xmm3
+        add esi, 64
+        add edi, 64
+        dec edx
+        jnz .sse_aligned
+        jmp .dwords
+
+    .sse_unaligned:
+        movdqu xmm0, [esi]
+        movdqu xmm1, [esi + 16]
+        movdqu xmm2, [esi + 32]
+        movdqu xmm3, [esi + 48]
+        movdqa [edi], xmm0
+        movdqa [edi + 16], xmm1
+        movdqa [edi + 32], xmm2
+        movdqa [edi + 48], xmm3
+        add esi, 64
+        add edi, 64
+        dec edx
+        jnz .sse_unaligned
+
+    .dwords:
+    cmp ecx, 8
+    jb .bytes
+
+    ; byte copy until the destination is dword aligned, then whole dwords
+    mov edx, edi
+    neg edx
+    and edx, 3
+    sub ecx, edx
+    xchg ecx, edx
+    rep movsb
+    mov ecx, edx
+    shr ecx, 2
+    rep movsd
+    mov ecx, edx
+    and ecx, 3
+
+    .bytes:
+    rep movsb
+    ret
+
 ;
 ; EXPORT void ASMCALL memcpy(void* dst, void* src, size_t size);
 ; Args (cdecl):
@@ -13,22 +99,19 @@ global memcpy
 memcpy:
     push ebp
     mov ebp, esp
+    push esi
+    push edi
 
     mov edi, [ebp + 8]  ; dst
     mov esi, [ebp + 12] ; src
     mov ecx, [ebp + 16] ; count
 
-    push edi ; save return value (dst)
-
-    ; check for zero length
-    test ecx, ecx
-    je .done
-
     cld
-    rep movsb
+    call copy_forward
 
-    .done:
-    pop eax
+    mov eax, [ebp + 8]
+    pop edi
+    pop esi
     pop ebp
     ret
 
@@ -45,22 +128,67 @@ global memset
 memset:
     push ebp
     mov ebp, esp
+    push edi
 
     mov edi, [ebp + 8]  ; dst
-    mov eax, [ebp + 12] ; value
+    movzx eax, byte [ebp + 12] ; value
     mov ecx, [ebp + 16] ; count
 
-    push edi ; save return value (dst)
-
-    ; check for zero length
-    test ecx, ecx
-    je .done
+    ; replicate the byte into every byte of eax
+    mov edx, 0x01010101
+    imul eax, edx
 
     cld
+    cmp ecx, SSE_THRESHOLD
+    jb .dwords
+    cmp byte [g_MemorySSE], 0
+    je .dwords
+
+    ; byte fill until the destination is 16-byte aligned
+    mov edx, edi
+    neg edx
+    and edx, 15
+    sub ecx, edx
+    xchg ecx, edx
     rep stosb
+    mov ecx, edx
 
-    .done:
-    pop eax
+    movd xmm0, eax
+    pshufd xmm0, xmm0, 0
+    mov edx, ecx
+    shr edx, 6
+    and ecx, 63
+
+    .sse:
+        movdqa [edi], xmm0
+        movdqa [edi + 16], xmm0
+        movdqa [edi + 32], xmm0
+        movdqa [edi + 48], xmm0
+        add edi, 64
+        dec edx
+        jnz .sse
+
+    .dwords:
+    cmp ecx, 8
+    jb .bytes
+
+    mov edx, edi
+    neg edx
+    and edx, 3
+    sub ecx, edx
+    xchg ecx, edx
+    rep stosb
+    mov ecx, edx
+    shr ecx, 2
+    rep stosd
+    mov ecx, edx
+    and ecx, 3
+
+    .bytes:
+    rep stosb
+
+    mov eax, [ebp + 8]
+    pop edi
     pop ebp
     ret
 
@@ -79,6 +207,9 @@ global memcmp
 memcmp:
     push ebp
     mov ebp, esp
+    push ebx
+    push esi
+    push edi
 
     mov esi, [ebp + 8]    ; s1
     mov edi, [ebp + 12]   ; s2
@@ -99,6 +230,9 @@ memcmp:
     sub eax, ebx
 
 .done:
+    pop edi
+    pop esi
+    pop ebx
     pop ebp
     ret
 
@@ -122,6 +256,7 @@ memmove:
     cmp edi, esi 
     je .done
 
+    ; A forward copy is safe unless the destination starts inside the source
     jb .forward_copy
 
     mov edx, esi
@@ -129,27 +264,29 @@ memmove:
     cmp edi, edx
     jae .forward_copy
 
-    add esi, ecx
-    add edi, ecx
+    ; Back to front: the odd trailing bytes first, then whole dwords
+    lea esi, [esi + ecx - 1]
+    lea edi, [edi + ecx - 1]
     std
-    dec esi
-    dec edi
+    mov edx, ecx
+    and ecx, 3
     rep movsb
+    sub esi, 3
+    sub edi, 3
+    mov ecx, edx
+    shr ecx, 2
+    rep movsd
     cld
     jmp .done
 
     .forward_copy:
         cld
-        mov edx, ecx
-        shr ecx, 2
-        rep movsd
-        mov ecx, edx
-        and ecx, 3
-        rep movsb
+        call copy_forward
 
     .done:
+        mov eax, [ebp + 8]
         pop edi
         pop esi
         mov esp, ebp
         pop ebp
-        ret
\ No newline at end of file
+        ret
@@ -0,0 +1,42 @@
+#include "BlockDevice.hpp"
+
+#include <core/cpp/Algorithm.hpp>
+
+uint8_t* IOVecCursor::Next(size_t max, size_t& length) {
+    while (offset == iov[index].length) {
+        index++;
+        offset = 0;
+    }
+    uint8_t* piece = static_cast<uint8_t*>(iov[index].base) + offset;
+    length = min<size_t>(max, iov[index].length - offset);
+    offset += length;
+    return piece;
+}
+
+void IOVecCursor::Rewind(size_t bytes) {
+    while (bytes > offset) {
+        bytes -= offset;
+        offset = iov[--index].length;
+    }
+    offset -= bytes;
+}
+
+bool BlockDevice::ReadBlocks(uint64_t lba, size_t count, const IOVec* iov, size_t iov_count) {
+    if (IOVecLength(iov, iov_count) != count * BlockSize()) return false;
+    if (!Seek(lba * BlockSize(), SeekPos::Set)) return false;
+
+    for (size_t i = 0; i < iov_count; i++) {
+        if (Read(static_cast<uint8_t*>(iov[i].base), iov[i].length) != iov[i].length) return false;
+    }
+    return true;
+}
+
+bool BlockDevice::WriteBlocks(uint64_t lba, size_t count, const IOVec* iov, size_t iov_count) {
+    if (IOVecLength(iov, iov_count) != count * BlockSize()) return false;
+    if (!Seek(lba * BlockSize(), SeekPos::Set)) return false;
+
+    for (size_t i = 0; i < iov_count; i++) {
+        if (Write(static_cast<const uint8_t*>(iov[i].base), iov[i].length) != iov[i].length) return false;
+    }
+    return true;
+}
@@ -10,9 +10,43 @@ enum class SeekPos {
     End,
 };
 
+// One piece of a scattered transfer buffer
+struct IOVec {
+    void* base;
+    size_t length;
+};
+
+inline size_t IOVecLength(const IOVec* iov, size_t iov_count) {
+    size_t length = 0;
+    for (size_t i = 0; i < iov_count; i++)
+        length += iov[i].length;
+    return length;
+}
+
+// Position inside an iovec array while a transfer consumes it
+struct IOVecCursor {
+    const IOVec* iov;
+    size_t index;
+    size_t offset;
+
+    // Hands out the next contiguous piece of at most `max` bytes
+    uint8_t* Next(size_t max, size_t& length);
+    // Steps back over the last `bytes` bytes handed out
+    void Rewind(size_t bytes);
+};
+
+// Positions and sizes are 64-bit byte offsets, so devices past 4 GiB (and LBA48 disks) are addressable
 class BlockDevice : public CharacterDevice {
 public:
-    virtual bool Seek(int rel, SeekPos pos) = 0;
-    virtual size_t Position() = 0;
-    virtual size_t Size() = 0;
+    virtual bool Seek(int64_t rel, SeekPos pos) = 0;
+    virtual uint64_t Position() = 0;
+    virtual uint64_t Size() = 0;
+
+    // Block-addressed scatter/gather transfers, independent of the Seek cursor.
+    // The pieces of `iov` are filled (or drained) in order, must add up to exactly count * BlockSize() bytes
+    // and each must hold an even number of bytes.
+    // The defaults go through Seek and Read/Write and leave the cursor after the transferred range.
+    virtual bool ReadBlocks(uint64_t lba, size_t count, const IOVec* iov, size_t iov_count);
+    virtual bool WriteBlocks(uint64_t lba, size_t count, const IOVec* iov, size_t iov_count);
+    virtual uint32_t BlockSize() { return 512; }
 };
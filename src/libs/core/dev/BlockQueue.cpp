@@ -0,0 +1,148 @@
+#include "BlockQueue.hpp"
+
+#include <core/Debug.hpp>
+
+BlockQueue::BlockQueue()
+    : m_Device(nullptr), m_Pending(nullptr), m_PendingCount(0), m_Depth(DefaultDepth), m_Head(0),
+      m_Submitted(0), m_Dispatches(0), m_Merged(0), m_HeadTravel(0) {}
+
+void BlockQueue::Initialize(BlockDevice* device, size_t depth) {
+    m_Device = device;
+    m_Depth = depth ? depth : 1;
+    m_Pending = nullptr;
+    m_PendingCount = 0;
+    m_Head = 0;
+    ResetStats();
+}
+
+void BlockQueue::Submit(BlockRequest* request) {
+    request->done = false;
+    request->ok = false;
+    request->next = nullptr;
+
+    if (Conflicts(request)) Run();
+
+    BlockRequest** link = &m_Pending;
+    while (*link && (*link)->lba <= request->lba)
+        link = &(*link)->next;
+    request->next = *link;
+    *link = request;
+
+    m_PendingCount++;
+    m_Submitted++;
+    if (m_PendingCount >= m_Depth) Run();
+}
+
+bool BlockQueue::Run() {
+    bool ok = true;
+    while (m_Pending) {
+        if (!DispatchOne()) ok = false;
+    }
+    return ok;
+}
+
+bool BlockQueue::Wait(BlockRequest* request) {
+    while (!request->done) {
+        if (!m_Pending) return false;
+        DispatchOne();
+    }
+    return request->ok;
+}
+
+bool BlockQueue::Read(uint64_t lba, uint8_t* buffer, size_t count) {
+    BlockRequest request{ lba, count, buffer, false, nullptr, nullptr };
+    Submit(&request);
+    return Wait(&request);
+}
+
+bool BlockQueue::Write(uint64_t lba, uint8_t* buffer, size_t count) {
+    BlockRequest request{ lba, count, buffer, true, nullptr, nullptr };
+    Submit(&request);
+    return Wait(&request);
+}
+
+bool BlockQueue::Conflicts(const BlockRequest* request) const {
+    uint64_t end = request->lba + request->count;
+    for (BlockRequest* pending = m_Pending; pending && pending->lba < end; pending = pending->next) {
+        if (!pending->write && !request->write) continue;
+        if (request->lba < pending->lba + pending->count) return true;
+    }
+    return false;
+}
+
+BlockRequest* BlockQueue::TakeBatch() {
+    // C-LOOK: the first request at or past the head, otherwise wrap around to the lowest LBA
+    BlockRequest** link = &m_Pending;
+    while (*link && (*link)->lba < m_Head)
+        link = &(*link)->next;
+    if (!*link) link = &m_Pending;
+
+    BlockRequest* first = *link;
+    BlockRequest* last = first;
+    size_t blocks = first->count;
+    size_t requests = 1;
+    *link = first->next;
+    m_PendingCount--;
+
+    // The list is sorted, so whatever continues the batch follows right behind it
+    while (BlockRequest* candidate = *link) {
+        if (candidate->write != first->write || candidate->lba != last->lba + last->count) break;
+        if (blocks + candidate->count > MaxBatchBlocks || requests == MaxBatchPieces) break;
+
+        *link = candidate->next;
+        last->next = candidate;
+        last = candidate;
+        blocks += candidate->count;
+        requests++;
+        m_PendingCount--;
+        m_Merged++;
+    }
+    last->next = nullptr;
+    return first;
+}
+
+bool BlockQueue::DispatchOne() {
+    BlockRequest* batch = TakeBatch();
+    uint32_t block_size = m_Device->BlockSize();
+
+    size_t count = 0, pieces = 0;
+    for (BlockRequest* request = batch; request; request = request->next) {
+        size_t length = request->count * block_size;
+        IOVec* previous = pieces ? &m_Pieces[pieces - 1] : nullptr;
+        if (previous && static_cast<uint8_t*>(previous->base) + previous->length == request->buffer)
+            previous->length += length;
+        else m_Pieces[pieces++] = IOVec{ request->buffer, length };
+        count += request->count;
+    }
+
+    m_HeadTravel += batch->lba > m_Head ? batch->lba - m_Head : m_Head - batch->lba;
+    m_Dispatches++;
+
+    bool ok = batch->write ? m_Device->WriteBlocks(batch->lba, count, m_Pieces, pieces)
+                           : m_Device->ReadBlocks(batch->lba, count, m_Pieces, pieces);
+    if (!ok) Debug::Error("BlockQueue", "%s of %u blocks at LBA %llu failed", batch->write ? "Write" : "Read", count, batch->lba);
+    m_Head = batch->lba + count;
+
+    // Callbacks may resubmit or release their request, so the link is read first
+    for (BlockRequest* request = batch; request;) {
+        BlockRequest* next = request->next;
+        request->next = nullptr;
+        request->ok = ok;
+        request->done = true;
+        if (request->callback) request->callback(request, request->data);
+        request = next;
+    }
+    return ok;
+}
+
+void BlockQueue::ResetStats() {
+    m_Submitted = 0;
+    m_Dispatches = 0;
+    m_Merged = 0;
+    m_HeadTravel = 0;
+}
+
+void BlockQueue::LogStats(const char* module) {
+    Debug::Info(module, "%llu requests in %llu device calls (%llu merged), head travel %llu blocks",
+        m_Submitted, m_Dispatches, m_Merged, m_HeadTravel);
+}
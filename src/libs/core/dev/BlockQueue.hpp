@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "BlockDevice.hpp"
+
+struct BlockRequest;
+// Runs once the request has been transferred (or failed), from whichever call dispatched it
+using BlockCallback = void(*)(BlockRequest* request, void* data);
+
+struct BlockRequest {
+    uint64_t lba;
+    size_t count;
+    uint8_t* buffer;    // count * BlockSize() bytes, owned by the submitter until the request completes
+    bool write;
+    BlockCallback callback;
+    void* data;
+
+    // Set by the queue
+    bool done;
+    bool ok;
+    BlockRequest* next;
+};
+
+// Collects block requests and hands them to the device in C-LOOK order: ascending LBA from the last
+// dispatched position, wrapping around to the lowest pending LBA. Requests of the same direction whose
+// ranges touch are merged into one vectored ReadBlocks/WriteBlocks call.
+// Submit only queues; requests reach the device once `Depth` are pending, or through Run and Wait.
+// Device calls themselves still block until the transfer is done.
+class BlockQueue {
+public:
+    BlockQueue();
+
+    void Initialize(BlockDevice* device, size_t depth = DefaultDepth);
+    BlockDevice* Device() { return m_Device; }
+
+    void Submit(BlockRequest* request);
+    // Dispatches everything pending; false if any request failed
+    bool Run();
+    // Dispatches until `request` completed and returns its result
+    bool Wait(BlockRequest* request);
+    bool Idle() const { return m_Pending == nullptr; }
+
+    // Submit and wait in one go
+    bool Read(uint64_t lba, uint8_t* buffer, size_t count);
+    bool Write(uint64_t lba, uint8_t* buffer, size_t count);
+
+    // Total LBA distance between consecutive device calls, a stand-in for seek cost
+    uint64_t HeadTravel() const { return m_HeadTravel; }
+    uint64_t Dispatches() const { return m_Dispatches; }
+    void ResetStats();
+    void LogStats(const char* module);
+
+    static constexpr size_t DefaultDepth{ 64 };
+    static constexpr size_t MaxBatchBlocks{ 256 };
+    static constexpr size_t MaxBatchPieces{ 128 };
+private:
+    // Overlapping a pending request with a write on either side would let the elevator reorder the two
+    bool Conflicts(const BlockRequest* request) const;
+    BlockRequest* TakeBatch();
+    bool DispatchOne();
+
+    BlockDevice* m_Device;
+    // Sorted by LBA; equal LBAs keep submission order
+    BlockRequest* m_Pending;
+    size_t m_PendingCount;
+    size_t m_Depth;
+    uint64_t m_Head;
+
+    IOVec m_Pieces[MaxBatchPieces];
+
+    uint64_t m_Submitted;
+    uint64_t m_Dispatches;
+    uint64_t m_Merged;
+    uint64_t m_HeadTravel;
+};
@@ -0,0 +1,355 @@
+#include "BufferCache.hpp"
+
+#include <core/Debug.hpp>
+#include <core/arch/i686/Timer.hpp>
+#include <core/cpp/Algorithm.hpp>
+#include <core/cpp/Memory.hpp>
+
+constexpr const char* LogModule = "BufferCache";
+
+BufferCache g_BufferCache;
+
+BufferCache::BufferCache()
+    : m_Buffers(nullptr), m_Data(nullptr), m_Buckets(nullptr), m_Capacity(0), m_BucketMask(0),
+      m_LRUHead(nullptr), m_LRUTail(nullptr), m_WriteBack(false), m_FlushTicks(0), m_DirtyCount(0), m_DirtySince(0),
+      m_Hits(0), m_Misses(0), m_Evictions(0), m_Writes(0), m_Prefetched(0), m_PrefetchHits(0) {}
+
+bool BufferCache::Initialize(size_t capacity) {
+    if (m_Buffers) {
+        Flush();
+        delete[] m_Buffers;
+        delete[] m_Data;
+        delete[] m_Buckets;
+        m_Buffers = nullptr;
+        m_Capacity = 0;
+    }
+    if (!capacity) return false;
+
+    size_t buckets = 1;
+    while (buckets < capacity) buckets <<= 1;
+
+    m_Buffers = new Buffer[capacity];
+    m_Data = new uint8_t[capacity * BufferSize];
+    m_Buckets = new Buffer*[buckets];
+    if (!m_Buffers || !m_Data || !m_Buckets) {
+        Debug::Error(LogModule, "Failed to allocate %u buffers", capacity);
+        return false;
+    }
+
+    m_Capacity = capacity;
+    m_BucketMask = buckets - 1;
+    for (size_t i = 0; i < buckets; i++)
+        m_Buckets[i] = nullptr;
+
+    m_LRUHead = m_LRUTail = nullptr;
+    m_DirtyCount = 0;
+    for (size_t i = 0; i < capacity; i++) {
+        Buffer& buffer = m_Buffers[i];
+        buffer.device = nullptr;
+        buffer.lba = 0;
+        buffer.data = m_Data + i * BufferSize;
+        buffer.refs = 0;
+        buffer.valid = false;
+        buffer.dirty = false;
+        buffer.stage = 0;
+        buffer.prefetched = false;
+        buffer.m_HashNext = nullptr;
+        buffer.m_LRUPrev = buffer.m_LRUNext = nullptr;
+        TouchLRU(&buffer);
+    }
+
+    ResetStats();
+    return true;
+}
+
+BufferCache::Buffer* BufferCache::Get(BlockDevice* device, uint64_t lba, bool read) {
+    if (!m_Buffers && !Initialize(DefaultCapacity)) return nullptr;
+    if (device->BlockSize() != BufferSize) {
+        Debug::Error(LogModule, "Only %u-byte blocks are cached", BufferSize);
+        return nullptr;
+    }
+
+    if (Buffer* buffer = Find(device, lba)) {
+        m_Hits++;
+        if (buffer->prefetched) {
+            m_PrefetchHits++;
+            buffer->prefetched = false;
+        }
+        buffer->refs++;
+        TouchLRU(buffer);
+        return buffer;
+    }
+
+    m_Misses++;
+    Buffer* buffer = Evict();
+    if (!buffer) return nullptr;
+
+    if (read) {
+        IOVec iov{ buffer->data, BufferSize };
+        if (!device->ReadBlocks(lba, 1, &iov, 1)) {
+            Debug::Error(LogModule, "Failed to read block %llu", lba);
+            return nullptr;
+        }
+    }
+
+    buffer->device = device;
+    buffer->lba = lba;
+    buffer->refs = 1;
+    Insert(buffer);
+    return buffer;
+}
+
+size_t BufferCache::Prefetch(BlockDevice* device, uint64_t lba, size_t count) {
+    if (!m_Buffers && !Initialize(DefaultCapacity)) return 0;
+    if (device->BlockSize() != BufferSize) return 0;
+    count = min(count, m_Capacity / 2);
+
+    BlockQueue queue;
+    queue.Initialize(device, m_Capacity + 1);
+
+    // The claimed buffers stay referenced, so claiming the next one can't evict them, and are chained
+    // through their (unused) hash links until the reads are done
+    Buffer* claimed = nullptr;
+    for (size_t i = 0; i < count; i++) {
+        if (Find(device, lba + i)) continue;
+        Buffer* buffer = Evict();
+        if (!buffer) break;
+
+        buffer->refs = 1;
+        buffer->m_Request = BlockRequest{ lba + i, 1, buffer->data, false, nullptr, nullptr };
+        buffer->m_HashNext = claimed;
+        claimed = buffer;
+        queue.Submit(&buffer->m_Request);
+    }
+    queue.Run();
+
+    size_t fetched = 0;
+    while (Buffer* buffer = claimed) {
+        claimed = buffer->m_HashNext;
+        buffer->m_HashNext = nullptr;
+        buffer->refs = 0;
+        if (!buffer->m_Request.ok) continue;
+
+        buffer->device = device;
+        buffer->lba = buffer->m_Request.lba;
+        buffer->prefetched = true;
+        Insert(buffer);
+        fetched++;
+    }
+    m_Prefetched += fetched;
+    return fetched;
+}
+
+void BufferCache::Release(Buffer* buffer) {
+    if (buffer && buffer->refs) buffer->refs--;
+    FlushExpired();
+}
+
+bool BufferCache::MarkDirty(Buffer* buffer, uint8_t stage) {
+    if (stage >= Stages) stage = Stages - 1;
+    if (!buffer->dirty) {
+        if (!m_DirtyCount++) m_DirtySince = PITTicks;
+        buffer->dirty = true;
+        buffer->stage = stage;
+    } else if (stage > buffer->stage) buffer->stage = stage;
+
+    if (m_WriteBack) return true;
+    return WriteBuffer(buffer);
+}
+
+void BufferCache::SetWriteBack(bool enabled, uint32_t flush_interval_ms) {
+    if (!enabled) Flush();
+    m_WriteBack = enabled;
+    m_FlushTicks = PIT::MsToTicks(flush_interval_ms);
+}
+
+bool BufferCache::FlushExpired() {
+    if (!m_WriteBack || !m_DirtyCount || PITTicks - m_DirtySince < m_FlushTicks) return true;
+    return Flush();
+}
+
+bool BufferCache::Flush(BlockDevice* device) {
+    if (device) return FlushDevice(device);
+
+    bool ok = true;
+    for (size_t i = 0; i < m_Capacity; i++) {
+        Buffer& buffer = m_Buffers[i];
+        if (buffer.valid && buffer.dirty && !FlushDevice(buffer.device)) ok = false;
+    }
+    return ok;
+}
+
+bool BufferCache::FlushRange(BlockDevice* device, uint64_t lba, size_t count) {
+    if (!m_DirtyCount) return true;
+
+    // The device's dirty buffers go out together, sorted and merged, as soon as one of them is in the range
+    if (count > m_Capacity) {
+        for (size_t i = 0; i < m_Capacity; i++) {
+            Buffer& buffer = m_Buffers[i];
+            if (buffer.valid && buffer.dirty && buffer.device == device && buffer.lba >= lba && buffer.lba < lba + count)
+                return FlushDevice(device);
+        }
+        return true;
+    }
+    for (size_t i = 0; i < count; i++) {
+        Buffer* buffer = Find(device, lba + i);
+        if (buffer && buffer->dirty) return FlushDevice(device);
+    }
+    return true;
+}
+
+void BufferCache::Refresh(BlockDevice* device, uint64_t lba, size_t count, const uint8_t* data) {
+    // Referenced buffers are updated in place rather than dropped, so their holders keep seeing current data
+    auto refresh = [&](Buffer* buffer) {
+        Memory::Copy(buffer->data, data + (buffer->lba - lba) * BufferSize, BufferSize);
+        ClearDirty(buffer);
+    };
+
+    if (count > m_Capacity) {
+        for (size_t i = 0; i < m_Capacity; i++) {
+            Buffer& buffer = m_Buffers[i];
+            if (buffer.valid && buffer.device == device && buffer.lba >= lba && buffer.lba < lba + count)
+                refresh(&buffer);
+        }
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (Buffer* buffer = Find(device, lba + i)) refresh(buffer);
+    }
+}
+
+void BufferCache::Insert(Buffer* buffer) {
+    buffer->valid = true;
+    size_t bucket = Bucket(buffer->device, buffer->lba);
+    buffer->m_HashNext = m_Buckets[bucket];
+    m_Buckets[bucket] = buffer;
+    TouchLRU(buffer);
+}
+
+size_t BufferCache::Bucket(BlockDevice* device, uint64_t lba) const {
+    uint32_t hash = static_cast<uint32_t>(lba) * 2654435761u ^ (reinterpret_cast<uintptr_t>(device) >> 4);
+    return hash & m_BucketMask;
+}
+
+BufferCache::Buffer* BufferCache::Find(BlockDevice* device, uint64_t lba) {
+    if (!m_Buckets) return nullptr;
+    for (Buffer* buffer = m_Buckets[Bucket(device, lba)]; buffer; buffer = buffer->m_HashNext) {
+        if (buffer->device == device && buffer->lba == lba) return buffer;
+    }
+    return nullptr;
+}
+
+BufferCache::Buffer* BufferCache::Evict() {
+    Buffer* buffer = m_LRUTail;
+    while (buffer && buffer->refs) buffer = buffer->m_LRUPrev;
+    if (!buffer) {
+        Debug::Error(LogModule, "All %u buffers are in use", m_Capacity);
+        return nullptr;
+    }
+
+    if (buffer->valid) {
+        // Written together with the rest of its device, which keeps the stage order and merges the writes
+        if (buffer->dirty && (!FlushDevice(buffer->device) || buffer->dirty)) return nullptr;
+        Unhash(buffer);
+        m_Evictions++;
+    }
+    buffer->valid = false;
+    buffer->prefetched = false;
+    buffer->device = nullptr;
+    return buffer;
+}
+
+void BufferCache::Unhash(Buffer* buffer) {
+    if (!buffer->device) return;
+    for (Buffer** link = &m_Buckets[Bucket(buffer->device, buffer->lba)]; *link; link = &(*link)->m_HashNext) {
+        if (*link == buffer) {
+            *link = buffer->m_HashNext;
+            break;
+        }
+    }
+    buffer->m_HashNext = nullptr;
+}
+
+void BufferCache::TouchLRU(Buffer* buffer) {
+    UnlinkLRU(buffer);
+    buffer->m_LRUNext = m_LRUHead;
+    if (m_LRUHead) m_LRUHead->m_LRUPrev = buffer;
+    m_LRUHead = buffer;
+    if (!m_LRUTail) m_LRUTail = buffer;
+}
+
+void BufferCache::UnlinkLRU(Buffer* buffer) {
+    if (buffer->m_LRUPrev) buffer->m_LRUPrev->m_LRUNext = buffer->m_LRUNext;
+    else if (m_LRUHead == buffer) m_LRUHead = buffer->m_LRUNext;
+    if (buffer->m_LRUNext) buffer->m_LRUNext->m_LRUPrev = buffer->m_LRUPrev;
+    else if (m_LRUTail == buffer) m_LRUTail = buffer->m_LRUPrev;
+    buffer->m_LRUPrev = buffer->m_LRUNext = nullptr;
+}
+
+bool BufferCache::WriteBuffer(Buffer* buffer) {
+    IOVec iov{ buffer->data, BufferSize };
+    if (!buffer->device->WriteBlocks(buffer->lba, 1, &iov, 1)) {
+        Debug::Error(LogModule, "Failed to write block %llu", buffer->lba);
+        return false;
+    }
+    ClearDirty(buffer);
+    m_Writes++;
+    return true;
+}
+
+void BufferCache::ClearDirty(Buffer* buffer) {
+    if (!buffer->dirty) return;
+    buffer->dirty = false;
+    buffer->stage = 0;
+    // m_DirtySince stays put, so whatever is left is flushed early rather than late
+    m_DirtyCount--;
+}
+
+bool BufferCache::FlushDevice(BlockDevice* device) {
+    bool ok = true;
+    for (uint8_t stage = 0; stage < Stages; stage++) {
+        // Deeper than the cache, so nothing is dispatched before every dirty block of the stage has been queued
+        BlockQueue queue;
+        queue.Initialize(device, m_Capacity + 1);
+
+        auto pending = [&](Buffer& buffer) { return buffer.valid && buffer.dirty && buffer.device == device && buffer.stage == stage; };
+        for (size_t i = 0; i < m_Capacity; i++) {
+            Buffer& buffer = m_Buffers[i];
+            if (!pending(buffer)) continue;
+            buffer.m_Request = BlockRequest{ buffer.lba, 1, buffer.data, true, nullptr, nullptr };
+            queue.Submit(&buffer.m_Request);
+        }
+        if (queue.Idle()) continue;
+        queue.Run();
+
+        for (size_t i = 0; i < m_Capacity; i++) {
+            Buffer& buffer = m_Buffers[i];
+            if (!pending(buffer)) continue;
+            if (buffer.m_Request.ok) {
+                ClearDirty(&buffer);
+                m_Writes++;
+            } else ok = false;
+        }
+        // A later stage must never reach the disk ahead of an earlier one that failed
+        if (!ok) break;
+    }
+    return ok;
+}
+
+void BufferCache::ResetStats() {
+    m_Hits = 0;
+    m_Misses = 0;
+    m_Evictions = 0;
+    m_Writes = 0;
+    m_Prefetched = 0;
+    m_PrefetchHits = 0;
+}
+
+void BufferCache::LogStats(const char* module) {
+    uint64_t lookups = m_Hits + m_Misses;
+    uint64_t percent = lookups ? m_Hits * 100 / lookups : 0;
+    Debug::Info(module, "Buffer cache: %llu hits, %llu misses (%llu%% hit rate), %llu evictions, %llu writes, %u buffers",
+        m_Hits, m_Misses, percent, m_Evictions, m_Writes, m_Capacity);
+    uint64_t used = m_Prefetched ? m_PrefetchHits * 100 / m_Prefetched : 0;
+    Debug::Info(module, "Readahead: %llu blocks read ahead, %llu used (%llu%%)", m_Prefetched, m_PrefetchHits, used);
+}
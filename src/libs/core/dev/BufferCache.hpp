@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "BlockDevice.hpp"
+#include "BlockQueue.hpp"
+
+// Block buffers shared by every file system, keyed by (device, LBA) and recycled least recently used first.
+// A buffer handed out by Get stays valid until it is given back with Release; referenced buffers are never evicted.
+// Modified buffers are written through by default. In write-back mode they stay dirty until a Flush, until
+// they are evicted, or until the oldest has waited the flush interval; FlushExpired checks that interval
+// and runs on every Release, idle loops may call it too.
+class BufferCache {
+public:
+    struct Buffer {
+        BlockDevice* device;
+        uint64_t lba;
+        uint8_t* data;
+        uint32_t refs;
+        bool valid;
+        bool dirty;
+        // Flush stage, see MarkDirty
+        uint8_t stage;
+        // Read ahead and not asked for yet
+        bool prefetched;
+
+    private:
+        Buffer* m_LRUPrev;
+        Buffer* m_LRUNext;
+        Buffer* m_HashNext;
+        BlockRequest m_Request;
+
+        friend class BufferCache;
+    };
+
+    BufferCache();
+
+    // Sets the number of cached blocks, writing back and dropping whatever the cache held before
+    bool Initialize(size_t capacity);
+    size_t Capacity() const { return m_Capacity; }
+
+    // Returns the block with a reference taken. With `read` false a missing block isn't fetched from the device,
+    // for callers that overwrite all of it. Null when the read fails or every buffer is referenced.
+    Buffer* Get(BlockDevice* device, uint64_t lba, bool read = true);
+    void Release(Buffer* buffer);
+    // Marks the buffer modified, writing it through unless write-back is on. Flushes write a device's dirty
+    // buffers in ascending `stage` order and finish each stage before starting the next, so blocks that point
+    // at others (a directory entry at its FAT chain) can be given a later stage than what they point at.
+    bool MarkDirty(Buffer* buffer, uint8_t stage = 0);
+
+    void SetWriteBack(bool enabled, uint32_t flush_interval_ms = DefaultFlushIntervalMs);
+    bool WriteBack() const { return m_WriteBack; }
+    // Flushes everything once the oldest dirty buffer has waited the flush interval
+    bool FlushExpired();
+
+    // Writes back every dirty buffer of `device`, or of every device when null, sorted and merged per device
+    bool Flush(BlockDevice* device = nullptr);
+    // Reads the uncached blocks of a range ahead of use, in as few device calls as the queue can merge them into.
+    // At most half the cache is filled per call; returns the number of blocks read.
+    size_t Prefetch(BlockDevice* device, uint64_t lba, size_t count);
+    // Writes back dirty copies of a range the caller is about to read around the cache; clean copies stay cached
+    bool FlushRange(BlockDevice* device, uint64_t lba, size_t count);
+    // Copies a range the caller just wrote around the cache into the cached copies of it, which end up clean
+    void Refresh(BlockDevice* device, uint64_t lba, size_t count, const uint8_t* data);
+
+    void ResetStats();
+    void LogStats(const char* module);
+
+    static constexpr size_t BufferSize{ 512 };
+    static constexpr size_t DefaultCapacity{ 128 };
+    static constexpr uint8_t Stages{ 2 };
+    static constexpr uint32_t DefaultFlushIntervalMs{ 1000 };
+private:
+    size_t Bucket(BlockDevice* device, uint64_t lba) const;
+    Buffer* Find(BlockDevice* device, uint64_t lba);
+    Buffer* Evict();
+    // Hashes a buffer whose device and LBA are set and makes it the most recently used
+    void Insert(Buffer* buffer);
+    void Unhash(Buffer* buffer);
+    void TouchLRU(Buffer* buffer);
+    void UnlinkLRU(Buffer* buffer);
+    bool WriteBuffer(Buffer* buffer);
+    void ClearDirty(Buffer* buffer);
+    bool FlushDevice(BlockDevice* device);
+
+    Buffer* m_Buffers;
+    uint8_t* m_Data;
+    Buffer** m_Buckets;
+    size_t m_Capacity;
+    size_t m_BucketMask;
+    // Most recently used at the head, eviction candidates taken from the tail
+    Buffer* m_LRUHead;
+    Buffer* m_LRUTail;
+
+    bool m_WriteBack;
+    uint64_t m_FlushTicks;
+    size_t m_DirtyCount;
+    // PIT tick at which the oldest dirty buffer was dirtied
+    uint64_t m_DirtySince;
+
+    uint64_t m_Hits;
+    uint64_t m_Misses;
+    uint64_t m_Evictions;
+    uint64_t m_Writes;
+    uint64_t m_Prefetched;
+    uint64_t m_PrefetchHits;
+};
+
+// The kernel's cache; set up with DefaultCapacity on first use unless Initialize was called before
+extern BufferCache g_BufferCache;
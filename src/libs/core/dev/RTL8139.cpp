@@ -15,6 +15,7 @@ RTL8139::RTL8139(GeneralPCIDevice* pci_dev, PCIDevice::MmapRange rtl_mmap, Pagin
 
     ResetDevice();
     InitReceiveBuffer();
+    InitTransmitBuffers();
     InitInterrupts();
     EnableTXRX();
 
@@ -48,6 +49,16 @@ void RTL8139::InitReceiveBuffer() {
     SetRXBufferSize();
 }
 
+void RTL8139::InitTransmitBuffers() {
+    constexpr size_t num_pages = (TRANSMIT_SLOTS * TRANSMIT_SLOT_SIZE + PAGE_SIZE - 1) / PAGE_SIZE;
+    m_TXBuffers = reinterpret_cast<uint8_t*>(FrameAllocator::AllocateLowContiguous(num_pages));
+    if (!m_TXBuffers) {
+        Debug::Critical("RTL8139", "Failed to allocate the transmit buffers!");
+        return;
+    }
+    Memory::Set(m_TXBuffers, 0x00, num_pages * PAGE_SIZE);
+}
+
 void RTL8139::ClearInterrupts() {
     volatile uint16_t* reg = (uint16_t*)(MMapRange.start + INTERRUPT_STATUS_OFFSET);
     uint16_t _ = *reg;
@@ -130,7 +141,8 @@ void RTL8139::GenerateRXBuffer() {
     }
 
     constexpr uintptr_t RXBUF_VIRTUAL_BASE = 0xC0400000;
-    KernelPagingManager->MapRange(reinterpret_cast<uintptr_t>(m_RXBufferPhys), RXBUF_VIRTUAL_BASE, num_pages * PAGE_SIZE, PAGE_PRESENT | PAGE_READWRITE | PAGE_CACHEDISABLED);
+    // Bus-master DMA is cache coherent on x86, so the ring is ordinary write-back memory
+    KernelPagingManager->MapRange(reinterpret_cast<uintptr_t>(m_RXBufferPhys), RXBUF_VIRTUAL_BASE, num_pages * PAGE_SIZE, PAGE_PRESENT | PAGE_READWRITE);
     m_RXBufferVirt = reinterpret_cast<uint8_t*>(RXBUF_VIRTUAL_BASE);
     Memory::Set(m_RXBufferVirt, 0x00, num_pages * PAGE_SIZE); 
 }
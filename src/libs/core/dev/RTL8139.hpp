@@ -15,6 +15,7 @@
 #include <core/arch/i686/PagingManager.hpp>
 
 #include <core/std/set_bits.hpp>
+#include <core/cpp/Memory.hpp>
 
 class RTL8139 {
 public:
@@ -29,18 +30,22 @@ public:
 
     template<typename T>
     void write(std::span<T>& packet) {
-        if (packet.size() < 60) {
+        if (packet.size_bytes() < 60) {
             Debug::Error("RTL8139", "Packet is too small!");
             return;
         }
+        if (packet.size_bytes() > MAX_TRANSMIT_SIZE || !m_TXBuffers) {
+            Debug::Error("RTL8139", "Packet is too large or there is no transmit buffer!");
+            return;
+        }
 
         size_t extra_offset = m_TransmitIndex * sizeof(uint32_t);
         size_t data_offset = TRANSMIT_DATA_OFFSET + extra_offset;
         size_t status_offset = TRANSMIT_STATUS_OFFSET + extra_offset;
         volatile uint32_t* data_ptr = (uint32_t*)(MMapRange.start + data_offset);
         volatile uint32_t* status_ptr = (uint32_t*)(MMapRange.start + status_offset);
-        TransmitAndWait(data_ptr, status_ptr, packet);
-        m_TransmitIndex = (m_TransmitIndex + 1) % 4; 
+        TransmitAndWait(data_ptr, status_ptr, m_TXBuffers + m_TransmitIndex * TRANSMIT_SLOT_SIZE, packet);
+        m_TransmitIndex = (m_TransmitIndex + 1) % TRANSMIT_SLOTS; 
     }
 
     std::array<uint8_t, 6> GetMACAddress();
@@ -55,9 +60,13 @@ private:
     static constexpr size_t TRANSMIT_DATA_OFFSET = 0x20;
     static constexpr size_t CAPR_OFFSET = 0x38;
     static constexpr size_t CBR_OFFSET = 0x3a;
+    static constexpr size_t TRANSMIT_SLOTS = 4;
+    static constexpr size_t TRANSMIT_SLOT_SIZE = 2048;
+    static constexpr size_t MAX_TRANSMIT_SIZE = 1792;
 
     void ResetDevice();
     void InitReceiveBuffer();
+    void InitTransmitBuffers();
     void InitInterrupts();
     void EnableTXRX();
     void EnableLoopback();
@@ -77,13 +86,14 @@ private:
     
     static void InterruptHandler(ISR::Registers* regs, void* data);
 
+    // The packet is copied into the slot's buffer first: heap pages aren't physically contiguous, the slot is
     template<typename T>
-    void TransmitAndWait(volatile uint32_t* data_ptr, volatile uint32_t* status_ptr, std::span<T>& packet) {
-        uintptr_t phys_addr = KernelPagingManager->VirtToPhys((uintptr_t)packet.data());
-        *data_ptr = (uint32_t)phys_addr;
+    void TransmitAndWait(volatile uint32_t* data_ptr, volatile uint32_t* status_ptr, uint8_t* slot, std::span<T>& packet) {
+        Memory::Copy(slot, packet.data(), packet.size_bytes());
+        *data_ptr = reinterpret_cast<uint32_t>(slot);
 
         uint32_t status = *status_ptr;
-        status = std::set_bits<uint32_t>(status, 0, 12, packet.size());
+        status = std::set_bits<uint32_t>(status, 0, 12, packet.size_bytes());
         status = std::set_bits<uint32_t>(status, 13, 1, 0);
         *status_ptr = status;
 
@@ -102,6 +112,8 @@ private:
     bool m_Loopback{ false };
     uint8_t* m_RXBufferPhys{ nullptr };
     uint8_t* m_RXBufferVirt{ nullptr };
+    // TRANSMIT_SLOTS buffers in identity-mapped low frames, so their addresses are also what the card DMAs from
+    uint8_t* m_TXBuffers{ nullptr };
     uint32_t m_TransmitIndex{ 0 };
     PagingManager* KernelPagingManager{ nullptr };
 };
\ No newline at end of file
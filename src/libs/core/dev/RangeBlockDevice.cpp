@@ -6,7 +6,7 @@
 RangeBlockDevice::RangeBlockDevice()
     : m_Device(nullptr), m_RangeBegin(0), m_RangeSize(0) {}
 
-void RangeBlockDevice::Initialize(BlockDevice* device, size_t rangeBegin, size_t rangeSize) {
+void RangeBlockDevice::Initialize(BlockDevice* device, uint64_t rangeBegin, uint64_t rangeSize) {
     m_Device = device;
     m_RangeBegin = rangeBegin;
     m_RangeSize = rangeSize;
@@ -15,17 +15,17 @@ void RangeBlockDevice::Initialize(BlockDevice* device, size_t rangeBegin, size_t
 
 size_t RangeBlockDevice::Read(uint8_t* data, size_t size) {
     if (!m_Device) return -1;
-    size = min(size, Size() - Position());
+    size = static_cast<size_t>(min<uint64_t>(size, Size() - Position()));
     return m_Device->Read(data, size);
 }
 
 size_t RangeBlockDevice::Write(const uint8_t* data, size_t size) {
     if (!m_Device) return -1;
-    size = min(size, Size() - Position());
+    size = static_cast<size_t>(min<uint64_t>(size, Size() - Position()));
     return m_Device->Write(data, size);
 }
 
-bool RangeBlockDevice::Seek(int rel, SeekPos pos) {
+bool RangeBlockDevice::Seek(int64_t rel, SeekPos pos) {
     if (!m_Device) return false;
     bool ok = true;
     switch (pos) {
@@ -36,17 +36,35 @@ bool RangeBlockDevice::Seek(int rel, SeekPos pos) {
             ok = m_Device->Seek(rel, SeekPos::Current);
             break;
         case SeekPos::End:
-            ok = m_Device->Seek(m_RangeBegin + m_RangeSize, SeekPos::End);
+            ok = m_Device->Seek(m_RangeBegin + m_RangeSize - rel, SeekPos::Set);
             break;
     }
     return ok;
 }
 
-size_t RangeBlockDevice::Position() {
+uint64_t RangeBlockDevice::Position() {
     if (!m_Device) return -1;
     return m_Device->Position() - m_RangeBegin;
 }
 
-size_t RangeBlockDevice::Size() {
+uint64_t RangeBlockDevice::Size() {
     return m_RangeSize;
 }
+
+bool RangeBlockDevice::ReadBlocks(uint64_t lba, size_t count, const IOVec* iov, size_t iov_count) {
+    if (!m_Device) return false;
+    uint32_t block_size = m_Device->BlockSize();
+    if ((lba + count) * block_size > m_RangeSize) return false;
+    return m_Device->ReadBlocks(m_RangeBegin / block_size + lba, count, iov, iov_count);
+}
+
+bool RangeBlockDevice::WriteBlocks(uint64_t lba, size_t count, const IOVec* iov, size_t iov_count) {
+    if (!m_Device) return false;
+    uint32_t block_size = m_Device->BlockSize();
+    if ((lba + count) * block_size > m_RangeSize) return false;
+    return m_Device->WriteBlocks(m_RangeBegin / block_size + lba, count, iov, iov_count);
+}
+
+uint32_t RangeBlockDevice::BlockSize() {
+    return m_Device ? m_Device->BlockSize() : BlockDevice::BlockSize();
+}
@@ -6,16 +6,21 @@ class RangeBlockDevice : public BlockDevice {
 public:
     RangeBlockDevice();
     
-    void Initialize(BlockDevice* device, size_t rangeBegin, size_t rangeSize);
+    void Initialize(BlockDevice* device, uint64_t rangeBegin, uint64_t rangeSize);
 
     virtual size_t Read(uint8_t* data, size_t size) override;
     virtual size_t Write(const uint8_t* data, size_t size) override;
-    virtual bool Seek(int rel, SeekPos pos) override;
-    virtual size_t Position() override;
-    virtual size_t Size() override;
+    virtual bool Seek(int64_t rel, SeekPos pos) override;
+    virtual uint64_t Position() override;
+    virtual uint64_t Size() override;
+
+    // Forwarded to the underlying device with the range's first block added; the range has to start on a block boundary
+    virtual bool ReadBlocks(uint64_t lba, size_t count, const IOVec* iov, size_t iov_count) override;
+    virtual bool WriteBlocks(uint64_t lba, size_t count, const IOVec* iov, size_t iov_count) override;
+    virtual uint32_t BlockSize() override;
 
 private:
     BlockDevice* m_Device;
-    size_t m_RangeBegin;
-    size_t m_RangeSize;
+    uint64_t m_RangeBegin;
+    uint64_t m_RangeSize;
 };
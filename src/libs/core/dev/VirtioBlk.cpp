@@ -0,0 +1,462 @@
+#include "VirtioBlk.hpp"
+
+#include <core/Debug.hpp>
+#include <core/cpp/Algorithm.hpp>
+#include <core/cpp/Memory.hpp>
+#include <core/arch/i686/IRQ.hpp>
+#include <core/arch/i686/Timer.hpp>
+#include <core/arch/i686/FrameAllocator.hpp>
+#include <core/arch/i686/PagingManager.hpp>
+
+namespace {
+    // Legacy virtio-pci registers, relative to BAR0
+    constexpr IOOffset REG_DEVICE_FEATURES = 0x00;
+    constexpr IOOffset REG_GUEST_FEATURES = 0x04;
+    constexpr IOOffset REG_QUEUE_ADDRESS = 0x08; // page frame number of the ring
+    constexpr IOOffset REG_QUEUE_SIZE = 0x0C;
+    constexpr IOOffset REG_QUEUE_SELECT = 0x0E;
+    constexpr IOOffset REG_QUEUE_NOTIFY = 0x10;
+    constexpr IOOffset REG_DEVICE_STATUS = 0x12;
+    constexpr IOOffset REG_ISR_STATUS = 0x13;
+    // virtio-blk configuration, right behind the header as long as MSI-X is off
+    constexpr IOOffset REG_CAPACITY = 0x14;
+    constexpr IOOffset REG_SIZE_MAX = 0x1C;
+    constexpr IOOffset REG_SEG_MAX = 0x20;
+
+    constexpr uint8_t STATUS_ACKNOWLEDGE = 0x01;
+    constexpr uint8_t STATUS_DRIVER = 0x02;
+    constexpr uint8_t STATUS_DRIVER_OK = 0x04;
+    constexpr uint8_t STATUS_FAILED = 0x80;
+
+    constexpr uint32_t FEATURE_SIZE_MAX = (1 << 1);
+    constexpr uint32_t FEATURE_SEG_MAX = (1 << 2);
+    constexpr uint32_t FEATURE_RO = (1 << 5);
+
+    constexpr uint16_t DESC_NEXT = 0x1;
+    constexpr uint16_t DESC_WRITE = 0x2; // the device writes to this buffer
+    constexpr uint16_t USED_NO_NOTIFY = 0x1;
+    constexpr uint8_t ISR_QUEUE = 0x1;
+
+    constexpr uint32_t REQUEST_IN = 0;
+    constexpr uint32_t REQUEST_OUT = 1;
+    constexpr uint8_t REQUEST_OK = 0;
+
+    constexpr uint16_t MAX_QUEUE_SIZE = 1024;
+    constexpr uint32_t REQUEST_TIMEOUT_MS = 5000;
+    constexpr uint32_t EFLAGS_IF = (1 << 9);
+
+    constexpr size_t PageAlign(size_t bytes) {
+        return (bytes + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    }
+}
+
+bool VirtioBlk::Initialize(GeneralPCIDevice* pci, IORange* range, PagingManager* paging) {
+    m_Range = range;
+    m_Paging = paging;
+
+    m_Range->write<uint8_t>(REG_DEVICE_STATUS, 0);
+    m_Range->write<uint8_t>(REG_DEVICE_STATUS, STATUS_ACKNOWLEDGE);
+    m_Range->write<uint8_t>(REG_DEVICE_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+
+    // Flushes aren't negotiated, which keeps a legacy device writing through
+    uint32_t features = m_Range->read<uint32_t>(REG_DEVICE_FEATURES) & (FEATURE_SIZE_MAX | FEATURE_SEG_MAX | FEATURE_RO);
+    m_Range->write<uint32_t>(REG_GUEST_FEATURES, features);
+
+    m_SectorCount = m_Range->read<uint32_t>(REG_CAPACITY) | (static_cast<uint64_t>(m_Range->read<uint32_t>(REG_CAPACITY + 4)) << 32);
+    m_Size = m_SectorCount * BytesPerSector;
+    m_Position = 0;
+    m_ReadOnly = features & FEATURE_RO;
+    m_SegmentMaxBytes = (features & FEATURE_SIZE_MAX) ? m_Range->read<uint32_t>(REG_SIZE_MAX) : 0;
+    m_SegmentLimit = MaxSegments;
+    if (features & FEATURE_SEG_MAX) {
+        uint32_t seg_max = m_Range->read<uint32_t>(REG_SEG_MAX);
+        if (seg_max) m_SegmentLimit = min<size_t>(seg_max, MaxSegments);
+    }
+
+    if (!SetupQueue()) {
+        m_Range->write<uint8_t>(REG_DEVICE_STATUS, STATUS_FAILED);
+        return false;
+    }
+
+    pci->EnableBusMastering();
+    m_IRQ = pci->GetIRQ();
+    if (m_IRQ < 16) {
+        IRQ::RegisterHandler(m_IRQ, IRQHandler, this);
+        if (m_IRQ >= 8) IRQ::Unmask(2);
+        IRQ::Unmask(m_IRQ);
+    } else {
+        Debug::Warn("VirtioBlk", "No interrupt line routed, completions are polled on every PIT tick");
+    }
+
+    m_Range->write<uint8_t>(REG_DEVICE_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+    m_Ready = true;
+    Debug::Info("VirtioBlk", "%llu sectors (%llu MiB)%s, %u descriptors, up to %u segments per request, IRQ %u",
+        m_SectorCount, m_Size / (1024 * 1024), m_ReadOnly ? ", read-only" : "", m_QueueSize, m_SegmentLimit, m_IRQ);
+    return true;
+}
+
+bool VirtioBlk::SetupQueue() {
+    m_Range->write<uint16_t>(REG_QUEUE_SELECT, 0);
+    m_QueueSize = m_Range->read<uint16_t>(REG_QUEUE_SIZE);
+    if (m_QueueSize == 0 || m_QueueSize > MAX_QUEUE_SIZE) {
+        Debug::Error("VirtioBlk", "Unusable queue size %u", m_QueueSize);
+        return false;
+    }
+
+    // Legacy layout: descriptor table and available ring, then the used ring from the next page on
+    size_t used_offset = PageAlign(m_QueueSize * sizeof(Descriptor) + (3 + m_QueueSize) * sizeof(uint16_t));
+    size_t pages = (used_offset + PageAlign(3 * sizeof(uint16_t) + m_QueueSize * sizeof(UsedElement))) / PAGE_SIZE;
+    uintptr_t ring = FrameAllocator::AllocateLowContiguous(pages);
+    uintptr_t requests = FrameAllocator::AllocateLow();
+    if (!ring || !requests) {
+        Debug::Error("VirtioBlk", "No low memory left for a ring of %u descriptors", m_QueueSize);
+        if (ring) FrameAllocator::FreeContiguous(ring, pages);
+        if (requests) FrameAllocator::Free(requests);
+        return false;
+    }
+    Memory::Set(reinterpret_cast<void*>(ring), 0, pages * PAGE_SIZE);
+
+    m_Descriptors = reinterpret_cast<volatile Descriptor*>(ring);
+    m_Available = reinterpret_cast<volatile uint16_t*>(ring + m_QueueSize * sizeof(Descriptor));
+    m_Used = reinterpret_cast<volatile uint16_t*>(ring + used_offset);
+    m_UsedRing = reinterpret_cast<volatile UsedElement*>(ring + used_offset + 2 * sizeof(uint16_t));
+
+    // Free descriptors are chained through their next fields
+    for (uint16_t i = 0; i < m_QueueSize; i++)
+        m_Descriptors[i].next = i + 1;
+    m_FreeHead = 0;
+    m_FreeDescriptors = m_QueueSize;
+    m_AvailableIndex = 0;
+    m_LastUsed = 0;
+    m_InFlight = 0;
+
+    m_Headers = reinterpret_cast<RequestHeader*>(requests);
+    m_Status = reinterpret_cast<volatile uint8_t*>(requests + MaxRequests * sizeof(RequestHeader));
+
+    m_Range->write<uint32_t>(REG_QUEUE_ADDRESS, ring / PAGE_SIZE);
+    return true;
+}
+
+size_t VirtioBlk::Read(uint8_t* data, size_t size) {
+    uint64_t initialPosition = m_Position;
+    if (m_Position >= m_Size) return 0;
+    size = static_cast<size_t>(min<uint64_t>(size, m_Size - m_Position));
+
+    while (size > 0) {
+        uint64_t lba = m_Position / BytesPerSector;
+        size_t sectorPos = m_Position % BytesPerSector;
+        size_t bytes;
+        if (sectorPos == 0 && size >= BytesPerSector) {
+            bytes = size - size % BytesPerSector;
+            IOVec iov{ data, bytes };
+            if (!ReadBlocks(lba, bytes / BytesPerSector, &iov, 1)) break;
+        } else {
+            IOVec iov{ m_Sector, BytesPerSector };
+            if (!ReadBlocks(lba, 1, &iov, 1)) break;
+            bytes = min<size_t>(size, BytesPerSector - sectorPos);
+            Memory::Copy(data, m_Sector + sectorPos, bytes);
+        }
+        size -= bytes;
+        data += bytes;
+        m_Position += bytes;
+    }
+
+    return m_Position - initialPosition;
+}
+
+size_t VirtioBlk::Write(const uint8_t* data, size_t size) {
+    uint64_t initialPosition = m_Position;
+    if (m_Position >= m_Size) return 0;
+    size = static_cast<size_t>(min<uint64_t>(size, m_Size - m_Position));
+
+    while (size > 0) {
+        uint64_t lba = m_Position / BytesPerSector;
+        size_t sectorPos = m_Position % BytesPerSector;
+        size_t bytes;
+        if (sectorPos == 0 && size >= BytesPerSector) {
+            bytes = size - size % BytesPerSector;
+            IOVec iov{ const_cast<uint8_t*>(data), bytes };
+            if (!WriteBlocks(lba, bytes / BytesPerSector, &iov, 1)) break;
+        } else {
+            // Partial sectors are read, patched and written back
+            IOVec iov{ m_Sector, BytesPerSector };
+            if (!ReadBlocks(lba, 1, &iov, 1)) break;
+            bytes = min<size_t>(size, BytesPerSector - sectorPos);
+            Memory::Copy(m_Sector + sectorPos, data, bytes);
+            if (!WriteBlocks(lba, 1, &iov, 1)) break;
+        }
+        size -= bytes;
+        data += bytes;
+        m_Position += bytes;
+    }
+
+    return m_Position - initialPosition;
+}
+
+bool VirtioBlk::Seek(int64_t rel, SeekPos pos) {
+    int64_t newPos = 0;
+    switch (pos) {
+        case SeekPos::Set:      newPos = rel; break;
+        case SeekPos::Current:  newPos = m_Position + rel; break;
+        case SeekPos::End:      newPos = m_Size - rel; break;
+    }
+
+    if (newPos < 0 || static_cast<uint64_t>(newPos) > m_Size) return false;
+    m_Position = newPos;
+    return true;
+}
+
+uint64_t VirtioBlk::Position() {
+    return m_Position;
+}
+
+uint64_t VirtioBlk::Size() {
+    return m_Size;
+}
+
+bool VirtioBlk::ReadBlocks(uint64_t lba, size_t count, const IOVec* iov, size_t iov_count) {
+    return Transfer(lba, count, iov, iov_count, false);
+}
+
+bool VirtioBlk::WriteBlocks(uint64_t lba, size_t count, const IOVec* iov, size_t iov_count) {
+    return Transfer(lba, count, iov, iov_count, true);
+}
+
+bool VirtioBlk::Transfer(uint64_t lba, size_t count, const IOVec* iov, size_t iov_count, bool write) {
+    if (!m_Ready || lba + count > m_SectorCount) return false;
+    if (write && m_ReadOnly) return false;
+    if (IOVecLength(iov, iov_count) != count * BytesPerSector) return false;
+
+    // The interrupt handler touches the ring too, it only gets in while Collect sleeps
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r"(flags) :: "memory");
+
+    IOVecCursor cursor{ iov, 0, 0 };
+    bool ok = true;
+    while (count > 0) {
+        size_t queued = count;
+        if (!Submit(lba, cursor, queued, write)) {
+            Debug::Critical("VirtioBlk", "Can't translate the buffer of the transfer at LBA %llu", lba);
+            ok = false;
+            break;
+        }
+        if (queued) {
+            lba += queued;
+            count -= queued;
+            continue;
+        }
+
+        // Out of slots or descriptors: let the device start on what's queued and retire something
+        if (!m_InFlight) {
+            Debug::Critical("VirtioBlk", "A block at LBA %llu is split into more pieces than a request can hold", lba);
+            ok = false;
+            break;
+        }
+        Notify();
+        if (!Collect()) ok = false;
+        if (!m_Ready) break;
+    }
+
+    // Buffers stay the device's until it's done with them, failed or not
+    Notify();
+    while (m_InFlight > 0 && m_Ready) {
+        if (!Collect()) ok = false;
+    }
+
+    if (flags & EFLAGS_IF) asm volatile("sti");
+    return ok && m_Ready;
+}
+
+bool VirtioBlk::Submit(uint64_t lba, IOVecCursor& cursor, size_t& count, bool write) {
+    size_t slot = 0;
+    while (slot < MaxRequests && m_Requests[slot].busy) slot++;
+    // Besides its data a request takes a header and a status descriptor
+    if (slot == MaxRequests || m_FreeDescriptors < 3) {
+        count = 0;
+        return true;
+    }
+
+    size_t bytes = min(count, MaxRequestBlocks) * BytesPerSector;
+    size_t segments;
+    if (!BuildSegments(cursor, bytes, min<size_t>(m_FreeDescriptors - 2, m_SegmentLimit), segments)) return false;
+    count = bytes / BytesPerSector;
+    if (!count) return true;
+
+    uint16_t descriptors = static_cast<uint16_t>(segments + 2);
+    m_Requests[slot] = Request{ lba, count, m_FreeHead, descriptors, write, true, false };
+    m_Headers[slot] = RequestHeader{ write ? REQUEST_OUT : REQUEST_IN, 0, lba };
+    m_Status[slot] = 0xFF;
+
+    // Header, data, status. The chain keeps the free list's links, so the last one's next is the new free head.
+    uint16_t index = m_FreeHead;
+    for (size_t i = 0; i < descriptors; i++) {
+        volatile Descriptor& descriptor = m_Descriptors[index];
+        if (i == 0) {
+            descriptor.address = reinterpret_cast<uintptr_t>(&m_Headers[slot]);
+            descriptor.length = sizeof(RequestHeader);
+            descriptor.flags = DESC_NEXT;
+        } else if (i <= segments) {
+            descriptor.address = m_Segments[i - 1].address;
+            descriptor.length = m_Segments[i - 1].length;
+            descriptor.flags = DESC_NEXT | (write ? 0 : DESC_WRITE);
+        } else {
+            descriptor.address = reinterpret_cast<uintptr_t>(&m_Status[slot]);
+            descriptor.length = 1;
+            descriptor.flags = DESC_WRITE;
+        }
+        index = descriptor.next;
+    }
+    m_FreeHead = index;
+    m_FreeDescriptors -= descriptors;
+
+    m_Available[2 + m_AvailableIndex % m_QueueSize] = m_Requests[slot].head;
+    m_AvailableIndex++;
+    // Descriptors and header have to be in memory before the index publishes them; x86 keeps stores in order
+    asm volatile("" ::: "memory");
+    m_Available[1] = m_AvailableIndex;
+
+    m_NotifyPending = true;
+    m_InFlight++;
+    m_MaxInFlight = max(m_MaxInFlight, m_InFlight);
+    m_RequestCount++;
+    return true;
+}
+
+bool VirtioBlk::BuildSegments(IOVecCursor& cursor, size_t& bytes, size_t max_segments, size_t& segments) {
+    size_t wanted = bytes;
+    bytes = 0;
+    segments = 0;
+
+    while (bytes < wanted) {
+        size_t piece_length;
+        const uint8_t* piece = cursor.Next(wanted - bytes, piece_length);
+
+        while (piece_length > 0) {
+            uintptr_t virt = reinterpret_cast<uintptr_t>(piece);
+            uintptr_t phys = m_Paging->VirtToPhys(virt);
+            if (!phys) {
+                // Heap pages are only backed once touched, fault this one in
+                (void)*reinterpret_cast<const volatile uint8_t*>(piece);
+                phys = m_Paging->VirtToPhys(virt);
+                if (!phys) return false;
+            }
+            size_t chunk = min<size_t>(piece_length, PAGE_SIZE - (virt & (PAGE_SIZE - 1)));
+
+            // Physically contiguous pages share a segment
+            Segment* last = segments ? &m_Segments[segments - 1] : nullptr;
+            if (last && last->address + last->length == phys && (!m_SegmentMaxBytes || last->length + chunk <= m_SegmentMaxBytes)) {
+                last->length += chunk;
+            } else if (segments < max_segments) {
+                m_Segments[segments++] = Segment{ static_cast<uint32_t>(phys), static_cast<uint32_t>(chunk) };
+            } else {
+                // Out of segments, the rest of the piece goes into the next request
+                cursor.Rewind(piece_length);
+                wanted = bytes;
+                break;
+            }
+
+            bytes += chunk;
+            piece += chunk;
+            piece_length -= chunk;
+        }
+    }
+
+    // Requests cover whole blocks, whatever spills past the last block boundary is handed back too
+    size_t excess = bytes % BytesPerSector;
+    cursor.Rewind(excess);
+    bytes -= excess;
+    while (excess > 0) {
+        Segment& last = m_Segments[segments - 1];
+        size_t trim = min<size_t>(excess, last.length);
+        last.length -= trim;
+        excess -= trim;
+        if (!last.length) segments--;
+    }
+    return true;
+}
+
+void VirtioBlk::Notify() {
+    if (!m_NotifyPending) return;
+    m_NotifyPending = false;
+
+    // The available index store has to land before the flag is read, x86 may otherwise let the load pass it
+    asm volatile("mfence" ::: "memory");
+    // Set while the device is still working through the ring and will see the new entries anyway
+    if (m_Used[0] & USED_NO_NOTIFY) return;
+    m_Range->write<uint16_t>(REG_QUEUE_NOTIFY, 0);
+    m_Notifications++;
+}
+
+void VirtioBlk::Reap() {
+    while (m_LastUsed != m_Used[1]) {
+        uint16_t head = static_cast<uint16_t>(m_UsedRing[m_LastUsed % m_QueueSize].id);
+        m_LastUsed++;
+
+        for (Request& request : m_Requests) {
+            if (!request.busy || request.done || request.head != head) continue;
+
+            uint16_t tail = head;
+            for (uint16_t i = 1; i < request.descriptors; i++)
+                tail = m_Descriptors[tail].next;
+            m_Descriptors[tail].next = m_FreeHead;
+            m_FreeHead = head;
+            m_FreeDescriptors += request.descriptors;
+            request.done = true;
+            break;
+        }
+    }
+}
+
+bool VirtioBlk::Collect() {
+    // Interrupts are off; sti only takes effect after hlt, so a completion arriving after the check still wakes it
+    uint64_t start = PITTicks;
+    uint64_t timeout = PIT::MsToTicks(REQUEST_TIMEOUT_MS);
+    bool ok = true;
+
+    while (PITTicks - start < timeout) {
+        Reap();
+
+        size_t completed = 0;
+        for (size_t slot = 0; slot < MaxRequests; slot++) {
+            Request& request = m_Requests[slot];
+            if (!request.busy || !request.done) continue;
+
+            if (m_Status[slot] != REQUEST_OK) {
+                Debug::Critical("VirtioBlk", "%s of %u sectors at LBA %llu failed (status %u)",
+                    request.write ? "Write" : "Read", request.count, request.lba, m_Status[slot]);
+                ok = false;
+            }
+            request.busy = false;
+            m_InFlight--;
+            completed++;
+        }
+        if (completed) return ok;
+
+        asm volatile("sti; hlt; cli" ::: "memory");
+    }
+
+    // Whatever is still on the ring may be written at any time, nothing can be submitted safely anymore
+    Debug::Critical("VirtioBlk", "%u requests timed out, disabling the device", m_InFlight);
+    m_Ready = false;
+    return false;
+}
+
+void VirtioBlk::IRQHandler(ISR::Registers* regs, void* data) {
+    VirtioBlk* dev = static_cast<VirtioBlk*>(data);
+    // Reading the ISR status acknowledges the interrupt; without the queue bit it came from another device on the line
+    if (!(dev->m_Range->read<uint8_t>(REG_ISR_STATUS) & ISR_QUEUE)) return;
+    dev->m_Interrupts++;
+    dev->Reap();
+}
+
+void VirtioBlk::ResetStats() {
+    m_RequestCount = 0;
+    m_Notifications = 0;
+    m_Interrupts = 0;
+    m_MaxInFlight = 0;
+}
+
+void VirtioBlk::LogStats(const char* module) {
+    Debug::Info(module, "%llu requests, %llu notifications, %llu interrupts, up to %u in flight",
+        m_RequestCount, m_Notifications, m_Interrupts, m_MaxInFlight);
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <core/ZosDefs.hpp>
+#include <core/arch/i686/IOAllocator.hpp>
+#include <core/arch/i686/PCI.hpp>
+#include <core/arch/i686/ISR.hpp>
+#include "BlockDevice.hpp"
+
+class PagingManager;
+
+// virtio-blk-pci through the legacy I/O port interface of transitional devices, with one split virtqueue.
+// ReadBlocks/WriteBlocks cut a transfer into requests of at most MaxRequestBlocks blocks and put as many on the
+// ring as there are free slots and descriptors before waiting, so large or scattered transfers keep several
+// requests in flight and the device is notified once per batch. Completions are taken off the used ring by
+// the interrupt handler; waits also look at the ring whenever they wake up, so a lost interrupt only costs a PIT tick.
+class VirtioBlk : public BlockDevice {
+public:
+    VirtioBlk() = default;
+
+    // Resets the device, negotiates features and sets up queue 0. `range` covers BAR0 and has to outlive the driver.
+    bool Initialize(GeneralPCIDevice* pci, IORange* range, PagingManager* paging);
+
+    virtual size_t Read(uint8_t* data, size_t size) override;
+    virtual size_t Write(const uint8_t* data, size_t size) override;
+    virtual bool Seek(int64_t rel, SeekPos pos) override;
+    virtual uint64_t Position() override;
+    virtual uint64_t Size() override;
+
+    virtual bool ReadBlocks(uint64_t lba, size_t count, const IOVec* iov, size_t iov_count) override;
+    virtual bool WriteBlocks(uint64_t lba, size_t count, const IOVec* iov, size_t iov_count) override;
+    virtual uint32_t BlockSize() override { return BytesPerSector; }
+
+    uint64_t SectorCount() const { return m_SectorCount; }
+    bool ReadOnly() const { return m_ReadOnly; }
+
+    void ResetStats();
+    void LogStats(const char* module);
+
+    // Transitional virtio-blk; modern-only devices (0x1042) have no legacy interface
+    static constexpr uint16_t VendorID{ 0x1AF4 };
+    static constexpr uint16_t DeviceID{ 0x1001 };
+    // Legacy header plus the device configuration fields read here
+    static constexpr uint16_t IORangeLength{ 0x40 };
+    static constexpr uint32_t BytesPerSector{ 512 };
+    static constexpr size_t MaxRequests{ 32 };
+    static constexpr size_t MaxRequestBlocks{ 256 };
+    static constexpr size_t MaxSegments{ 128 };
+private:
+    struct Descriptor {
+        uint64_t address;
+        uint32_t length;
+        uint16_t flags;
+        uint16_t next;
+    } PACKED;
+
+    struct UsedElement {
+        uint32_t id;
+        uint32_t length;
+    } PACKED;
+
+    struct RequestHeader {
+        uint32_t type;
+        uint32_t reserved;
+        uint64_t sector;
+    } PACKED;
+
+    struct Segment {
+        uint32_t address;
+        uint32_t length;
+    };
+
+    struct Request {
+        uint64_t lba;
+        size_t count;
+        uint16_t head;
+        uint16_t descriptors;
+        bool write;
+        bool busy;
+        bool done;
+    };
+
+    static void IRQHandler(ISR::Registers* regs, void* data);
+
+    bool SetupQueue();
+    bool Transfer(uint64_t lba, size_t count, const IOVec* iov, size_t iov_count, bool write);
+    // Puts a request for up to `count` blocks at `lba` on the ring and sets `count` to what it covers,
+    // 0 when no slot or descriptors are free. False if a buffer couldn't be translated.
+    bool Submit(uint64_t lba, IOVecCursor& cursor, size_t& count, bool write);
+    // Gathers the physical segments of at most `bytes` bytes into m_Segments and trims `bytes` to the whole
+    // blocks they cover, leaving the cursor right behind them
+    bool BuildSegments(IOVecCursor& cursor, size_t& bytes, size_t max_segments, size_t& segments);
+    void Notify();
+    // Moves used ring entries onto their requests and gives their descriptors back
+    void Reap();
+    // Waits until at least one request in flight completed and retires every completed one
+    bool Collect();
+
+    IORange* m_Range{ nullptr };
+    PagingManager* m_Paging{ nullptr };
+    uint8_t m_IRQ{ 0 };
+    uint64_t m_SectorCount{ 0 };
+    uint64_t m_Size{ 0 };
+    uint64_t m_Position{ 0 };
+    bool m_ReadOnly{ false };
+    bool m_Ready{ false };
+    uint32_t m_SegmentMaxBytes{ 0 };
+    size_t m_SegmentLimit{ MaxSegments };
+
+    // The ring lives in identity-mapped low frames, so these pointers are also the addresses given to the device
+    uint16_t m_QueueSize{ 0 };
+    volatile Descriptor* m_Descriptors{ nullptr };
+    // flags, idx, ring[m_QueueSize], used_event
+    volatile uint16_t* m_Available{ nullptr };
+    // flags, idx, then m_QueueSize UsedElements
+    volatile uint16_t* m_Used{ nullptr };
+    volatile UsedElement* m_UsedRing{ nullptr };
+    uint16_t m_AvailableIndex{ 0 };
+    uint16_t m_LastUsed{ 0 };
+    uint16_t m_FreeHead{ 0 };
+    uint16_t m_FreeDescriptors{ 0 };
+    bool m_NotifyPending{ false };
+
+    Request m_Requests[MaxRequests]{};
+    // One low frame: a header per request slot followed by their status bytes
+    RequestHeader* m_Headers{ nullptr };
+    volatile uint8_t* m_Status{ nullptr };
+    size_t m_InFlight{ 0 };
+    Segment m_Segments[MaxSegments];
+
+    // Bounce buffer for partial-sector byte accesses
+    uint8_t m_Sector[BytesPerSector];
+
+    uint64_t m_RequestCount{ 0 };
+    uint64_t m_Notifications{ 0 };
+    uint64_t m_Interrupts{ 0 };
+    size_t m_MaxInFlight{ 0 };
+};
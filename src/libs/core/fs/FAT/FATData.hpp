@@ -7,7 +7,6 @@
 
 constexpr size_t MaxFileNameSize = 256;
 constexpr size_t MaxFileHandles = 16;
-constexpr size_t FatCacheSize = 5;
 constexpr int32_t RootDirectoryHandle = -1;
 constexpr uint32_t FAT_LFN_Last = 0x40;
 
@@ -21,9 +20,6 @@ struct FAT_Data {
     StaticObjectPool<FATFile, MaxFileHandles> OpenedFilePool;
     StaticObjectPool<FATFileEntry, MaxFileHandles> FileEntryPool;
 
-    uint8_t FAT_Cache[FatCacheSize * SectorSize];
-    uint32_t FAT_CachePosition;
-
     FAT_LFN_Block LFN_Blocks[FAT_LFN_Last];
     int LFN_Count;
 };
@@ -7,23 +7,34 @@
 #include <fs/FATFileSystem.hpp>
 
 FATFile::FATFile() 
-    : m_FS(nullptr), m_Opened(false), m_IsRootDir(false), m_FirstCluster(), m_CurrentCluster(),
-    m_CurrentSectorInCluster(), m_Position(), m_Size(), m_CurrentClusterIdx(), m_IsDirectory(false) {}
+    : m_FS(nullptr), m_Sector(nullptr), m_Opened(false), m_IsRootDir(false), m_FirstCluster(), m_CurrentCluster(),
+    m_CurrentSectorInCluster(), m_Position(), m_Size(), m_CurrentClusterIdx(), m_IsDirectory(false), m_EntryLBA(), m_EntryIndex(), m_EntryDirty(false),
+    m_ExtentCount(), m_MappedClusters(), m_MapComplete(false), m_TailCluster(), m_ClusterCount(), m_TailKnown(false), m_LastReadEnd(), m_ReadaheadIdx(), m_ReadaheadClusters() {}
 
-bool FATFile::Open(FATFileSystem* fs, uint32_t firstCluster, const char* name, uint32_t size, bool isDirectory, uint32_t parentDirCluster) {
+bool FATFile::Open(FATFileSystem* fs, uint32_t firstCluster, const char* name, uint32_t size, bool isDirectory, uint32_t parentDirCluster,
+                   uint32_t entryLBA, uint32_t entryIndex) {
+    DropSector();
     m_FS = fs;
 
     m_IsDirectory = isDirectory;
     m_IsRootDir = false;
     m_Position = 0;
     m_Size = size;
+    m_EntryLBA = entryLBA;
+    m_EntryIndex = entryIndex;
+    m_EntryDirty = false;
     m_FirstCluster = firstCluster;
     m_CurrentCluster = m_FirstCluster;
     m_CurrentClusterIdx = 0;
     m_CurrentSectorInCluster = 0;
     m_ParentDirCluster = parentDirCluster;
+    ResetExtents();
+    m_LastReadEnd = 0;
+    m_ReadaheadIdx = 0;
+    m_ReadaheadClusters = 0;
     
-    if (!m_FS->ReadSectorFromCluster(m_CurrentCluster, m_Buffer, m_CurrentSectorInCluster)) {
+    // An empty file has no sector to load until something is written
+    if (m_FirstCluster >= 2 && !LoadCurrentSector()) {
         Debug::Error("FatFile", "Failed to open file!");
         return false;
     }
@@ -33,17 +44,22 @@ bool FATFile::Open(FATFileSystem* fs, uint32_t firstCluster, const char* name, u
 }
 
 bool FATFile::OpenRootDirectory1216(FATFileSystem* fs, uint32_t rootDirLba, uint32_t rootDirSize) {
+    DropSector();
     m_FS = fs;
     
     m_IsRootDir = true;
     m_Position = 0;
     m_Size = rootDirSize;
+    m_EntryLBA = 0;
+    m_EntryIndex = 0;
+    m_EntryDirty = false;
     m_FirstCluster = rootDirLba;
     m_CurrentCluster = m_FirstCluster;
     m_CurrentClusterIdx = 0;
     m_CurrentSectorInCluster = 0;
+    ResetExtents();
     
-    if (!m_FS->ReadSector(rootDirLba, m_Buffer)) {
+    if (!LoadCurrentSector()) {
         Debug::Error("FatFile", "Failed to read root directory!\r\n");
         return false;
     }
@@ -56,6 +72,10 @@ bool FATFile::ReadFileEntry(FAT_DirectoryEntry* dirEntry) {
 } 
 
 FileEntry* FATFile::ReadFileEntry() {
+    // Remembered so the entry can be updated in place once the file it describes changes
+    uint32_t entryLBA = CurrentLBA();
+    uint32_t entryIndex = (m_Position % SectorSize) / sizeof(FAT_DirectoryEntry);
+
     FAT_DirectoryEntry dirEntry;
     if (!ReadFileEntry(&dirEntry)) {
         Debug::Error("FatFile", "Failed to read directory entry!");
@@ -67,156 +87,279 @@ FileEntry* FATFile::ReadFileEntry() {
         Debug::Error("FatFile", "Failed to allocate a file entry!");
         return nullptr;
     }
-    fileEntry->Initialize(m_FS, dirEntry, m_CurrentCluster);
+    fileEntry->Initialize(m_FS, dirEntry, m_CurrentCluster, entryLBA, entryIndex);
 
     return fileEntry;
 }
 
+// Closing a file only puts its directory entry into the cache; the volume is written back by Sync,
+// eviction or the write-back deadline
 void FATFile::Release() {
+    DropSector();
+    Flush();
     m_FS->ReleaseFile(this);
 }
 
+bool FATFile::Flush() {
+    if (!m_EntryDirty || m_IsDirectory) return true;
+    if (!m_EntryLBA) {
+        Debug::Error("FATFile", "File has no directory entry to update!");
+        return false;
+    }
+    if (!m_FS->UpdateFileEntry(this)) {
+        Debug::Error("FATFile", "Failed to update directory entry!");
+        return false;
+    }
+    m_EntryDirty = false;
+    return true;
+}
+
+uint32_t FATFile::CurrentLBA() {
+    // The FAT12/16 root directory is addressed by sector rather than by cluster
+    if (m_IsRootDir) return m_CurrentCluster;
+    return m_FS->ClusterToLBA(m_CurrentCluster) + m_CurrentSectorInCluster;
+}
+
+bool FATFile::LoadCurrentSector(bool read) {
+    uint32_t lba = CurrentLBA();
+    if (m_Sector && m_Sector->valid && m_Sector->lba == lba) return true;
+
+    DropSector();
+    m_Sector = m_FS->GetSector(lba, read);
+    return m_Sector != nullptr;
+}
+
+void FATFile::DropSector() {
+    if (!m_Sector) return;
+    m_FS->ReleaseSector(m_Sector);
+    m_Sector = nullptr;
+}
+
 size_t FATFile::Read(uint8_t* data, size_t count) {
     uint8_t* originalDataPtr = data;
     if (!m_IsDirectory || (m_IsDirectory && m_Size != 0))
         count = min(count, (size_t)(m_Size - m_Position));
 
+    // Random access starts the window over
+    bool sequential = m_Position == m_LastReadEnd;
+    if (!sequential) {
+        m_ReadaheadClusters = 0;
+        m_ReadaheadIdx = m_CurrentClusterIdx;
+    }
+
     while (count > 0) {
+        // Whole sectors skip the cache; the sector buffer is left for unaligned heads and tails
+        if (m_Position % SectorSize == 0 && count >= SectorSize && !m_IsRootDir && !m_IsDirectory) {
+            size_t sectors = ReadDirect(data, count / SectorSize);
+            if (sectors) {
+                data += sectors * SectorSize;
+                m_Position += sectors * SectorSize;
+                count -= sectors * SectorSize;
+                continue;
+            }
+        }
+
+        // Only reads that end in this sector are served from the cache all the way; anything longer continues
+        // around it, and a window read ahead now would be read from the disk a second time
+        if (sequential && m_Position % SectorSize + count <= SectorSize) Readahead();
+        if (!LoadCurrentSector()) {
+            Debug::Error("FatFile", "Failed to read next sector!");
+            break;
+        }
+
         size_t leftInBuffer = SectorSize - (m_Position % SectorSize);
         uint32_t take = min(count, leftInBuffer);
 
-        Memory::Copy(data, m_Buffer + (m_Position % SectorSize), take);
+        Memory::Copy(data, m_Sector->data + (m_Position % SectorSize), take);
         data += take;
         m_Position += take;
         count -= take;
 
-        // check if there's more data
+        // move on to the next sector; it is fetched once there's data to take from it
         if (leftInBuffer == take) {
-            if (m_IsRootDir) {
-                m_CurrentCluster++;
-                if (!m_FS->ReadSector(m_CurrentCluster, m_Buffer)) {
-                    Debug::Error("FatFile", "Failed to read FAT12/16 Root Directory!");
-                    break;
-                }
-            } else {
-                if (m_CurrentSectorInCluster++ >= m_FS->Data().BS.BootSector.SectorsPerCluster) {
-                    m_CurrentSectorInCluster = 0;
-                    m_CurrentCluster = m_FS->GetNextCluster(m_CurrentCluster);
-                    m_CurrentClusterIdx++;
-                }
-                if (m_CurrentCluster >= 0xFFFFFFF8) {
-                    // EOF
-                    m_Size = m_Position;
-                    break;
-                }
-
-                if (!m_FS->ReadSectorFromCluster(m_CurrentCluster, m_Buffer, m_CurrentSectorInCluster)) {
-                    Debug::Error("FatFile", "Failed to read next sector!");
-                    break;
-                }
+            NextSector();
+            if (!m_IsRootDir && m_CurrentCluster >= 0xFFFFFFF8) {
+                // EOF
+                m_Size = m_Position;
+                break;
             }
         }
     }
 
+    m_LastReadEnd = m_Position;
     return data - originalDataPtr;
 }
 
+void FATFile::Readahead() {
+    uint32_t maxWindow = m_FS->ReadaheadWindow();
+    // Directories have no size to bound the window with
+    if (m_IsRootDir || m_IsDirectory || !maxWindow || m_CurrentClusterIdx < m_ReadaheadIdx) return;
+    if (m_CurrentCluster < 2 || m_CurrentCluster >= 0xFFFFFFF8) return;
+
+    uint32_t sectorsPerCluster = m_FS->Data().BS.BootSector.SectorsPerCluster;
+    uint32_t clusterBytes = sectorsPerCluster * SectorSize;
+    uint32_t lastClusterIdx = m_Size ? (m_Size - 1) / clusterBytes : 0;
+
+    m_ReadaheadClusters = m_ReadaheadClusters ? min(m_ReadaheadClusters * 2, maxWindow) : 1;
+    uint32_t window = min(m_ReadaheadClusters, lastClusterIdx - m_CurrentClusterIdx);
+
+    // The rest of the current cluster plus `window` clusters after it, prefetched one contiguous run at a time
+    uint32_t runLBA = m_FS->ClusterToLBA(m_CurrentCluster) + m_CurrentSectorInCluster;
+    uint32_t runCount = sectorsPerCluster - m_CurrentSectorInCluster;
+    uint32_t clusterIdx = m_CurrentClusterIdx + 1;
+    uint32_t end = clusterIdx + window;
+    while (clusterIdx < end) {
+        uint32_t cluster, run;
+        if (!MapCluster(clusterIdx, cluster, &run)) break;
+        run = min(run, end - clusterIdx);
+        clusterIdx += run;
+
+        uint32_t lba = m_FS->ClusterToLBA(cluster);
+        if (lba == runLBA + runCount) {
+            runCount += run * sectorsPerCluster;
+            continue;
+        }
+        m_FS->Prefetch(runLBA, runCount);
+        runLBA = lba;
+        runCount = run * sectorsPerCluster;
+    }
+    m_FS->Prefetch(runLBA, runCount);
+
+    m_ReadaheadIdx = clusterIdx;
+}
+
+size_t FATFile::ReadDirect(uint8_t* data, size_t maxSectors) {
+    uint32_t sectorsPerCluster = m_FS->Data().BS.BootSector.SectorsPerCluster;
+    uint32_t cluster, run;
+    if (!MapCluster(m_CurrentClusterIdx, cluster, &run)) return 0;
+
+    size_t sectors = min<size_t>(run * sectorsPerCluster - m_CurrentSectorInCluster, maxSectors);
+    if (!m_FS->ReadSectorsDirect(m_FS->ClusterToLBA(cluster) + m_CurrentSectorInCluster, data, sectors)) return 0;
+
+    uint32_t offset = m_CurrentSectorInCluster + sectors;
+    m_CurrentSectorInCluster = offset % sectorsPerCluster;
+    if (offset >= sectorsPerCluster) {
+        m_CurrentClusterIdx += offset / sectorsPerCluster;
+        if (!MapCluster(m_CurrentClusterIdx, cluster)) cluster = 0xFFFFFFFF;
+        m_CurrentCluster = cluster;
+    }
+    return sectors;
+}
+
+size_t FATFile::WriteDirect(const uint8_t* data, size_t maxSectors) {
+    uint32_t sectorsPerCluster = m_FS->Data().BS.BootSector.SectorsPerCluster;
+    uint32_t cluster, run;
+    if (!MapCluster(m_CurrentClusterIdx, cluster, &run)) return 0;
+
+    size_t sectors = min<size_t>(run * sectorsPerCluster - m_CurrentSectorInCluster, maxSectors);
+    if (!m_FS->WriteSectorsDirect(m_FS->ClusterToLBA(cluster) + m_CurrentSectorInCluster, data, sectors)) return 0;
+
+    uint32_t offset = m_CurrentSectorInCluster + sectors;
+    m_CurrentSectorInCluster = offset % sectorsPerCluster;
+    if (offset >= sectorsPerCluster) {
+        m_CurrentClusterIdx += offset / sectorsPerCluster;
+        if (!MapCluster(m_CurrentClusterIdx, cluster)) cluster = 0xFFFFFFFF;
+        m_CurrentCluster = cluster;
+    }
+    return sectors;
+}
+
 size_t FATFile::Write(const uint8_t* data, size_t count) {
     const uint8_t* originalDataPtr = data;
-    uint32_t originalSize = m_Size;
+
+    // File clusters from this index on were allocated by this call and hold nothing worth reading back
+    uint32_t freshFrom = UINT32_MAX;
+
+    // Every cluster the write needs is claimed up front, as contiguous runs where the free space allows
+    if (!m_IsRootDir && count > 0) {
+        uint32_t clusterBytes = m_FS->Data().BS.BootSector.SectorsPerCluster * SectorSize;
+        count = min<size_t>(count, UINT32_MAX - m_Position);
+        uint32_t needed = (static_cast<uint64_t>(m_Position) + count + clusterBytes - 1) / clusterBytes;
+        // Overwrites inside clusters already known to exist don't need to look at the end of the chain
+        uint32_t known = m_TailKnown ? m_ClusterCount : m_MappedClusters;
+        uint32_t reached = needed;
+        if (needed > known) {
+            LastCluster(&freshFrom);
+            reached = Grow(needed);
+        }
+        if (reached < needed) {
+            Debug::Error("FATFile", "Failed to allocate clusters, the write is cut short!");
+            uint64_t room = static_cast<uint64_t>(reached) * clusterBytes;
+            count = room > m_Position ? min<uint64_t>(count, room - m_Position) : 0;
+        }
+
+        // The cursor may be waiting past the old end of the chain
+        if (count > 0 && (m_CurrentCluster < 2 || m_CurrentCluster >= 0xFFFFFFF8)) {
+            uint32_t cluster;
+            if (!MapCluster(m_CurrentClusterIdx, cluster)) count = 0;
+            else m_CurrentCluster = cluster;
+        }
+    }
 
     while (count > 0) {
         size_t offsetInSector = m_Position % SectorSize;
-        size_t spaceInBuffer = SectorSize - offsetInSector;
-        size_t toWrite = min(count, spaceInBuffer);
 
-        // If we are writing partial sector, read the current sector to preserve unwritten bytes
-        if (offsetInSector != 0 || toWrite != SectorSize) {
-            if (!m_FS->ReadSectorFromCluster(m_CurrentCluster, m_Buffer, m_CurrentSectorInCluster)) {
-                Debug::Error("FATFile", "Failed to read sector for partial write!");
-                break;
+        // Whole sectors go to the disk in one command per cluster run
+        if (offsetInSector == 0 && count >= SectorSize && !m_IsRootDir) {
+            size_t sectors = WriteDirect(data, count / SectorSize);
+            if (sectors) {
+                m_Position += sectors * SectorSize;
+                data += sectors * SectorSize;
+                count -= sectors * SectorSize;
+                continue;
             }
         }
 
-        // Copy the data into the buffer
-        Memory::Copy(m_Buffer + offsetInSector, data, toWrite);
+        size_t toWrite = min(count, SectorSize - offsetInSector);
 
-        // Flush the buffer to disk ALWAYS after copying
-        if (!m_FS->WriteSectorFromCluster(m_CurrentCluster, m_Buffer, m_CurrentSectorInCluster)) {
-            Debug::Error("FATFile", "Failed to write sector!");
+        // A partial sector has to be read first to preserve the unwritten bytes, unless it is cached already.
+        // A cluster this call allocated has nothing to preserve and the sector is cleared instead. m_Size can't
+        // tell that, directories have none.
+        bool partial = offsetInSector != 0 || toWrite != SectorSize;
+        bool fresh = !m_IsRootDir && m_CurrentClusterIdx >= freshFrom;
+        if (!LoadCurrentSector(partial && !fresh)) {
+            Debug::Error("FATFile", "Failed to read sector for partial write!");
             break;
         }
+        if (partial && fresh) Memory::Set(m_Sector->data, 0, SectorSize);
 
-        Debug::Info("FATFile", "Wrote %zu bytes to cluster %u sector %u pos %u",
-                    toWrite, m_CurrentCluster, m_CurrentSectorInCluster, m_Position);
+        // Copy the data into the cached sector
+        Memory::Copy(m_Sector->data + offsetInSector, data, toWrite);
+
+        // Written through, or buffered until the next flush in write-back mode
+        if (!m_FS->MarkSectorDirty(m_Sector)) {
+            Debug::Error("FATFile", "Failed to write sector!");
+            break;
+        }
 
         m_Position += toWrite;
         data += toWrite;
         count -= toWrite;
 
         // Move to next sector if current sector is fully written
-        if (offsetInSector + toWrite == SectorSize) {
-            m_CurrentSectorInCluster++;
-            if (m_CurrentSectorInCluster >= m_FS->Data().BS.BootSector.SectorsPerCluster) {
-                m_CurrentSectorInCluster = 0;
-
-                uint32_t nextCluster = m_FS->GetNextCluster(m_CurrentCluster);
-                if (nextCluster >= 0xFFFFFFF8) {
-                    // Need to allocate a new cluster and link it
-                    uint32_t newCluster = m_FS->AllocateCluster();
-                    if (!newCluster) {
-                        Debug::Error("FATFile", "Failed to allocate new cluster!");
-                        break;
-                    }
-                    if (!m_FS->LinkCluster(m_CurrentCluster, newCluster)) {
-                        Debug::Error("FATFile", "Failed to link new cluster!");
-                        break;
-                    }
-                    m_CurrentCluster = newCluster;
-
-                    // Flush FAT table after modifying it
-                    if (!m_FS->FlushFAT()) {
-                        Debug::Error("FATFile", "Failed to flush FAT after cluster allocation!");
-                        break;
-                    }
-                } else {
-                    m_CurrentCluster = nextCluster;
-                }
-            }
-        }
-
-        // Update the file size in memory
-        if (m_Position > m_Size) {
-            m_Size = m_Position;
-        }
+        if (offsetInSector + toWrite == SectorSize) NextSector();
     }
 
-    // After writing, update the directory entry on disk if size changed
-    if (m_Size != originalSize) {
-        if (!m_FS->UpdateFileEntrySize(this, m_Size)) {
-            Debug::Error("FATFile", "Failed to update directory entry file size!");
-        }
-    }
+    // The directory entry is written once, by Flush or on release
+    if (data != originalDataPtr) m_EntryDirty = true;
+    if (m_Position > m_Size) m_Size = m_Position;
 
     return data - originalDataPtr;
 }
 
-
-bool FATFile::Seek(int rel, SeekPos pos) {
+bool FATFile::Seek(int64_t rel, SeekPos pos) {
+    // FAT files stay below 4 GiB, so the position is clamped into 32 bits
     switch (pos)
     {
     case SeekPos::Set: 
-        m_Position = static_cast<uint32_t>(max(0, rel));
+        m_Position = static_cast<uint32_t>(min<int64_t>(max<int64_t>(0, rel), m_Size));
         break;
     case SeekPos::Current:
-        if (rel < 0 && m_Position < -rel)
-            m_Position = 0;
-        m_Position = min(Size(), static_cast<size_t>(m_Position + rel));
+        m_Position = static_cast<uint32_t>(min<int64_t>(max<int64_t>(0, static_cast<int64_t>(m_Position) + rel), m_Size));
         break;
     case SeekPos::End:
-        if (rel < 0 && Size() < -rel)
-            m_Position = 0;
-        m_Position = min(Size(), static_cast<size_t>(Size() + rel));
+        m_Position = static_cast<uint32_t>(min<int64_t>(max<int64_t>(0, static_cast<int64_t>(m_Size) + rel), m_Size));
+        break;
 
     default:
         break;
@@ -226,23 +369,201 @@ bool FATFile::Seek(int rel, SeekPos pos) {
 }
 
 bool FATFile::UpdateCurrentCluster() {
-    uint32_t clusterSize = m_FS->Data().BS.BootSector.SectorsPerCluster;
-    uint32_t desiredCluster = m_Position / clusterSize;
-    uint32_t desiredSector = (m_Position % clusterSize) / SectorSize;
+    if (m_IsRootDir) {
+        m_CurrentCluster = m_FirstCluster + m_Position / SectorSize;
+        return LoadCurrentSector();
+    }
 
-    if (desiredCluster == m_CurrentClusterIdx && desiredSector == m_CurrentSectorInCluster) return true;
+    uint32_t clusterBytes = m_FS->Data().BS.BootSector.SectorsPerCluster * SectorSize;
+    uint32_t clusterIdx = m_Position / clusterBytes;
+    m_CurrentSectorInCluster = (m_Position % clusterBytes) / SectorSize;
 
-    if (desiredCluster < m_CurrentClusterIdx) {
-        m_CurrentClusterIdx = 0;
-        m_CurrentCluster = m_FirstCluster;
+    if (clusterIdx != m_CurrentClusterIdx || m_CurrentCluster < 2 || m_CurrentCluster >= 0xFFFFFFF8) {
+        uint32_t cluster;
+        if (!MapCluster(clusterIdx, cluster)) cluster = 0xFFFFFFFF;
+        m_CurrentClusterIdx = clusterIdx;
+        m_CurrentCluster = cluster;
+    }
+
+    // The end of a file that fills its last cluster has no sector until a write allocates one
+    if (m_CurrentCluster < 2 || m_CurrentCluster >= 0xFFFFFFF8) {
+        DropSector();
+        return m_Position == m_Size;
     }
-    while (desiredCluster > m_CurrentClusterIdx) {
-        m_CurrentCluster = m_FS->GetNextCluster(m_CurrentCluster);
-        m_CurrentClusterIdx++;
+    return LoadCurrentSector();
+}
+
+void FATFile::NextSector() {
+    if (m_IsRootDir) {
+        m_CurrentCluster++;
+        return;
+    }
+    if (++m_CurrentSectorInCluster < m_FS->Data().BS.BootSector.SectorsPerCluster) return;
+
+    uint32_t cluster;
+    if (!MapCluster(m_CurrentClusterIdx + 1, cluster)) cluster = 0xFFFFFFFF;
+    m_CurrentSectorInCluster = 0;
+    m_CurrentClusterIdx++;
+    m_CurrentCluster = cluster;
+}
+
+bool FATFile::MapCluster(uint32_t clusterIdx, uint32_t& cluster, uint32_t* run) {
+    if (!ExtendMap(clusterIdx)) {
+        if (m_MapComplete || !m_MappedClusters) return false;
+
+        // Out of extents: walk the chain, from the cursor when that's closer than the last extent
+        const Extent& last = m_Extents[m_ExtentCount - 1];
+        uint32_t idx = m_MappedClusters - 1;
+        uint32_t current = last.diskCluster + last.length - 1;
+        if (m_CurrentClusterIdx > idx && m_CurrentClusterIdx <= clusterIdx && m_CurrentCluster >= 2 && m_CurrentCluster < 0xFFFFFFF8) {
+            idx = m_CurrentClusterIdx;
+            current = m_CurrentCluster;
+        }
+        for (; idx < clusterIdx; idx++) {
+            current = m_FS->GetNextCluster(current);
+            if (current < 2 || current >= 0xFFFFFFF8) return false;
+        }
+        cluster = current;
+        if (run) *run = 1;
+        return true;
+    }
+
+    // Last extent starting at or before the cluster
+    size_t low = 0, high = m_ExtentCount;
+    while (high - low > 1) {
+        size_t mid = (low + high) / 2;
+        if (m_Extents[mid].fileCluster <= clusterIdx) low = mid;
+        else high = mid;
+    }
+    const Extent& extent = m_Extents[low];
+    cluster = extent.diskCluster + (clusterIdx - extent.fileCluster);
+    if (run) *run = extent.length - (clusterIdx - extent.fileCluster);
+    return true;
+}
+
+bool FATFile::ExtendMap(uint32_t clusterIdx) {
+    while (clusterIdx >= m_MappedClusters && !m_MapComplete) {
+        uint32_t next = m_FirstCluster;
+        if (m_ExtentCount) {
+            const Extent& last = m_Extents[m_ExtentCount - 1];
+            next = m_FS->GetNextCluster(last.diskCluster + last.length - 1);
+        }
+        if (next < 2 || next >= 0xFFFFFFF8) {
+            m_MapComplete = true;
+            if (m_ExtentCount) {
+                const Extent& last = m_Extents[m_ExtentCount - 1];
+                m_TailCluster = last.diskCluster + last.length - 1;
+                m_ClusterCount = m_MappedClusters;
+                m_TailKnown = true;
+            }
+            break;
+        }
+        if (!AppendExtent(next)) return false;
+    }
+    return clusterIdx < m_MappedClusters;
+}
+
+bool FATFile::AppendExtent(uint32_t cluster, uint32_t count) {
+    if (m_ExtentCount) {
+        Extent& last = m_Extents[m_ExtentCount - 1];
+        if (last.diskCluster + last.length == cluster) {
+            last.length += count;
+            m_MappedClusters += count;
+            return true;
+        }
     }
+    if (m_ExtentCount == MaxExtents) return false;
 
-    m_CurrentSectorInCluster = desiredSector;
-    return m_FS->ReadSectorFromCluster(m_CurrentCluster, m_Buffer, m_CurrentSectorInCluster);
+    m_Extents[m_ExtentCount++] = Extent{ m_MappedClusters, cluster, count };
+    m_MappedClusters += count;
+    return true;
+}
+
+void FATFile::NoteAppended(uint32_t cluster, uint32_t count) {
+    // Only a map that reaches the old end can be extended, otherwise it picks the clusters up from the FAT later
+    if (m_MapComplete && !AppendExtent(cluster, count)) m_MapComplete = false;
+    if (m_TailKnown) {
+        m_TailCluster = cluster + count - 1;
+        m_ClusterCount += count;
+    }
+}
+
+void FATFile::ResetExtents() {
+    m_ExtentCount = 0;
+    m_MappedClusters = 0;
+    m_MapComplete = m_IsRootDir || m_FirstCluster < 2;
+    // A file without clusters has an empty chain, any other one is followed again on demand
+    m_TailCluster = 0;
+    m_ClusterCount = 0;
+    m_TailKnown = !m_IsRootDir && m_FirstCluster < 2;
+}
+
+void FATFile::TruncateExtents(uint32_t clusterCount, uint32_t lastCluster) {
+    m_TailCluster = lastCluster;
+    m_ClusterCount = clusterCount;
+    m_TailKnown = true;
+
+    while (m_ExtentCount && m_Extents[m_ExtentCount - 1].fileCluster >= clusterCount)
+        m_ExtentCount--;
+    if (m_ExtentCount) {
+        Extent& last = m_Extents[m_ExtentCount - 1];
+        last.length = min(last.length, clusterCount - last.fileCluster);
+    }
+    m_MappedClusters = min(m_MappedClusters, clusterCount);
+    m_MapComplete = m_MappedClusters == clusterCount;
+}
+
+uint32_t FATFile::LastCluster(uint32_t* clusterCount) {
+    if (!m_TailKnown) {
+        ExtendMap(UINT32_MAX);
+        if (!m_TailKnown) {
+            // The extent table is full, the rest of the chain is walked this once
+            const Extent& last = m_Extents[m_ExtentCount - 1];
+            uint32_t cluster = last.diskCluster + last.length - 1;
+            uint32_t count = m_MappedClusters;
+            for (uint32_t next = m_FS->GetNextCluster(cluster); next >= 2 && next < 0xFFFFFFF8; next = m_FS->GetNextCluster(cluster)) {
+                cluster = next;
+                count++;
+            }
+            m_TailCluster = cluster;
+            m_ClusterCount = count;
+            m_TailKnown = true;
+        }
+    }
+    if (clusterCount) *clusterCount = m_ClusterCount;
+    return m_TailCluster;
+}
+
+uint32_t FATFile::Grow(uint32_t clusterCount) {
+    uint32_t count;
+    uint32_t cluster = LastCluster(&count);
+
+    // A file without clusters starts its chain with the first run; the directory entry picks it up on Flush
+    if (!cluster && clusterCount > 0) {
+        count = clusterCount;
+        uint32_t run = m_FS->AllocateClusters(count);
+        if (!run) return 0;
+        // Still mapped as an empty, complete chain, so the run is taken up like any appended one
+        m_FirstCluster = run;
+        m_EntryDirty = true;
+        NoteAppended(run, count);
+        cluster = run + count - 1;
+    }
+
+    // Whole runs at a time, continuing right behind the last cluster where possible
+    while (count < clusterCount) {
+        uint32_t runLength = clusterCount - count;
+        uint32_t run = m_FS->AllocateClusters(runLength, cluster + 1);
+        if (!run) break;
+        if (!m_FS->LinkCluster(cluster, run)) {
+            m_FS->FreeClusterChain(run);
+            break;
+        }
+        NoteAppended(run, runLength);
+        cluster = run + runLength - 1;
+        count += runLength;
+    }
+    return count;
 }
 
 bool FATFile::Resize(size_t size) {
@@ -252,69 +573,78 @@ bool FATFile::Resize(size_t size) {
     }
 
     uint32_t clusterSizeBytes = m_FS->Data().BS.BootSector.SectorsPerCluster * SectorSize;
-    uint32_t currentClusterCount = (m_Size + clusterSizeBytes - 1) / clusterSizeBytes;
     uint32_t desiredClusterCount = (size + clusterSizeBytes - 1) / clusterSizeBytes;
 
     if (desiredClusterCount == 0) {
-        m_FS->FreeClusterChain(m_FirstCluster);
+        DropSector();
+        uint32_t toFree = m_FirstCluster;
 
         m_CurrentCluster = m_FirstCluster = 0;
         m_CurrentClusterIdx = 0;
         m_CurrentSectorInCluster = 0;
         m_Position = 0;
         m_Size = 0;
+        m_EntryDirty = true;
+        ResetExtents();
 
-        return true;
+        // Until the emptied entry is on the disk, the chain stays allocated; failing here only leaks it
+        if (!CommitEntry()) return false;
+        return m_FS->FreeClusterChain(toFree);
     }
 
+    // The chain is measured rather than derived from the size, so clusters left past the end are freed too
+    uint32_t currentClusterCount;
+    LastCluster(&currentClusterCount);
+
     // Shrink file (removed unused cluster)
     if (desiredClusterCount < currentClusterCount) {
-        uint32_t cluster = m_FirstCluster;
-        for (uint32_t i = 0; i < desiredClusterCount - 1; i++) {
-            cluster = m_FS->GetNextCluster(cluster);
+        uint32_t lastValid;
+        if (!MapCluster(desiredClusterCount - 1, lastValid)) {
+            Debug::Error("FATFile", "Cluster chain is shorter than the file size");
+            return false;
         }
+        uint32_t toFree = m_FS->GetNextCluster(lastValid);
 
-        uint32_t lastValid = cluster;
-        uint32_t toFree = m_FS->GetNextCluster(cluster);
+        // The shorter size reaches the disk before the clusters past it are released
+        if (m_Size > size) {
+            m_Size = size;
+            m_EntryDirty = true;
+        }
+        if (!CommitEntry()) return false;
 
         if (!m_FS->SetNextCluster(lastValid, 0xFFFFFFFF)){
             Debug::Error("FATFile", "Failed to mark last valid character");
             return false;
         }
 
-        while (toFree < 0xFFFFFFF8) {
-            uint32_t next = m_FS->GetNextCluster(toFree);
-            m_FS->FreeCluster(toFree);
-            toFree = next;
-        }
+        if (toFree < 0xFFFFFFF8) m_FS->FreeClusterChain(toFree);
+        TruncateExtents(desiredClusterCount, lastValid);
     }
 
     else if (desiredClusterCount > currentClusterCount) {
-        uint32_t cluster = m_FirstCluster;
-        while (cluster < 0xFFFFFFF8) {
-            cluster = m_FS->GetNextCluster(cluster);
-        }
-
-        for (uint32_t i = currentClusterCount; i < desiredClusterCount; i++) {
-            uint32_t newCluster = m_FS->AllocateCluster();
-            if (!newCluster || !m_FS->LinkCluster(cluster, newCluster)) {
-                Debug::Error("FATFile", "Failed to allocate/link cluster while resizing file.");
-                return false;
-            }
-            cluster = newCluster;
+        if (Grow(desiredClusterCount) < desiredClusterCount) {
+            Debug::Error("FATFile", "Failed to allocate/link cluster while resizing file.");
+            return false;
         }
     }
 
+    if (m_Size != size) m_EntryDirty = true;
     m_Size = size;
     if (m_Position > size) m_Position = size;
 
+    // The cursor may sit in a freed cluster, or past the end where new ones were linked
+    m_CurrentClusterIdx = UINT32_MAX;
+    return UpdateCurrentCluster();
+}
+
+bool FATFile::CommitEntry() {
+    if (!Flush() || !m_FS->Sync()) {
+        Debug::Error("FATFile", "Failed to write the directory entry before freeing clusters!");
+        return false;
+    }
     return true;
 }
 
 bool FATFile::EraseContents() {
-    if (!Resize(0))
-        return false;
-    
-    Memory::Set(m_Buffer, 0, SectorSize);
-    return m_FS->WriteSectorFromCluster(m_FirstCluster, m_Buffer, 0);
-}
\ No newline at end of file
+    return Resize(0);
+}
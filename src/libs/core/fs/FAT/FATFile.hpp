@@ -3,6 +3,7 @@
 #include <core/fs/File.hpp>
 #include <core/fs/FileEntry.hpp>
 #include <core/fs/FAT/FATHeaders.hpp>
+#include <core/dev/BufferCache.hpp>
 
 class FATFileSystem;
 
@@ -10,7 +11,9 @@ class FATFile : public File {
 public:
     FATFile();
 
-    bool Open(FATFileSystem* fs, uint32_t firstCluster, const char* name, uint32_t size, bool isDirectory, uint32_t parentDirCluster = 0);
+    // `entryLBA` and `entryIndex` locate the file's directory entry; files without one (a FAT32 root) pass 0
+    bool Open(FATFileSystem* fs, uint32_t firstCluster, const char* name, uint32_t size, bool isDirectory, uint32_t parentDirCluster = 0,
+              uint32_t entryLBA = 0, uint32_t entryIndex = 0);
     bool OpenRootDirectory1216(FATFileSystem* fs, uint32_t rootDirLba, uint32_t rootDirSize);
     bool IsOpened() const { return m_Opened; }
 
@@ -21,21 +24,68 @@ public:
     virtual size_t Read(uint8_t* data, size_t count) override;
     virtual size_t Write(const uint8_t* data, size_t size) override;
     
-    virtual bool Seek(int rel, SeekPos pos) override;
+    virtual bool Seek(int64_t rel, SeekPos pos) override;
     
-    virtual size_t Position() override { return m_Position; }
-    virtual size_t Size() override { return m_Size; }
+    virtual uint64_t Position() override { return m_Position; }
+    virtual uint64_t Size() override { return m_Size; }
 
     virtual bool Resize(size_t size) override;
     virtual bool EraseContents() override;
+    // Writes the size, first cluster and modification time of earlier changes into the cached directory entry;
+    // Release and FATFileSystem::Sync do this too
+    bool Flush();
 
     uint32_t GetParentDirCluster() const { return m_ParentDirCluster; }
 
 private:
+    // A run of clusters that follow each other both in the file and on disk
+    struct Extent {
+        uint32_t fileCluster;
+        uint32_t diskCluster;
+        uint32_t length;
+    };
+
+    static constexpr size_t MaxExtents{ 32 };
+
     bool UpdateCurrentCluster();
+    // Moves the cursor to the next sector; past the last cluster m_CurrentCluster holds an end-of-chain value
+    void NextSector();
+
+    // Disk cluster of file cluster `clusterIdx`, and in `run` how many clusters from it on are contiguous.
+    // False past the end of the chain.
+    bool MapCluster(uint32_t clusterIdx, uint32_t& cluster, uint32_t* run = nullptr);
+    // Follows the chain from the end of the mapped extents until `clusterIdx` is mapped, the chain ends or the table is full
+    bool ExtendMap(uint32_t clusterIdx);
+    // Records `count` clusters from `cluster` as the next file clusters after the mapped ones
+    bool AppendExtent(uint32_t cluster, uint32_t count = 1);
+    // For clusters just linked to the end of the chain
+    void NoteAppended(uint32_t cluster, uint32_t count);
+    void ResetExtents();
+    // Cuts the map down to the first `clusterCount` clusters, `lastCluster` being the new end of the chain
+    void TruncateExtents(uint32_t clusterCount, uint32_t lastCluster);
+    // Disk cluster at the end of the chain, 0 for a file without clusters; `clusterCount` gets the chain's length.
+    // The chain is followed once, afterwards both are kept up to date as the chain grows and shrinks.
+    uint32_t LastCluster(uint32_t* clusterCount = nullptr);
+    // Extends the chain to `clusterCount` clusters in as few contiguous runs as the free space allows, starting
+    // one for a file without clusters. Returns the length the chain reached.
+    uint32_t Grow(uint32_t clusterCount);
+    // Flushes the directory entry and everything the volume buffers before clusters are freed, see FATFileSystem::DirectoryStage
+    bool CommitEntry();
+
+    uint32_t CurrentLBA();
+    // Points m_Sector at the cached sector under the cursor; `read` false skips fetching a sector about to be overwritten
+    bool LoadCurrentSector(bool read = true);
+    void DropSector();
+    // Reads ahead from the cursor once it reaches clusters that weren't read ahead yet
+    void Readahead();
+    // Reads whole sectors from the cursor on straight into `data`, up to the end of the cursor's cluster run,
+    // and moves the cursor behind them. Returns the number of sectors read, 0 if none could be.
+    size_t ReadDirect(uint8_t* data, size_t maxSectors);
+    size_t WriteDirect(const uint8_t* data, size_t maxSectors);
 
     FATFileSystem* m_FS;
-    uint8_t m_Buffer[SectorSize];
+    // Referenced for as long as the cursor stays in it
+    BufferCache::Buffer* m_Sector;
     bool m_Opened;
     bool m_IsRootDir;
     bool m_IsDirectory;
@@ -46,6 +96,28 @@ private:
     uint32_t m_CurrentSectorInCluster;
     uint32_t m_Position;
     uint32_t m_Size;
+    // Where the directory entry lives: the sector and the entry's index in it
+    uint32_t m_EntryLBA;
+    uint32_t m_EntryIndex;
+    // The file changed since the directory entry was last written
+    bool m_EntryDirty;
+
+    // Cover file clusters [0, m_MappedClusters) in order; m_MapComplete once the end of the chain was mapped too.
+    // Built as the cursor moves, so seeks and appends look clusters up with a binary search instead of walking the FAT.
+    Extent m_Extents[MaxExtents];
+    uint32_t m_ExtentCount;
+    uint32_t m_MappedClusters;
+    bool m_MapComplete;
+    // End and length of the whole chain, valid while m_TailKnown; unlike the extents they survive a full table
+    uint32_t m_TailCluster;
+    uint32_t m_ClusterCount;
+    bool m_TailKnown;
+
+    // Where the previous Read stopped; a Read starting there counts as sequential
+    uint32_t m_LastReadEnd;
+    // First cluster index past what was read ahead, and the window that covered it, doubled on every sequential refill
+    uint32_t m_ReadaheadIdx;
+    uint32_t m_ReadaheadClusters;
 
     friend class FATFileSystem;
 };
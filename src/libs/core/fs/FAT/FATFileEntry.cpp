@@ -7,10 +7,12 @@
 FATFileEntry::FATFileEntry()
     : m_FS(), m_DirEntry() {}
 
-void FATFileEntry::Initialize(FATFileSystem* fs, const FAT_DirectoryEntry& dirEntry, uint32_t parentDirCluster) {
+void FATFileEntry::Initialize(FATFileSystem* fs, const FAT_DirectoryEntry& dirEntry, uint32_t parentDirCluster, uint32_t entryLBA, uint32_t entryIndex) {
     m_FS = fs;
     m_DirEntry = dirEntry;
     m_ParentDirCluster = parentDirCluster;
+    m_EntryLBA = entryLBA;
+    m_EntryIndex = entryIndex;
 }
 
 void FATFileEntry::Release() {
@@ -25,7 +27,8 @@ File* FATFileEntry::Open(FileOpenMode mode) {
     }
 
     uint32_t firstCluster = m_DirEntry.FirstClusterLow + ((uint32_t)m_DirEntry.FirstClusterHigh << 16);
-    if (!file->Open(m_FS, firstCluster, Name(), m_DirEntry.Size, m_DirEntry.Attributes & FAT_ATTRIBUTE_DIRECTORY, m_ParentDirCluster)) {
+    if (!file->Open(m_FS, firstCluster, Name(), m_DirEntry.Size, m_DirEntry.Attributes & FAT_ATTRIBUTE_DIRECTORY, m_ParentDirCluster,
+                    m_EntryLBA, m_EntryIndex)) {
         Debug::Error("FatFileEntry", "Failed to open file!");
         m_FS->ReleaseFile(file);
         return nullptr;
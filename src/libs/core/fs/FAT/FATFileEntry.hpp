@@ -8,7 +8,8 @@ class FATFileSystem;
 class FATFileEntry : public FileEntry {
 public:
     FATFileEntry();
-    void Initialize(FATFileSystem* fs, const FAT_DirectoryEntry& dirEntry, uint32_t parentDirCluster);
+    // `entryLBA` and `entryIndex` say where `dirEntry` was read from, so the opened file can update it in place
+    void Initialize(FATFileSystem* fs, const FAT_DirectoryEntry& dirEntry, uint32_t parentDirCluster, uint32_t entryLBA, uint32_t entryIndex);
     virtual File* Open(FileOpenMode mode) override;
     virtual void Release() override;
 
@@ -19,4 +20,6 @@ private:
     FATFileSystem* m_FS;
     FAT_DirectoryEntry m_DirEntry;
     uint32_t m_ParentDirCluster = 0;
+    uint32_t m_EntryLBA = 0;
+    uint32_t m_EntryIndex = 0;
 };
@@ -77,6 +77,23 @@ struct FAT_BootSector {
     // ... we don't care about code ...
 } PACKED;
 
+// FAT32 only: the allocator's hints, both 0xFFFFFFFF when unknown
+struct FAT32_FSInfo {
+    uint32_t LeadSignature;
+    uint8_t _Reserved[480];
+    uint32_t StructSignature;
+    uint32_t FreeCount;
+    uint32_t NextFree;
+    uint8_t _Reserved2[12];
+    uint32_t TrailSignature;
+} PACKED;
+static_assert(sizeof(FAT32_FSInfo) == SectorSize, "FSInfo fills one sector");
+
+constexpr uint32_t FSInfoLeadSignature = 0x41615252;
+constexpr uint32_t FSInfoStructSignature = 0x61417272;
+constexpr uint32_t FSInfoTrailSignature = 0xAA550000;
+constexpr uint32_t FSInfoUnknown = 0xFFFFFFFF;
+
 struct FAT_LFN_Block{
     uint8_t Order;
     int16_t Chars[13]; 
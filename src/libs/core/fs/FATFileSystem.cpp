@@ -4,6 +4,9 @@
 
 #include <core/ZosDefs.hpp>
 #include <core/Debug.hpp>
+#include <core/cpp/Memory.hpp>
+#include <core/cpp/Algorithm.hpp>
+#include <core/arch/i686/RTC.hpp>
 
 constexpr const char* LogModule = "FAT";
 
@@ -48,6 +51,7 @@ bool FATFileSystem::Initialize(BlockDevice* device) {
         }
     }
 
+    m_TotalSectors = m_Data->BS.BootSector.TotalSectors ? m_Data->BS.BootSector.TotalSectors : m_Data->BS.BootSector.LargeSectorCount;
     DetectFatType();
 
     m_Data->LFN_Count = 0;
@@ -58,11 +62,46 @@ bool FATFileSystem::Initialize(BlockDevice* device) {
     }
 
     m_FATStart = m_Data->BS.BootSector.ReservedSectors;
-    m_TotalClusters = m_TotalSectors / m_Data->BS.BootSector.SectorsPerCluster;
+    // Data clusters are numbered from 2, and a FAT can't describe more clusters than it has entries for
+    uint32_t dataClusters = (m_TotalSectors - m_DataSectionLBA) / m_Data->BS.BootSector.SectorsPerCluster;
+    uint32_t fatEntries = static_cast<uint32_t>(static_cast<uint64_t>(m_SectorsPerFat) * SectorSize * 8 / m_FatType);
+    m_TotalClusters = min(dataClusters + 2, fatEntries);
+
+    if (m_FatType == 32) ReadFSInfo();
 
     return true;
 }
 
+void FATFileSystem::ReadFSInfo() {
+    uint16_t sector = m_Data->BS.BootSector.EBR32.FSInfoSector;
+    if (sector == 0 || sector == 0xFFFF) return;
+
+    BufferCache::Buffer* buffer = GetSector(sector);
+    if (!buffer) return;
+    const FAT32_FSInfo* info = reinterpret_cast<const FAT32_FSInfo*>(buffer->data);
+    if (info->LeadSignature == FSInfoLeadSignature && info->StructSignature == FSInfoStructSignature &&
+        info->TrailSignature == FSInfoTrailSignature) {
+        m_FSInfoLBA = sector;
+        if (info->FreeCount < m_TotalClusters) m_FSInfoFreeCount = info->FreeCount;
+        if (info->NextFree >= 2 && info->NextFree < m_TotalClusters) m_AllocCursor = info->NextFree;
+    } else Debug::Warn(LogModule, "FSInfo sector %u has bad signatures, ignoring it", sector);
+    ReleaseSector(buffer);
+}
+
+bool FATFileSystem::WriteFSInfo() {
+    if (!m_FSInfoLBA || !m_FSInfoDirty) return true;
+
+    BufferCache::Buffer* buffer = GetSector(m_FSInfoLBA);
+    if (!buffer) return false;
+    FAT32_FSInfo* info = reinterpret_cast<FAT32_FSInfo*>(buffer->data);
+    info->FreeCount = m_FreeClusters;
+    info->NextFree = m_AllocCursor;
+    bool ok = MarkSectorDirty(buffer);
+    ReleaseSector(buffer);
+    if (ok) m_FSInfoDirty = false;
+    return ok;
+}
+
 File* FATFileSystem::RootDirectory() {
     return &m_Data->RootDirectory;
 }
@@ -81,34 +120,85 @@ void FATFileSystem::DetectFatType() {
 }
 
 bool FATFileSystem::ReadBootSector() {
-    m_Device->Seek(0, SeekPos::Set);
-    size_t read = m_Device->Read(m_Data->BS.BootSectorBytes, SectorSize);
-    if (read != SectorSize) {
-        Debug::Debug(LogModule, "Boot Sector read failed! Expected: %lu, Actual: %lu", SectorSize, read);
+    if (!ReadSector(0, m_Data->BS.BootSectorBytes)) {
+        Debug::Debug(LogModule, "Boot Sector read failed!");
         return false;
     }
     return true;
 }
 
+// Every sector goes through the kernel buffer cache, whose blocks match the FAT sector size
+BufferCache::Buffer* FATFileSystem::GetSector(uint32_t LBA, bool read) {
+    BufferCache::Buffer* buffer = g_BufferCache.Get(m_Device, LBA, read);
+    if (!buffer) Debug::Debug(LogModule, "Get Sector failed! LBA: %lu", LBA);
+    return buffer;
+}
+
+BufferCache::Buffer* FATFileSystem::GetSectorFromCluster(uint32_t cluster, size_t offset, bool read) {
+    return GetSector(ClusterToLBA(cluster) + offset, read);
+}
+
+void FATFileSystem::ReleaseSector(BufferCache::Buffer* buffer) {
+    g_BufferCache.Release(buffer);
+}
+
+bool FATFileSystem::MarkSectorDirty(BufferCache::Buffer* buffer, uint8_t stage) {
+    return g_BufferCache.MarkDirty(buffer, stage);
+}
+
+void FATFileSystem::Prefetch(uint32_t LBA, size_t count) {
+    g_BufferCache.Prefetch(m_Device, LBA, count);
+}
+
 bool FATFileSystem::ReadSector(uint32_t LBA, uint8_t* buffer, size_t count) {
-    m_Device->Seek(LBA * SectorSize, SeekPos::Set);
-    size_t read = m_Device->Read(buffer, count * SectorSize);
-    size_t expected = count * SectorSize;
-    if (read != expected) {
-        Debug::Debug(LogModule, "Read Sector failed! Expected: %lu, Actual: %lu", expected, read);
+    for (size_t i = 0; i < count; i++) {
+        BufferCache::Buffer* sector = GetSector(LBA + i);
+        if (!sector) {
+            Debug::Debug(LogModule, "Read Sector failed! LBA: %lu, Count: %lu", LBA, count);
+            return false;
+        }
+        Memory::Copy(buffer + i * SectorSize, sector->data, SectorSize);
+        ReleaseSector(sector);
+    }
+    return true;
+}
+
+bool FATFileSystem::ReadSectorsDirect(uint32_t LBA, uint8_t* buffer, size_t count) {
+    if (!g_BufferCache.FlushRange(m_Device, LBA, count)) return false;
+
+    IOVec iov{ buffer, count * SectorSize };
+    if (!m_Device->ReadBlocks(LBA, count, &iov, 1)) {
+        Debug::Debug(LogModule, "Direct read failed! LBA: %lu, Count: %lu", LBA, count);
         return false;
     }
     return true;
 }
 
-bool FATFileSystem::WriteSector(uint32_t LBA, uint8_t* buffer, size_t count) {
-    m_Device->Seek(LBA * SectorSize, SeekPos::Set);
-    size_t write = m_Device->Write(buffer, count * SectorSize);
-    size_t expected = count * SectorSize;
-    if (write != expected) {
-        Debug::Debug(LogModule, "Write Sector failed! Expected %zu, Actual: %zu", expected, write);
+bool FATFileSystem::WriteSectorsDirect(uint32_t LBA, const uint8_t* buffer, size_t count) {
+    IOVec iov{ const_cast<uint8_t*>(buffer), count * SectorSize };
+    if (!m_Device->WriteBlocks(LBA, count, &iov, 1)) {
+        Debug::Debug(LogModule, "Direct write failed! LBA: %lu, Count: %lu", LBA, count);
         return false;
     }
+    g_BufferCache.Refresh(m_Device, LBA, count, buffer);
+    return true;
+}
+
+bool FATFileSystem::WriteSector(uint32_t LBA, uint8_t* buffer, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        BufferCache::Buffer* sector = GetSector(LBA + i, false);
+        if (!sector) {
+            Debug::Debug(LogModule, "Write Sector failed! LBA: %lu, Count: %lu", LBA, count);
+            return false;
+        }
+        Memory::Copy(sector->data, buffer + i * SectorSize, SectorSize);
+        bool ok = MarkSectorDirty(sector);
+        ReleaseSector(sector);
+        if (!ok) {
+            Debug::Debug(LogModule, "Write Sector failed! LBA: %lu, Count: %lu", LBA, count);
+            return false;
+        }
+    }
     return true;
 }
 
@@ -125,84 +215,260 @@ uint32_t FATFileSystem::ClusterToLBA(uint32_t cluster) {
 }
 
 uint32_t FATFileSystem::GetNextCluster(uint32_t currentCluster) {   
-    // determine the byte offset of the entry being read 
-    uint32_t fatIndex;
-    if (m_FatType == 12) {
-        fatIndex = currentCluster * 3 / 2;
-    } else if (m_FatType  == 16) {
-        fatIndex = currentCluster * 2;
-    } else /* if (m_FatType  == 32) */ {
-        fatIndex = currentCluster * 4;
-    }
-
-    // Make sure cache has the desired sector
-    uint32_t fatIndexSector = fatIndex / SectorSize;
-    if (fatIndexSector < m_Data->FAT_CachePosition || fatIndexSector >= (m_Data->FAT_CachePosition + FatCacheSize)) {
-        // Cache miss! Read entry from disk
-        ReadFat(fatIndexSector);
-        m_Data->FAT_CachePosition = fatIndexSector;
-    }
-
-    fatIndex -= (m_Data->FAT_CachePosition * SectorSize);
+    uint32_t nextCluster = GetFATEntry(currentCluster);
 
-    uint32_t nextCluster;
-    if (m_FatType  == 12) {
-        if (currentCluster % 2 == 0)
-            nextCluster = (*(uint16_t*)(m_Data->FAT_Cache + fatIndex)) & 0x0FFF;
-        else nextCluster = (*(uint16_t*)(m_Data->FAT_Cache + fatIndex)) >> 4;
+    // End-of-chain markers are widened to 32 bits, so callers check every FAT type against 0xFFFFFFF8
+    if (m_FatType == 12) {
         if (nextCluster >= 0xFF8)
             nextCluster |= 0xFFFFF000;
-    } else if (m_FatType  == 16) {
-        nextCluster = *(uint16_t*)(m_Data->FAT_Cache + fatIndex);
+    } else if (m_FatType == 16) {
         if (nextCluster >= 0xFFF8)
             nextCluster |= 0xFFFF0000;
-    } else /* if (m_FatType  == 32) */ {
-        nextCluster = *(uint32_t*)(m_Data->FAT_Cache + fatIndex);
+    } else /* if (m_FatType == 32) */ {
+        if (nextCluster >= 0x0FFFFFF8)
+            nextCluster |= 0xF0000000;
     }
     return nextCluster;
 }
 
-uint32_t FATFileSystem::AllocateCluster() {
-    for (uint32_t i{ 2 }; i < m_TotalClusters; i++) {
-        if (GetFATEntry(i) == 0x0) {
-            SetFATEntry(i, 0x0FFFFFFF);
-            return i;
+uint32_t FATFileSystem::AllocateCluster(uint32_t near) {
+    uint32_t count = 1;
+    return AllocateClusters(count, near);
+}
+
+uint32_t FATFileSystem::AllocateClusters(uint32_t& count, uint32_t near) {
+    uint32_t wanted = count;
+    count = 0;
+    if (!wanted || (!m_FreeBitmap && !BuildFreeBitmap())) return 0;
+    if (!m_FreeClusters) {
+        Debug::Error(LogModule, "No free clusters available!");
+        return 0;
+    }
+
+    uint32_t first = 0;
+    uint32_t length = 0;
+    if (near >= 2 && near < m_TotalClusters && IsClusterFree(near)) {
+        first = near;
+        length = FreeRunLength(near, wanted);
+    }
+
+    // Run by run from the cursor on; a run shorter than `wanted` was measured whole, so once the runs
+    // seen add up to the free count every free cluster has been looked at
+    uint32_t seen = 0;
+    for (uint32_t cluster = FindFreeCluster(m_AllocCursor); cluster && length < wanted && seen < m_FreeClusters;) {
+        uint32_t run = FreeRunLength(cluster, wanted);
+        if (run > length) {
+            first = cluster;
+            length = run;
+        }
+        seen += run;
+        cluster = FindFreeCluster(cluster + run);
+    }
+
+    for (uint32_t i = 0; i < length; i++) {
+        uint32_t next = i + 1 < length ? first + i + 1 : 0x0FFFFFFF;
+        if (!SetFATEntry(first + i, next)) {
+            Debug::Error(LogModule, "Failed to claim cluster %u", first + i);
+            while (i-- > 0) SetFATEntry(first + i, 0);
+            return 0;
+        }
+    }
+
+    m_AllocCursor = first + length < m_TotalClusters ? first + length : 2;
+    count = length;
+    return first;
+}
+
+uint32_t FATFileSystem::FreeClusterCount() {
+    if (!m_FreeBitmap && m_FSInfoFreeCount != FSInfoUnknown) return m_FSInfoFreeCount;
+    if (!m_FreeBitmap && !BuildFreeBitmap()) return 0;
+    return m_FreeClusters;
+}
+
+bool FATFileSystem::BuildFreeBitmap() {
+    uint32_t words = (m_TotalClusters + 31) / 32;
+    m_FreeBitmap = new uint32_t[words];
+    if (!m_FreeBitmap) {
+        Debug::Error(LogModule, "No memory for the free-cluster bitmap of %u clusters", m_TotalClusters);
+        return false;
+    }
+    Memory::Set(m_FreeBitmap, 0, words * sizeof(uint32_t));
+    m_FreeClusters = 0;
+
+    // FAT 0 is streamed through the cache in chunks that end on a whole FAT12 entry pair (3 bytes) as well
+    constexpr uint32_t ChunkSectors = 48;
+    uint8_t* chunk = new uint8_t[ChunkSectors * SectorSize];
+    if (!chunk) {
+        delete[] m_FreeBitmap;
+        m_FreeBitmap = nullptr;
+        return false;
+    }
+
+    uint32_t fatSectors = static_cast<uint32_t>((static_cast<uint64_t>(m_TotalClusters) * m_FatType + SectorSize * 8 - 1) / (SectorSize * 8));
+    bool ok = true;
+    for (uint32_t sector = 0; sector < fatSectors && ok; sector += ChunkSectors) {
+        uint32_t count = min(ChunkSectors, fatSectors - sector);
+        Prefetch(m_FATStart + sector, count);
+        if (!ReadSector(m_FATStart + sector, chunk, count)) {
+            ok = false;
+            break;
+        }
+
+        uint32_t firstCluster = static_cast<uint32_t>(static_cast<uint64_t>(sector) * SectorSize * 8 / m_FatType);
+        uint32_t clusters = min(count * SectorSize * 8 / m_FatType, m_TotalClusters - firstCluster);
+        for (uint32_t i = 0; i < clusters; i++) {
+            uint32_t value;
+            if (m_FatType == 12) {
+                uint16_t pair = chunk[i * 3 / 2] | (chunk[i * 3 / 2 + 1] << 8);
+                value = (i % 2 == 0) ? (pair & 0x0FFF) : (pair >> 4);
+            } else if (m_FatType == 16) {
+                value = reinterpret_cast<uint16_t*>(chunk)[i];
+            } else value = reinterpret_cast<uint32_t*>(chunk)[i] & 0x0FFFFFFF;
+
+            uint32_t cluster = firstCluster + i;
+            if (value == 0 && cluster >= 2) {
+                m_FreeBitmap[cluster / 32] |= 1u << (cluster % 32);
+                m_FreeClusters++;
+            }
         }
     }
+    delete[] chunk;
 
-    Debug::Error("FAT", "No free clusters available!");
+    if (!ok) {
+        Debug::Error(LogModule, "Failed to read the FAT while building the free-cluster bitmap");
+        delete[] m_FreeBitmap;
+        m_FreeBitmap = nullptr;
+        return false;
+    }
+
+    if (m_FSInfoLBA && m_FSInfoFreeCount != m_FreeClusters) {
+        Debug::Warn(LogModule, "FSInfo free count %u is stale, the FAT has %u free clusters", m_FSInfoFreeCount, m_FreeClusters);
+        m_FSInfoDirty = true;
+    }
+    Debug::Info(LogModule, "%u of %u clusters free", m_FreeClusters, m_TotalClusters - 2);
+    return true;
+}
+
+void FATFileSystem::MarkClusterFree(uint32_t cluster, bool free) {
+    uint32_t bit = 1u << (cluster % 32);
+    uint32_t& word = m_FreeBitmap[cluster / 32];
+    if (((word & bit) != 0) == free) return;
+
+    word ^= bit;
+    if (free) m_FreeClusters++;
+    else m_FreeClusters--;
+    m_FSInfoDirty = true;
+}
+
+uint32_t FATFileSystem::FindFreeCluster(uint32_t from) const {
+    if (from < 2 || from >= m_TotalClusters) from = 2;
+    uint32_t words = (m_TotalClusters + 31) / 32;
+
+    // Clusters 0, 1 and the bits past the last cluster are never set, so whole words can be tested
+    for (int pass = 0; pass < 2; pass++) {
+        uint32_t index = from / 32;
+        uint32_t word = m_FreeBitmap[index] & (~0u << (from % 32));
+        while (!word && ++index < words)
+            word = m_FreeBitmap[index];
+        if (word) return index * 32 + __builtin_ctz(word);
+        from = 0;
+    }
     return 0;
 }
 
+uint32_t FATFileSystem::FreeRunLength(uint32_t cluster, uint32_t limit) const {
+    uint32_t length = 0;
+    while (length < limit && cluster + length < m_TotalClusters && IsClusterFree(cluster + length))
+        length++;
+    return length;
+}
+
 bool FATFileSystem::LinkCluster(uint32_t cluster1, uint32_t cluster2) {
     return SetFATEntry(cluster1, cluster2);
 }
 
 uint32_t FATFileSystem::GetFATEntry(uint32_t clusterIndex) {
-    uint32_t fatOffset = clusterIndex * 4;
-    uint32_t sector = m_FATStart + (fatOffset / SectorSize);
-    uint32_t offset = fatOffset % SectorSize;
-
-    uint8_t sectorBuffer[SectorSize];
-    if (!ReadSector(sector, sectorBuffer)) return 0xFFFFFFFF;
+    uint8_t bytes[4] = {};
+    if (m_FatType == 12) {
+        // 12-bit entries are packed in pairs and may straddle a sector boundary
+        if (!AccessFAT(0, clusterIndex * 3 / 2, bytes, 2, false)) return 0xFFFFFFFF;
+        uint16_t pair = bytes[0] | (bytes[1] << 8);
+        return (clusterIndex % 2 == 0) ? (pair & 0x0FFF) : (pair >> 4);
+    } else if (m_FatType == 16) {
+        if (!AccessFAT(0, clusterIndex * 2, bytes, 2, false)) return 0xFFFFFFFF;
+        return bytes[0] | (bytes[1] << 8);
+    }
 
-    return *(uint32_t*)(sectorBuffer + offset) & 0x0FFFFFFF; // Mask to 28 bits
+    if (!AccessFAT(0, clusterIndex * 4, bytes, 4, false)) return 0xFFFFFFFF;
+    return *reinterpret_cast<uint32_t*>(bytes) & 0x0FFFFFFF; // Mask to 28 bits
 }
 
 bool FATFileSystem::SetFATEntry(uint32_t clusterIdx, uint32_t value) {
-    uint32_t fatOffset = clusterIdx * 4;
-    uint32_t sector = m_FATStart + (fatOffset / SectorSize);
-    uint32_t offset = fatOffset % SectorSize;
+    if (clusterIdx < 2 || clusterIdx >= m_TotalClusters) {
+        Debug::Error(LogModule, "FAT entry %u is out of range", clusterIdx);
+        return false;
+    }
+    if (!m_FreeBitmap && !BuildFreeBitmap()) return false;
 
-    uint8_t sectorBuffer[SectorSize];
-    if (!ReadSector(sector, sectorBuffer)) return false;
+    uint32_t offset;
+    size_t count;
+    if (m_FatType == 12) {
+        offset = clusterIdx * 3 / 2;
+        count = 2;
+    } else if (m_FatType == 16) {
+        offset = clusterIdx * 2;
+        count = 2;
+    } else {
+        offset = clusterIdx * 4;
+        count = 4;
+    }
+
+    for (uint32_t fat = 0; fat < m_Data->BS.BootSector.FatCount; fat++) {
+        uint8_t bytes[4];
+        if (!AccessFAT(fat, offset, bytes, count, false)) return false;
+
+        if (m_FatType == 12) {
+            uint16_t pair = bytes[0] | (bytes[1] << 8);
+            if (clusterIdx % 2 == 0) pair = (pair & 0xF000) | (value & 0x0FFF);
+            else pair = (pair & 0x000F) | ((value & 0x0FFF) << 4);
+            bytes[0] = pair & 0xFF;
+            bytes[1] = pair >> 8;
+        } else if (m_FatType == 16) {
+            bytes[0] = value & 0xFF;
+            bytes[1] = (value >> 8) & 0xFF;
+        } else {
+            // The top 4 bits are reserved and keep their value
+            uint32_t& entry = *reinterpret_cast<uint32_t*>(bytes);
+            entry = (entry & 0xF0000000) | (value & 0x0FFFFFFF);
+        }
 
-    *(uint32_t*)(sectorBuffer + offset) = (value & 0x0FFFFFFF);
-    return WriteSector(sector, sectorBuffer);
+        if (!AccessFAT(fat, offset, bytes, count, true)) return false;
+    }
+    MarkClusterFree(clusterIdx, value == 0);
+    return true;
 }
 
-bool FATFileSystem::ReadFat(uint32_t lbaOffset) {
-    return ReadSector(m_Data->BS.BootSector.ReservedSectors + lbaOffset, m_Data->FAT_Cache, FatCacheSize);
+bool FATFileSystem::AccessFAT(uint32_t fat, uint32_t offset, uint8_t* bytes, size_t count, bool write) {
+    uint32_t fatStart = m_Data->BS.BootSector.ReservedSectors + fat * m_SectorsPerFat;
+    while (count > 0) {
+        BufferCache::Buffer* sector = GetSector(fatStart + offset / SectorSize);
+        if (!sector) return false;
+
+        size_t inSector = offset % SectorSize;
+        size_t take = min(count, SectorSize - inSector);
+        bool ok = true;
+        if (write) {
+            Memory::Copy(sector->data + inSector, bytes, take);
+            ok = MarkSectorDirty(sector);
+        } else Memory::Copy(bytes, sector->data + inSector, take);
+        ReleaseSector(sector);
+        if (!ok) return false;
+
+        bytes += take;
+        offset += take;
+        count -= take;
+    }
+    return true;
 }
 
 FATFile* FATFileSystem::AllocateFile() {
@@ -221,122 +487,54 @@ void FATFileSystem::ReleaseFileEntry(FATFileEntry* entry) {
     m_Data->FileEntryPool.Free(entry);
 }
 
-bool FATFileSystem::FlushFAT() {
-    auto& bs = Data().BS.BootSector;
-    uint32_t sectorsPerFAT = (bs.FatCount > 0) ? (bs.FatCount * bs.SectorsPerFat) : 0;
-
-    if (sectorsPerFAT == 0) {
-        Debug::Error("FATFileSystem", "Invalid SectorsPerFat");
-        return false;
-    }
-
-    // Assume FAT_Cache stores FatCacheSize sectors starting at FAT_CachePosition sector
-    for (size_t i = 0; i < FatCacheSize; i++) {
-        uint32_t sectorToWrite = Data().FAT_CachePosition + i;
-        if (!WriteSector(bs.ReservedSectors + sectorToWrite, &Data().FAT_Cache[i * SectorSize])) {
-            Debug::Error("FatFileSystem", "Failed to write FAT sector %u", sectorToWrite);
-            return false;
-        }
-    }
-
-    return true;
+// FAT, directory and data sectors all live in the buffer cache, so syncing writes back this volume's dirty sectors.
+// Open files put their pending directory entry updates in the cache first, so they go out in the same flush.
+bool FATFileSystem::Sync() {
+    bool ok = true;
+    m_Data->OpenedFilePool.ForEach([&](FATFile& file) {
+        if (file.IsOpened() && !file.Flush()) ok = false;
+    });
+    ok = WriteFSInfo() && ok;
+    return g_BufferCache.Flush(m_Device) && ok;
 }
 
-bool FATFileSystem::UpdateFileEntrySize(FATFile* file, size_t size) {
-    if (file->m_IsRootDir) {
-        // for file entries in the root dir
-        uint32_t rootDirStart = file->m_FirstCluster;
-        uint32_t rootDirSectors = (Data().BS.BootSector.DirEntryCount * sizeof(FAT_DirectoryEntry)) / SectorSize;
-
-        uint8_t sectorBuffer[SectorSize];
-        for (uint32_t sector = 0; sector < rootDirSectors; sector++) {
-            uint32_t sectorLBA = rootDirStart + sector;
-            if (!ReadSector(sectorLBA, sectorBuffer)) {
-                Debug::Error("FATFileSystem", "Failed to read root dir sector %u", sectorLBA);
-                return false;
-            }
-
-            FAT_DirectoryEntry* entries = reinterpret_cast<FAT_DirectoryEntry*>(sectorBuffer);
-            size_t entryCount = SectorSize / sizeof(FAT_DirectoryEntry);
-            for (size_t i = 0; i < entryCount; i++) {
-                uint32_t firstCluster = entries[i].FirstClusterLow + ((uint32_t)entries[i].FirstClusterHigh << 16);
-                if (firstCluster == file->m_FirstCluster) {
-                    entries[i].Size = size;
-                    if (!WriteSector(sectorLBA, sectorBuffer)) {
-                        Debug::Error("FATFileSystem", "Failed to write updated root sector: %u", sectorLBA);
-                        return false;
-                    }
-                    return true;
-                }
-            }
-        }
-        Debug::Error("FATFileSystem", "File entry not found in root directory!");
-        return false;
-    } else {
-        // file entries not in root die (subdirs)
-        uint32_t cluster = file->GetParentDirCluster();
-        uint32_t sectorsPerCluster = Data().BS.BootSector.SectorsPerCluster;
-        uint8_t sectorBuffer[SectorSize];
-
-        while (cluster < 0xFFFFFFF8) {
-            for (uint32_t sectorInCluster = 0; sectorInCluster < sectorsPerCluster; sectorInCluster++) {
-                if (!ReadSectorFromCluster(cluster, sectorBuffer, sectorInCluster)) {
-                    Debug::Error("FATFileSystem", "Failed to read dir sector %u in cluster %u", sectorInCluster, cluster);
-                    return false;
-                }
-
-                FAT_DirectoryEntry* entries = reinterpret_cast<FAT_DirectoryEntry*>(sectorBuffer);
-                size_t entryCount = SectorSize / sizeof(FAT_DirectoryEntry);
-                for (size_t i = 0; i < entryCount; i++) {
-                    uint32_t firstCluster = entries[i].FirstClusterLow + ((uint32_t)entries[i].FirstClusterHigh << 16);
-                    if (firstCluster == file->m_FirstCluster) {
-                        entries[i].Size = size;
-                        if (!WriteSectorFromCluster(cluster, sectorBuffer, sectorInCluster)) {
-                            Debug::Error("FATFileSystem", "Failed to write updated dir sector %u in cluster %u", sectorInCluster, cluster);
-                            return false;
-                        }
-                        return true;
-                    }
-                }
-            }
-            cluster = GetNextCluster(cluster);
-        }
-        Debug::Error("FATFileSystem", "File entry not found in this directory!");
+bool FATFileSystem::UpdateFileEntry(FATFile* file) {
+    BufferCache::Buffer* sector = GetSector(file->m_EntryLBA);
+    if (!sector) {
+        Debug::Error(LogModule, "Failed to read directory sector %u", file->m_EntryLBA);
         return false;
     }
+
+    FAT_DirectoryEntry& entry = reinterpret_cast<FAT_DirectoryEntry*>(sector->data)[file->m_EntryIndex];
+    entry.Size = file->m_Size;
+    entry.FirstClusterLow = file->m_FirstCluster & 0xFFFF;
+    // The high half is only part of the cluster number on FAT32
+    if (m_FatType == 32) entry.FirstClusterHigh = file->m_FirstCluster >> 16;
+
+    // FAT time: hour:5 minute:6 (second/2):5, date: (year-1980):7 month:4 day:5
+    RTC::Time now;
+    RTC::GetTime(now);
+    uint32_t year = (now.cen ? now.cen * 100 : 2000) + now.year;
+    entry.ModifiedTime = (now.hour << 11) | (now.min << 5) | (now.sec / 2);
+    entry.ModifiedDate = ((year > 1980 ? year - 1980 : 0) << 9) | (now.mon << 5) | now.day;
+    entry.AccessedDate = entry.ModifiedDate;
+
+    bool ok = MarkSectorDirty(sector, DirectoryStage);
+    ReleaseSector(sector);
+    if (!ok) Debug::Error(LogModule, "Failed to write directory sector %u", file->m_EntryLBA);
+    return ok;
 }
 
 bool FATFileSystem::SetNextCluster(uint32_t cluster, uint32_t next) {
-    uint32_t fatOffset = cluster * 4;
-    uint32_t sector = m_Data->BS.BootSector.ReservedSectors + (fatOffset / SectorSize);
-    uint32_t offsetInSector = fatOffset % SectorSize;
-
-    if (!ReadFATSector(sector)) return false;
-
-    uint8_t* fat = m_Data->FAT_Cache;
-    *reinterpret_cast<uint32_t*>(&fat[offsetInSector]) = next & 0x0FFFFFFF;
-
-    return WriteFATSector(sector);
+    return SetFATEntry(cluster, next);
 }
 
 bool FATFileSystem::FreeCluster(uint32_t cluster) {
     return SetNextCluster(cluster, 0x00000000);
 }
 
-bool FATFileSystem::ReadFATSector(uint32_t sector) {
-    if (m_Data->FAT_CachePosition == sector) return true;
-    if (!ReadSector(sector, m_Data->FAT_Cache)) return false;
-
-    m_Data->FAT_CachePosition = sector;
-    return true;
-}
-
-bool FATFileSystem::WriteFATSector(uint32_t sector) {
-    return WriteSector(sector, m_Data->FAT_Cache);
-}
-
 bool FATFileSystem::FreeClusterChain(uint32_t cluster) {
-    while (cluster < 0x0FFFFFF8 || cluster != 0x00) {
+    while (cluster >= 2 && cluster < 0x0FFFFFF8) {
         uint32_t next = GetNextCluster(cluster);
 
         if (!SetNextCluster(cluster, 0x00000000)) {
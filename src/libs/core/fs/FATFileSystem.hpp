@@ -3,6 +3,8 @@
 #include "FileSystem.hpp"
 #include "FAT/FATData.hpp"
 
+#include <core/dev/BufferCache.hpp>
+
 constexpr size_t FATRequiredMemory = 0x10000;
 
 class FATFileSystem : public FileSystem {
@@ -10,16 +12,47 @@ public:
     FATFileSystem();
     virtual bool Initialize(BlockDevice* device) override;
     virtual File* RootDirectory() override;
+    virtual bool Sync() override;
+
+    // Buffer cache flush stages: file data and FAT sectors reach the disk before the directory entries pointing at them.
+    // That order only suits allocation. Freeing has to go the other way, or the disk briefly holds an entry that still
+    // points at free clusters: whoever frees clusters first writes the entry that drops them and flushes the volume
+    // (FATFile::CommitEntry), then changes the FAT, which reaches the disk with a later flush.
+    static constexpr uint8_t DataStage{ 0 };
+    static constexpr uint8_t DirectoryStage{ 1 };
+
+    // Cached sector access; the buffer stays valid until it is handed back with ReleaseSector
+    BufferCache::Buffer* GetSector(uint32_t LBA, bool read = true);
+    BufferCache::Buffer* GetSectorFromCluster(uint32_t cluster, size_t offset, bool read = true);
+    void ReleaseSector(BufferCache::Buffer* buffer);
+    bool MarkSectorDirty(BufferCache::Buffer* buffer, uint8_t stage = DataStage);
 
     bool ReadSector(uint32_t LBA, uint8_t* buffer, size_t count = 1);
+    // Reads around the buffer cache in one device call, after writing back dirty cached copies of the range
+    bool ReadSectorsDirect(uint32_t LBA, uint8_t* buffer, size_t count);
+    // Writes around the buffer cache in one device call and brings cached copies of the range up to date
+    bool WriteSectorsDirect(uint32_t LBA, const uint8_t* buffer, size_t count);
     bool WriteSector(uint32_t LBA, uint8_t* buffer, size_t count = 1);
     bool ReadSectorFromCluster(uint32_t cluster, uint8_t* buffer, size_t offset);
+    uint32_t ClusterToLBA(uint32_t cluster);
     uint32_t GetNextCluster(uint32_t currentCluster);
 
     bool WriteSectorFromCluster(uint32_t cluster, uint8_t* buffer, size_t offset);
-    uint32_t AllocateCluster();
+    // Claims a free cluster, `near` if that one is free, and marks it end of chain; 0 when the volume is full
+    uint32_t AllocateCluster(uint32_t near = 0);
+    // Claims up to `count` free clusters as one contiguous chain ending in an end-of-chain marker and returns
+    // the first. A run starting at `near` is taken if it's long enough, otherwise the first one that is, looking
+    // from the allocation cursor on, or else the longest there is. `count` is set to the run's length.
+    uint32_t AllocateClusters(uint32_t& count, uint32_t near = 0);
+    uint32_t FreeClusterCount();
     bool LinkCluster(uint32_t cluster1, uint32_t cluster2);
 
+    // Largest readahead window of sequentially read files, in clusters; 0 turns readahead off
+    void SetReadaheadWindow(uint32_t clusters) { m_ReadaheadWindow = clusters; }
+    uint32_t ReadaheadWindow() const { return m_ReadaheadWindow; }
+    // Pulls `count` sectors from `LBA` into the buffer cache ahead of use
+    void Prefetch(uint32_t LBA, size_t count);
+
     uint8_t FatType() const { return m_FatType; }
     FAT_Data& Data() { return *m_Data; }
 
@@ -29,8 +62,8 @@ public:
     FATFileEntry* AllocateFileEntry();
     void ReleaseFileEntry(FATFileEntry* entry);
 
-    bool FlushFAT();
-    bool UpdateFileEntrySize(FATFile* file, size_t size);
+    // Writes the file's size, first cluster and modification time into its directory entry, a single cached sector
+    bool UpdateFileEntry(FATFile* file);
 
     bool SetNextCluster(uint32_t cluster, uint32_t next);
     bool FreeCluster(uint32_t cluster);
@@ -40,14 +73,22 @@ public:
 private:
     bool ReadBootSector();
     void DetectFatType();
-    uint32_t ClusterToLBA(uint32_t cluster);
-    bool ReadFat(uint32_t lbaOffset);
+    void ReadFSInfo();
+    bool WriteFSInfo();
+
+    // The bitmap is built from FAT 0 before the first allocation or FAT write, read-only mounts never pay for it
+    bool BuildFreeBitmap();
+    bool IsClusterFree(uint32_t cluster) const { return m_FreeBitmap[cluster / 32] & (1u << (cluster % 32)); }
+    void MarkClusterFree(uint32_t cluster, bool free);
+    // First free cluster at or after `from`, wrapping around to cluster 2; 0 if there's none
+    uint32_t FindFreeCluster(uint32_t from) const;
+    uint32_t FreeRunLength(uint32_t cluster, uint32_t limit) const;
 
+    // Raw FAT entries of any FAT type; writes go to every FAT copy
     uint32_t GetFATEntry(uint32_t clusterIdx);
     bool SetFATEntry(uint32_t clusterIdx, uint32_t value);
-
-    bool ReadFATSector(uint32_t sector);
-    bool WriteFATSector(uint32_t sector);
+    // Copies `count` bytes at `offset` into the given FAT, through the buffer cache and across sector boundaries
+    bool AccessFAT(uint32_t fat, uint32_t offset, uint8_t* bytes, size_t count, bool write);
 
     BlockDevice* m_Device;
     FAT_Data* m_Data;
@@ -55,6 +96,17 @@ private:
     uint8_t m_FatType;
     uint32_t m_TotalSectors;
     uint32_t m_SectorsPerFat;
+    // One past the highest cluster number
     uint32_t m_TotalClusters;
     uint32_t m_FATStart;
+
+    // One bit per cluster, set while it's free
+    uint32_t* m_FreeBitmap{ nullptr };
+    uint32_t m_FreeClusters{ 0 };
+    // Where searches for free clusters start; saved as the FSInfo next-free hint
+    uint32_t m_AllocCursor{ 2 };
+    uint32_t m_FSInfoLBA{ 0 };
+    uint32_t m_FSInfoFreeCount{ FSInfoUnknown };
+    bool m_FSInfoDirty{ false };
+    uint32_t m_ReadaheadWindow{ 32 };
 };
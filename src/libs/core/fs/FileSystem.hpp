@@ -11,6 +11,8 @@ class FileSystem {
 public:
     virtual bool Initialize(BlockDevice* device) = 0;
     virtual File* RootDirectory() = 0;
+    // Writes back everything the file system still has buffered
+    virtual bool Sync() = 0;
     
     virtual File* Open(const char* path, FileOpenMode openMode);
 
@@ -0,0 +1,167 @@
+#include "SlabAllocator.hpp"
+
+#include <core/cpp/Memory.hpp>
+#include <core/Debug.hpp>
+
+constexpr const char* LogModule = "Slab";
+
+bool SlabAllocator::Initialize(uintptr_t arena_base, size_t arena_size, BackingAllocate allocate, BackingFree free) {
+    m_BackingAllocate = allocate;
+    m_BackingFree = free;
+    m_ArenaBase = arena_base & ~(SlabSize - 1);
+    m_ArenaSize = (arena_base + arena_size) - m_ArenaBase;
+
+    size_t slots = (m_ArenaSize + SlabSize - 1) / SlabSize;
+    size_t bitmap_bytes = ((slots + 31) / 32) * sizeof(uint32_t);
+    m_OwnerBitmap = static_cast<uint32_t*>(m_BackingAllocate(bitmap_bytes, sizeof(uint32_t)));
+    if (!m_OwnerBitmap) {
+        Debug::Error(LogModule, "Failed to allocate the slab owner bitmap (%u bytes)", bitmap_bytes);
+        return false;
+    }
+    Memory::Set(m_OwnerBitmap, 0, bitmap_bytes);
+
+    for (size_t i = 0; i < ClassCount; i++) {
+        m_Partial[i] = nullptr;
+        m_Empty[i] = nullptr;
+        m_SlabCount[i] = 0;
+        m_LiveObjects[i] = 0;
+    }
+
+    return true;
+}
+
+size_t SlabAllocator::ClassIndex(size_t size) {
+    if (size <= MinClassSize) return 0;
+    // Index of the smallest power of two >= size, relative to MinClassSize (2^4)
+    return (32 - __builtin_clz(static_cast<uint32_t>(size - 1))) - 4;
+}
+
+void* SlabAllocator::Allocate(size_t size) {
+    if (size > MaxClassSize || !m_OwnerBitmap) return nullptr;
+
+    size_t index = ClassIndex(size);
+    Slab* slab = m_Partial[index];
+    if (!slab) {
+        slab = m_Empty[index];
+        if (slab) m_Empty[index] = nullptr;
+        else slab = NewSlab(index);
+        if (!slab) return nullptr;
+        PushPartial(slab);
+    }
+
+    void* object;
+    if (slab->freeList) {
+        object = slab->freeList;
+        slab->freeList = *static_cast<void**>(object);
+    } else {
+        // Objects are carved lazily so a fresh slab only touches the memory it hands out
+        object = reinterpret_cast<uint8_t*>(slab) + slab->firstObject + slab->carved * ClassSize(index);
+        slab->carved++;
+    }
+
+    slab->inUse++;
+    m_LiveObjects[index]++;
+    if (!slab->freeList && slab->carved == slab->capacity) RemovePartial(slab);
+
+    return object;
+}
+
+void SlabAllocator::Free(void* ptr) {
+    if (!ptr) return;
+
+    Slab* slab = SlabOf(ptr);
+    size_t index = slab->classIndex;
+    bool wasFull = !slab->freeList && slab->carved == slab->capacity;
+
+    *static_cast<void**>(ptr) = slab->freeList;
+    slab->freeList = ptr;
+    slab->inUse--;
+    m_LiveObjects[index]--;
+
+    if (wasFull) PushPartial(slab);
+
+    if (slab->inUse == 0) {
+        RemovePartial(slab);
+        // Keep one empty slab per class around so alloc/free ping-pong doesn't hit the heap
+        if (!m_Empty[index]) m_Empty[index] = slab;
+        else ReleaseSlab(slab);
+    }
+}
+
+bool SlabAllocator::Owns(const void* ptr) const {
+    uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+    if (!m_OwnerBitmap || addr < m_ArenaBase || addr - m_ArenaBase >= m_ArenaSize) return false;
+
+    size_t slot = (addr - m_ArenaBase) / SlabSize;
+    return (m_OwnerBitmap[slot / 32] >> (slot % 32)) & 1;
+}
+
+size_t SlabAllocator::SizeOf(const void* ptr) const {
+    return ClassSize(SlabOf(ptr)->classIndex);
+}
+
+SlabAllocator::Slab* SlabAllocator::NewSlab(size_t index) {
+    Slab* slab = static_cast<Slab*>(m_BackingAllocate(SlabSize, SlabSize));
+    if (!slab) return nullptr;
+
+    uintptr_t addr = reinterpret_cast<uintptr_t>(slab);
+    if (addr < m_ArenaBase || addr + SlabSize > m_ArenaBase + m_ArenaSize) {
+        Debug::Error(LogModule, "Backing allocator returned a slab outside of the arena (0x%08X)", addr);
+        m_BackingFree(slab);
+        return nullptr;
+    }
+
+    size_t classSize = ClassSize(index);
+    size_t objectAlignment = classSize < MaxObjectAlignment ? classSize : MaxObjectAlignment;
+
+    slab->next = nullptr;
+    slab->prev = nullptr;
+    slab->freeList = nullptr;
+    slab->classIndex = static_cast<uint16_t>(index);
+    slab->inUse = 0;
+    slab->carved = 0;
+    slab->firstObject = ALIGN_UP(sizeof(Slab), objectAlignment);
+    slab->capacity = static_cast<uint16_t>((SlabSize - slab->firstObject) / classSize);
+
+    SetOwned(slab, true);
+    m_SlabCount[index]++;
+    return slab;
+}
+
+void SlabAllocator::ReleaseSlab(Slab* slab) {
+    SetOwned(slab, false);
+    m_SlabCount[slab->classIndex]--;
+    m_BackingFree(slab);
+}
+
+void SlabAllocator::PushPartial(Slab* slab) {
+    size_t index = slab->classIndex;
+    slab->prev = nullptr;
+    slab->next = m_Partial[index];
+    if (m_Partial[index]) m_Partial[index]->prev = slab;
+    m_Partial[index] = slab;
+}
+
+void SlabAllocator::RemovePartial(Slab* slab) {
+    size_t index = slab->classIndex;
+    if (slab->prev) slab->prev->next = slab->next;
+    else if (m_Partial[index] == slab) m_Partial[index] = slab->next;
+    if (slab->next) slab->next->prev = slab->prev;
+    slab->next = nullptr;
+    slab->prev = nullptr;
+}
+
+void SlabAllocator::SetOwned(const Slab* slab, bool owned) {
+    size_t slot = (reinterpret_cast<uintptr_t>(slab) - m_ArenaBase) / SlabSize;
+    if (owned) m_OwnerBitmap[slot / 32] |= (1u << (slot % 32));
+    else m_OwnerBitmap[slot / 32] &= ~(1u << (slot % 32));
+}
+
+void SlabAllocator::DumpStats() const {
+    Debug::Info(LogModule, "================ SLAB STATS ================");
+    for (size_t i = 0; i < ClassCount; i++) {
+        Debug::Info(LogModule, "Class %4u | Slabs: %4u | Live objects: %6u",
+            ClassSize(i), m_SlabCount[i], m_LiveObjects[i]);
+    }
+    Debug::Info(LogModule, "================ SLAB STATS ================");
+}
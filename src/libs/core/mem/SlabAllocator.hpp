@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Allocator.hpp"
+
+// Size-class allocator for small objects.
+// Every class (16, 32, ... 2048 bytes) owns a list of partially used slabs. A slab is a
+// SlabSize-aligned chunk taken from a backing allocator, with a small header followed by
+// equally sized objects, so both Allocate and Free are O(1).
+class SlabAllocator : public Allocator {
+public:
+    using BackingAllocate = void* (*)(uint32_t size, uint32_t alignment);
+    using BackingFree = void (*)(void* ptr);
+
+    static constexpr size_t SlabSize = 16 * 1024;
+    static constexpr size_t MinClassSize = 16;
+    static constexpr size_t MaxClassSize = 2048;
+    static constexpr size_t ClassCount = 8;
+    static constexpr size_t MaxObjectAlignment = 64;
+
+    // [arena_base, arena_base + arena_size) is the range the backing allocator hands slabs out of.
+    bool Initialize(uintptr_t arena_base, size_t arena_size, BackingAllocate allocate, BackingFree free);
+
+    static bool Handles(size_t size, size_t alignment) {
+        return alignment <= MaxObjectAlignment && size <= MaxClassSize;
+    }
+
+    virtual void* Allocate(size_t size) override;
+    virtual void Free(void* ptr) override;
+
+    bool Owns(const void* ptr) const;
+    size_t SizeOf(const void* ptr) const;
+
+    void DumpStats() const;
+
+private:
+    struct Slab {
+        Slab* next;
+        Slab* prev;
+        void* freeList;
+        uint16_t classIndex;
+        uint16_t inUse;
+        uint16_t carved;
+        uint16_t capacity;
+        uint32_t firstObject;
+    };
+
+    static size_t ClassIndex(size_t size);
+    static size_t ClassSize(size_t index) { return MinClassSize << index; }
+    static Slab* SlabOf(const void* ptr) { return reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(ptr) & ~(SlabSize - 1)); }
+
+    Slab* NewSlab(size_t index);
+    void ReleaseSlab(Slab* slab);
+    void PushPartial(Slab* slab);
+    void RemovePartial(Slab* slab);
+    void SetOwned(const Slab* slab, bool owned);
+
+    uintptr_t m_ArenaBase{ 0 };
+    size_t m_ArenaSize{ 0 };
+    uint32_t* m_OwnerBitmap{ nullptr };
+
+    BackingAllocate m_BackingAllocate{ nullptr };
+    BackingFree m_BackingFree{ nullptr };
+
+    Slab* m_Partial[ClassCount]{};
+    Slab* m_Empty[ClassCount]{};
+
+    uint32_t m_SlabCount[ClassCount]{};
+    uint32_t m_LiveObjects[ClassCount]{};
+};
@@ -11,6 +11,9 @@ public:
     
     T* Allocate();
     void Free(T* obj);
+    // Calls `fn` with every object currently allocated
+    template <typename Fn>
+    void ForEach(Fn fn);
 
 private:
     T m_Pool[PoolSize];
@@ -49,3 +52,11 @@ void StaticObjectPool<T, PoolSize>::Free(T* obj) {
     m_ObjectMask[idx] = false;
     m_PoolSize--;
 }
+
+template <typename T, size_t PoolSize>
+template <typename Fn>
+void StaticObjectPool<T, PoolSize>::ForEach(Fn fn) {
+    for (size_t i = 0; i < PoolSize; i++) {
+        if (m_ObjectMask[i]) fn(m_Pool[i]);
+    }
+}
@@ -0,0 +1,276 @@
+#include "TLSFHeap.hpp"
+
+#include <core/cpp/Memory.hpp>
+#include <core/Debug.hpp>
+
+constexpr const char* LogModule = "TLSF";
+
+static inline size_t FindLastSet(uint32_t value) { return 31 - __builtin_clz(value); }
+static inline size_t FindFirstSet(uint32_t value) { return __builtin_ctz(value); }
+
+bool TLSFHeap::Initialize(uintptr_t base, size_t size) {
+    uintptr_t begin = ALIGN_UP(base, Alignment);
+    uintptr_t end = (base + size) & ~(Alignment - 1);
+    if (end <= begin || end - begin < 2 * HeaderSize + MinPayload) {
+        Debug::Error(LogModule, "Heap region [0x%08X - 0x%08X] is too small", base, base + size);
+        return false;
+    }
+
+    m_Base = begin;
+    m_Size = end - begin;
+    m_FLBitmap = 0;
+    for (size_t fl = 0; fl < FLCount; fl++) {
+        m_SLBitmap[fl] = 0;
+        for (size_t sl = 0; sl < SLCount; sl++)
+            m_Free[fl][sl] = nullptr;
+    }
+
+    // One free block spanning the region, terminated by a zero-sized used sentinel
+    m_First = reinterpret_cast<Block*>(begin);
+    m_First->prevPhys = nullptr;
+    m_First->size = static_cast<uint32_t>(m_Size - 2 * HeaderSize);
+
+    Block* sentinel = NextPhys(m_First);
+    sentinel->prevPhys = m_First;
+    sentinel->size = 0;
+
+    MarkFree(m_First);
+    InsertFree(m_First);
+    return true;
+}
+
+bool TLSFHeap::Extend(size_t size) {
+    size &= ~(Alignment - 1);
+    if (!m_First || size < HeaderSize + MinPayload) return false;
+
+    // The old sentinel becomes the header of the new block, and a new sentinel goes at the new end
+    Block* block = reinterpret_cast<Block*>(m_Base + m_Size - HeaderSize);
+    SetSize(block, static_cast<uint32_t>(size - HeaderSize));
+    m_Size += size;
+
+    Block* sentinel = NextPhys(block);
+    sentinel->prevPhys = block;
+    sentinel->size = 0;
+
+    block = MergePrev(block);
+    MarkFree(block);
+    InsertFree(block);
+    return true;
+}
+
+void TLSFHeap::MappingInsert(size_t size, size_t& fl, size_t& sl) {
+    if (size < SmallBlockSize) {
+        fl = 0;
+        sl = size / (SmallBlockSize / SLCount);
+    } else {
+        size_t msb = FindLastSet(static_cast<uint32_t>(size));
+        sl = (size >> (msb - SLCountLog2)) ^ SLCount;
+        fl = msb - (FLShift - 1);
+    }
+}
+
+void TLSFHeap::MappingSearch(size_t size, size_t& fl, size_t& sl) {
+    // Round up to the next list boundary so any block found in the list is large enough
+    if (size >= SmallBlockSize) {
+        size_t round = (1u << (FindLastSet(static_cast<uint32_t>(size)) - SLCountLog2)) - 1;
+        if (size + round > size) size += round;
+    }
+    MappingInsert(size, fl, sl);
+}
+
+void TLSFHeap::InsertFree(Block* block) {
+    size_t fl, sl;
+    MappingInsert(SizeOf(block), fl, sl);
+
+    Block* head = m_Free[fl][sl];
+    block->prevFree = nullptr;
+    block->nextFree = head;
+    if (head) head->prevFree = block;
+    m_Free[fl][sl] = block;
+
+    m_FLBitmap |= (1u << fl);
+    m_SLBitmap[fl] |= (1u << sl);
+}
+
+void TLSFHeap::RemoveFree(Block* block) {
+    size_t fl, sl;
+    MappingInsert(SizeOf(block), fl, sl);
+
+    if (block->nextFree) block->nextFree->prevFree = block->prevFree;
+    if (block->prevFree) block->prevFree->nextFree = block->nextFree;
+    else {
+        m_Free[fl][sl] = block->nextFree;
+        if (!m_Free[fl][sl]) {
+            m_SLBitmap[fl] &= ~(1u << sl);
+            if (!m_SLBitmap[fl]) m_FLBitmap &= ~(1u << fl);
+        }
+    }
+}
+
+TLSFHeap::Block* TLSFHeap::FindFree(size_t size) {
+    size_t fl, sl;
+    MappingSearch(size, fl, sl);
+    if (fl >= FLCount) return nullptr;
+
+    uint32_t slMap = m_SLBitmap[fl] & (~0u << sl);
+    if (!slMap) {
+        uint32_t flMap = (fl + 1 < 32) ? (m_FLBitmap & (~0u << (fl + 1))) : 0;
+        if (!flMap) return nullptr;
+        fl = FindFirstSet(flMap);
+        slMap = m_SLBitmap[fl];
+    }
+    sl = FindFirstSet(slMap);
+
+    Block* block = m_Free[fl][sl];
+    RemoveFree(block);
+    return block;
+}
+
+void TLSFHeap::MarkFree(Block* block) {
+    block->size |= BlockFree;
+    Block* next = NextPhys(block);
+    next->prevPhys = block;
+    next->size |= PrevFree;
+}
+
+void TLSFHeap::MarkUsed(Block* block) {
+    block->size &= ~BlockFree;
+    NextPhys(block)->size &= ~PrevFree;
+}
+
+// Cuts `block` down to `size` bytes of payload and returns the remainder, or nullptr if it's too small to stand alone.
+TLSFHeap::Block* TLSFHeap::Split(Block* block, size_t size) {
+    size_t blockSize = SizeOf(block);
+    if (blockSize < size + HeaderSize + MinPayload) return nullptr;
+
+    Block* rest = reinterpret_cast<Block*>(reinterpret_cast<uintptr_t>(block) + HeaderSize + size);
+    rest->size = static_cast<uint32_t>(blockSize - size - HeaderSize);
+    SetSize(block, static_cast<uint32_t>(size));
+
+    rest->prevPhys = block;
+    NextPhys(rest)->prevPhys = rest;
+    return rest;
+}
+
+TLSFHeap::Block* TLSFHeap::MergePrev(Block* block) {
+    if (!IsPrevFree(block)) return block;
+
+    Block* prev = block->prevPhys;
+    RemoveFree(prev);
+    SetSize(prev, SizeOf(prev) + HeaderSize + SizeOf(block));
+    NextPhys(prev)->prevPhys = prev;
+    return prev;
+}
+
+TLSFHeap::Block* TLSFHeap::MergeNext(Block* block) {
+    Block* next = NextPhys(block);
+    if (!IsFree(next)) return block;
+
+    RemoveFree(next);
+    SetSize(block, SizeOf(block) + HeaderSize + SizeOf(next));
+    NextPhys(block)->prevPhys = block;
+    return block;
+}
+
+void* TLSFHeap::Allocate(size_t size, size_t alignment) {
+    if (!m_First) return nullptr;
+
+    size = ALIGN_UP(size < MinPayload ? MinPayload : size, Alignment);
+    if (alignment < Alignment) alignment = Alignment;
+
+    // Over-allocate for stricter alignment so a leading gap block can always be split off
+    size_t search = size;
+    if (alignment > Alignment) search += alignment + HeaderSize + MinPayload;
+
+    Block* block = FindFree(search);
+    if (!block) return nullptr;
+
+    if (alignment > Alignment) {
+        uintptr_t payload = reinterpret_cast<uintptr_t>(ToPointer(block));
+        uintptr_t aligned = ALIGN_UP(payload, alignment);
+        if (aligned != payload && aligned - payload < HeaderSize + MinPayload)
+            aligned = ALIGN_UP(payload + HeaderSize + MinPayload, alignment);
+
+        if (aligned != payload) {
+            Block* gap = block;
+            block = Split(gap, aligned - payload - HeaderSize);
+            MarkFree(gap);
+            InsertFree(gap);
+        }
+    }
+
+    Block* rest = Split(block, size);
+    if (rest) {
+        MarkFree(rest);
+        InsertFree(rest);
+    }
+
+    MarkUsed(block);
+    return ToPointer(block);
+}
+
+void TLSFHeap::Free(void* ptr) {
+    if (!ptr) return;
+
+    Block* block = FromPointer(ptr);
+    if (IsFree(block)) {
+        Debug::Error(LogModule, "Double free of %p", ptr);
+        return;
+    }
+
+    block = MergePrev(block);
+    block = MergeNext(block);
+    MarkFree(block);
+    InsertFree(block);
+}
+
+bool TLSFHeap::ResizeInPlace(void* ptr, size_t size) {
+    Block* block = FromPointer(ptr);
+    size = ALIGN_UP(size < MinPayload ? MinPayload : size, Alignment);
+
+    size_t current = SizeOf(block);
+    if (size > current) {
+        Block* next = NextPhys(block);
+        if (!IsFree(next) || current + HeaderSize + SizeOf(next) < size) return false;
+        MergeNext(block);
+    }
+
+    Block* rest = Split(block, size);
+    if (rest) {
+        rest = MergeNext(rest);
+        MarkFree(rest);
+        InsertFree(rest);
+    }
+    MarkUsed(block);
+    return true;
+}
+
+size_t TLSFHeap::UsableSize(const void* ptr) const {
+    return SizeOf(FromPointer(ptr));
+}
+
+bool TLSFHeap::Contains(const void* ptr) const {
+    uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+    return addr >= m_Base && addr < m_Base + m_Size;
+}
+
+void TLSFHeap::Dump() const {
+    Debug::Info(LogModule, "================ HEAP DUMP ================");
+    size_t total_free = 0, total_used = 0;
+    size_t free_blocks = 0, used_blocks = 0;
+
+    for (const Block* block = m_First; block && SizeOf(block) != 0; block = NextPhys(block)) {
+        if (IsFree(block)) {
+            total_free += SizeOf(block);
+            free_blocks++;
+        } else {
+            total_used += SizeOf(block);
+            used_blocks++;
+        }
+    }
+
+    Debug::Info(LogModule, "Region [%08X - %08X]", m_Base, m_Base + m_Size);
+    Debug::Info(LogModule, "Used: %u blocks, %u bytes (%uMB)", used_blocks, total_used, total_used / 1024 / 1024);
+    Debug::Info(LogModule, "Free: %u blocks, %u bytes (%uMB)", free_blocks, total_free, total_free / 1024 / 1024);
+    Debug::Info(LogModule, "================ HEAP DUMP ================");
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Two-Level Segregated Fit heap.
+// Free blocks are binned by size into FLCount x SLCount lists, with a bitmap per level so
+// finding a fitting list is a couple of bit scans. Every block carries a boundary tag
+// (pointer to its physical predecessor), so freeing coalesces with both neighbours in O(1).
+// Only free blocks are ever looked at, regardless of how many live allocations exist.
+class TLSFHeap {
+public:
+    static constexpr size_t Alignment = 8;
+
+    bool Initialize(uintptr_t base, size_t size);
+    // Appends `size` bytes of memory directly following the current end of the heap.
+    bool Extend(size_t size);
+
+    void* Allocate(size_t size, size_t alignment = Alignment);
+    void Free(void* ptr);
+
+    // Grows or shrinks an allocation without moving it; returns false if the neighbour can't supply the space.
+    bool ResizeInPlace(void* ptr, size_t size);
+    size_t UsableSize(const void* ptr) const;
+
+    bool Contains(const void* ptr) const;
+    uintptr_t Base() const { return m_Base; }
+    size_t Size() const { return m_Size; }
+
+    void Dump() const;
+
+private:
+    struct Block {
+        Block* prevPhys;
+        uint32_t size;      // payload size, low bits hold the flags below
+        // Only valid while the block is free
+        Block* nextFree;
+        Block* prevFree;
+    };
+
+    static constexpr uint32_t BlockFree = 1u << 0;
+    static constexpr uint32_t PrevFree = 1u << 1;
+    static constexpr uint32_t FlagMask = BlockFree | PrevFree;
+
+    static constexpr size_t HeaderSize = offsetof(Block, nextFree);
+    static constexpr size_t MinPayload = sizeof(Block) - HeaderSize;
+
+    static constexpr size_t SLCountLog2 = 5;
+    static constexpr size_t SLCount = 1 << SLCountLog2;
+    static constexpr size_t FLShift = SLCountLog2 + 3;
+    static constexpr size_t SmallBlockSize = 1 << FLShift;
+    static constexpr size_t FLMax = 31;
+    static constexpr size_t FLCount = FLMax - FLShift + 2;
+
+    static uint32_t SizeOf(const Block* block) { return block->size & ~FlagMask; }
+    static bool IsFree(const Block* block) { return block->size & BlockFree; }
+    static bool IsPrevFree(const Block* block) { return block->size & PrevFree; }
+    static void SetSize(Block* block, uint32_t size) { block->size = size | (block->size & FlagMask); }
+
+    static Block* FromPointer(const void* ptr) { return reinterpret_cast<Block*>(reinterpret_cast<uintptr_t>(ptr) - HeaderSize); }
+    static void* ToPointer(Block* block) { return reinterpret_cast<uint8_t*>(block) + HeaderSize; }
+    static Block* NextPhys(const Block* block) { return reinterpret_cast<Block*>(reinterpret_cast<uintptr_t>(block) + HeaderSize + SizeOf(block)); }
+
+    static void MappingInsert(size_t size, size_t& fl, size_t& sl);
+    static void MappingSearch(size_t size, size_t& fl, size_t& sl);
+
+    void InsertFree(Block* block);
+    void RemoveFree(Block* block);
+    Block* FindFree(size_t size);
+
+    void MarkFree(Block* block);
+    void MarkUsed(Block* block);
+    Block* Split(Block* block, size_t size);
+    Block* MergePrev(Block* block);
+    Block* MergeNext(Block* block);
+
+    uintptr_t m_Base{ 0 };
+    size_t m_Size{ 0 };
+    Block* m_First{ nullptr };
+
+    uint32_t m_FLBitmap{ 0 };
+    uint32_t m_SLBitmap[FLCount]{};
+    Block* m_Free[FLCount][SLCount]{};
+};